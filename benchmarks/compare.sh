@@ -0,0 +1,41 @@
+#!/usr/bin/env bash
+# Compara dos resultados de benchmarks/run.sh: valor anterior, nuevo y cambio en %.
+# Los valores son tiempos o tamaños, así que un cambio negativo es una mejora.
+
+set -euo pipefail
+
+if [ $# -ne 2 ]; then
+    echo "Usage: benchmarks/compare.sh before.jsonl after.jsonl" >&2
+    exit 1
+fi
+
+awk '
+function parse(line, values,    fields, count, i, pair) {
+    gsub(/^[ \t]*\{|\}[ \t]*$/, "", line)
+    count = split(line, fields, /, "/)
+    for (i = 1; i <= count; i++) {
+        split(fields[i], pair, /": /)
+        gsub(/"/, "", pair[1])
+        gsub(/"/, "", pair[2])
+        values[pair[1]] = pair[2]
+    }
+}
+FNR == 1 { file++ }
+{
+    delete values
+    parse($0, values)
+    name = values["benchmark"]
+    if (file == 1) {
+        for (key in values) before[name, key] = values[key]
+        next
+    }
+    printf "%s\n", name
+    for (key in values) {
+        if (key == "benchmark" || key == "revision" || key == "scale" || !((name, key) in before)) continue
+        old = before[name, key] + 0
+        new = values[key] + 0
+        change = old ? sprintf("%+.1f%%", (new - old) * 100 / old) : "n/a"
+        printf "  %-20s %14d %14d %9s\n", key, old, new, change
+    }
+}
+' "$1" "$2"
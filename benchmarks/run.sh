@@ -0,0 +1,275 @@
+#!/usr/bin/env bash
+# Benchmarks de LightPath con proyectos sintéticos.
+# Cada resultado es una línea JSON (JSON Lines) para poder comparar versiones:
+#
+#   benchmarks/run.sh > before.jsonl
+#   (cambiar lightpath)
+#   benchmarks/run.sh > after.jsonl
+#   benchmarks/compare.sh before.jsonl after.jsonl
+#
+# Tiempos en microsegundos, tamaños en bytes. El progreso va a stderr.
+
+set -euo pipefail
+
+usage() {
+    cat >&2 <<'EOF'
+Usage: benchmarks/run.sh [options]
+  --scale quick|full   quick (default): up to 10k commands and 64 MB files
+                       full: up to 100k commands and multi-GB files, one of them
+                       over 4 GB (Zip64); needs about 40 GB of free disk
+  --lightpath PATH     lightpath binary to measure (default: build source/lightpath.c)
+  --work DIR           directory for the synthetic projects (default: a temporary one)
+  --repeat N           runs per startup measurement, the median is kept (default: 5)
+  --only NAME          run only the benchmarks whose name contains NAME
+  --keep               keep the work directory
+EOF
+    exit 1
+}
+
+repo_dir=$(cd "$(dirname "$0")/.." && pwd)
+scale=quick
+lightpath=
+work=
+repeat=5
+only=
+keep=0
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --scale) scale=${2:-}; shift 2 ;;
+        --lightpath) lightpath=${2:-}; shift 2 ;;
+        --work) work=${2:-}; shift 2 ;;
+        --repeat) repeat=${2:-}; shift 2 ;;
+        --only) only=${2:-}; shift 2 ;;
+        --keep) keep=1; shift ;;
+        *) usage ;;
+    esac
+done
+case "$scale" in quick|full) ;; *) usage ;; esac
+
+if [ -z "$work" ]; then
+    work=$(mktemp -d "${TMPDIR:-/tmp}/lightpath-bench.XXXXXX")
+fi
+mkdir -p "$work"
+work=$(cd "$work" && pwd)
+if [ "$keep" = 0 ]; then
+    trap 'rm -rf "$work"' EXIT
+fi
+
+if [ -z "$lightpath" ]; then
+    echo "Building lightpath from source/lightpath.c" >&2
+    gcc -O2 -o "$work/lightpath" "$repo_dir/source/lightpath.c"
+    lightpath="$work/lightpath"
+fi
+lightpath=$(cd "$(dirname "$lightpath")" && pwd)/$(basename "$lightpath")
+revision=$(git -C "$repo_dir" describe --always --dirty 2>/dev/null || echo unknown)
+
+now_us() {
+    echo $(( $(date +%s%N) / 1000 ))
+}
+
+# Tiempo de una fase en el perfil de --profile (cada fase ocupa una línea)
+phase_us() {
+    sed -n "s/.*{\"name\": \"$2\", \"category\": \"phase\".*\"wall_us\": \([0-9]*\),.*/\1/p" "$1" | head -n 1
+}
+
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { print (NR ? v[int((NR + 1) / 2)] : 0) }'
+}
+
+selected() {
+    [ -z "$only" ] || [[ "$1" == *"$only"* ]]
+}
+
+emit() {
+    local name=$1
+    shift
+    local line="{\"benchmark\": \"$name\", \"revision\": \"$revision\", \"scale\": \"$scale\""
+    while [ $# -gt 0 ]; do
+        line="$line, \"$1\": $2"
+        shift 2
+    done
+    echo "$line}"
+}
+
+# build.path con N comandos repartidos en funciones de 10
+write_commands_project() {
+    local dir=$1 commands=$2
+    mkdir -p "$dir"
+    awk -v commands="$commands" 'BEGIN {
+        print "build {"
+        print "    build_version = \"1.0\""
+        print "    command \"echo building\""
+        print "}"
+        print ""
+        print "main {"
+        print "    command \"true\""
+        print "}"
+        print ""
+        print "bench_noop {"
+        print "    command \"true\""
+        print "}"
+        for (i = 0; i < commands; i++) {
+            if (i % 10 == 0) printf "%sstep_%d {\n", (i ? "}\n\n" : "\n"), i / 10
+            if (i % 10 == 0 && i >= 10) printf "    needs = \"step_%d\"\n", i / 10 - 1
+            printf "    command \"echo \\\"step %d\\\" && test -d . # %s\"\n", i, "synthetic command padding"
+        }
+        if (commands > 0) print "}"
+    }' > "$dir/build.path"
+}
+
+bench_commands() {
+    local commands=$1 name="commands_$1" dir="$work/commands_$1"
+    selected "$name" || return 0
+    echo "$name" >&2
+    write_commands_project "$dir" "$commands"
+    (
+        cd "$dir"
+        rm -rf .lightpath
+        "$lightpath" --profile parse.json bench_noop >/dev/null
+        "$lightpath" --profile cached.json bench_noop >/dev/null
+        local start end
+        start=$(now_us)
+        "$lightpath" step_0 >/dev/null
+        end=$(now_us)
+        emit "$name" commands "$commands" build_path_bytes "$(stat -c %s build.path)" \
+            parse_us "$(phase_us parse.json 'load build.path')" \
+            parse_cached_us "$(phase_us cached.json 'load build.path')" \
+            function_run_us $((end - start))
+    )
+}
+
+# Árboles de source/: muchos archivos diminutos, texto mediano o pocos archivos grandes
+write_source_tree() {
+    local dir=$1 kind=$2 count=$3 size=$4
+    mkdir -p "$dir/source"
+    case "$kind" in
+        tiny)
+            awk -v count="$count" -v dir="$dir/source" 'BEGIN {
+                for (i = 0; i < count; i++) {
+                    sub_dir = dir "/d" int(i / 500)
+                    if (i % 500 == 0) system("mkdir -p " sub_dir)
+                    file = sub_dir "/f" i ".txt"
+                    printf "file %d of the synthetic tree\n", i > file
+                    close(file)
+                }
+            }'
+            ;;
+        text)
+            for ((i = 0; i < count; i++)); do
+                seq 1 $((size / 48)) | awk -v n="$i" '{ printf "%08d line of module %d, value = %d;\n", $1, n, $1 * 7 }' \
+                    > "$dir/source/module_$i.c"
+            done
+            ;;
+        large)
+            for ((i = 0; i < count; i++)); do
+                # Mitad texto comprimible, mitad aleatorio
+                { seq 1 $((size / 2 / 40)) | awk '{ printf "%010d synthetic large row %08x\n", $1, $1 }'
+                  head -c $((size / 2)) /dev/urandom; } > "$dir/source/blob_$i.bin"
+            done
+            ;;
+    esac
+    # Un archivo disperso de menos de 4 MB (un solo bloque) con datos en medio:
+    # lightpath_app falla al arrancar, y con él el benchmark, si no se extrae bien
+    truncate -s 1M "$dir/source/sparse.bin"
+    printf 'sparse data' | dd of="$dir/source/sparse.bin" bs=1 seek=524288 conv=notrunc status=none
+    printf '#!/bin/sh\nexit 0\n' > "$dir/source/start.sh"
+    chmod +x "$dir/source/start.sh"
+}
+
+bench_source() {
+    local kind=$1 count=$2 size=$3 codec=$4
+    local name="source_${kind}_${count}x${size}_${codec}" dir="$work/source_${kind}_${count}x${size}"
+    selected "$name" || return 0
+    echo "$name" >&2
+    if [ ! -d "$dir/source" ]; then
+        write_source_tree "$dir" "$kind" "$count" "$size"
+    fi
+    cat > "$dir/build.path" <<EOF
+build {
+    compression = "$codec"
+    build
+}
+
+main {
+    cache = "true"
+    cache_limit = "64G"
+    command "./start.sh"
+}
+EOF
+    (
+        cd "$dir"
+        rm -rf .lightpath lightpath_app
+        local start end build_us rebuild_us touch_us source_bytes
+        start=$(now_us)
+        "$lightpath" --profile build.json >/dev/null
+        end=$(now_us)
+        build_us=$((end - start))
+
+        start=$(now_us)
+        "$lightpath" >/dev/null
+        end=$(now_us)
+        rebuild_us=$((end - start))
+
+        touch source/start.sh
+        start=$(now_us)
+        "$lightpath" --profile touch.json >/dev/null
+        end=$(now_us)
+        touch_us=$((end - start))
+        source_bytes=$(find source -type f -printf '%s\n' | awk '{ total += $1 } END { printf "%.0f\n", total }')
+
+        # Arranque en frío: caché de extracción vacía; en caliente: ya extraída.
+        # Cada arranque en frío usa un directorio nuevo y nada se borra hasta el
+        # final: borrar miles de archivos retrasa las escrituras siguientes
+        # (discard de ext4) y falsea los tiempos.
+        local cold=() warm=() cache_dir
+        for ((r = 0; r < repeat; r++)); do
+            cache_dir="$dir/app_cache.$codec.$r"
+            sync
+            start=$(now_us)
+            LIGHTPATH_CACHE_DIR="$cache_dir" ./lightpath_app >/dev/null
+            end=$(now_us)
+            cold+=($((end - start)))
+        done
+        for ((r = 0; r < repeat; r++)); do
+            start=$(now_us)
+            LIGHTPATH_CACHE_DIR="$cache_dir" ./lightpath_app >/dev/null
+            end=$(now_us)
+            warm+=($((end - start)))
+        done
+
+        emit "$name" files "$count" source_bytes "$source_bytes" \
+            build_us "$build_us" pack_us "$(phase_us build.json 'pack source')" \
+            write_app_us "$(phase_us build.json 'write lightpath_app')" \
+            noop_rebuild_us "$rebuild_us" touch_rebuild_us "$touch_us" \
+            touch_pack_us "$(phase_us touch.json 'pack source')" \
+            payload_bytes "$(stat -c %s .lightpath/source_packed.zip)" \
+            app_bytes "$(stat -c %s lightpath_app)" \
+            startup_cold_us "$(printf '%s\n' "${cold[@]}" | median)" \
+            startup_warm_us "$(printf '%s\n' "${warm[@]}" | median)"
+        # Las extracciones de varios GB no caben todas a la vez en el disco
+        rm -rf "$dir"/app_cache.*
+    )
+}
+
+if [ "$scale" = quick ]; then
+    command_scales="10 1000 10000"
+    source_sets="tiny:5000:32 text:200:65536 large:2:33554432"
+else
+    command_scales="10 1000 10000 100000"
+    # Un archivo de 4.5 GB: su entrada es Zip64 y se empaqueta y extrae por trozos
+    source_sets="tiny:100000:32 text:2000:65536 large:4:268435456 large:2:1610612736 large:1:4831838208"
+fi
+
+for commands in $command_scales; do
+    bench_commands "$commands"
+done
+for set in $source_sets; do
+    IFS=: read -r kind count size <<< "$set"
+    for codec in deflate fast max none; do
+        # "max" sobre varios GB tarda demasiado para una pasada normal
+        if [ "$codec" = max ] && [ "$size" -gt 268435456 ]; then
+            continue
+        fi
+        bench_source "$kind" "$count" "$size" "$codec"
+    done
+done
@@ -4,7 +4,9 @@
  * Hecho con amor en C para máxima eficiencia
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,13 +14,64 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/file.h>
+#include <ftw.h>
+#include <spawn.h>
+#include <sys/inotify.h>
+#include <fnmatch.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#ifndef FICLONE
+#define FICLONE _IOW(0x94, 9, int)
+#endif
 
 #define MAX_PATH_LENGTH 1024
-#define MAX_COMMAND_LENGTH 512
-#define MAX_COMMANDS 100
-#define MAX_TOKEN_LENGTH 256
 #define MAX_TOKENS 1000
 #define LIGHTPATH_VERSION 1
+#define DEFAULT_CACHE_LIMIT (2ULL << 30)
+#define DEFAULT_ARTIFACT_CACHE_LIMIT (10ULL << 30)
+#define STATE_DIR ".lightpath"
+#define ARENA_RESERVE (1ULL << 30)
+#define ARENA_COMMIT_STEP (1 << 20)
+#define PROJECT_CACHE STATE_DIR "/project.cache"
+#define PROJECT_CACHE_FORMAT 4
+#define METHOD_STORED 0
+#define METHOD_DEFLATE 8
+#define METHOD_FAST 100     // métodos privados de lightpath (fuera de APPNOTE)
+#define METHOD_MAX 101
+#define METHOD_LINK 0xffff  // sólo en el manifiesto: duplicado guardado como enlace
+#define LINK_EXTRA_ID 0x4c50 // campo extra "PL": ruta del archivo con el mismo contenido
+#define SPARSE_EXTRA_ID 0x5350 // campo extra "PS": archivo disperso (los bloques a cero son huecos)
+#define ZIP64_EXTRA_ID 0x0001
+#define ZIP64_LIMIT 0xffffffffULL
+#define PACK_CHUNK_SIZE (4 << 20) // los archivos mayores se comprimen y extraen por trozos
+#define MEMO_DIR STATE_DIR "/memo" // último resultado de las funciones con inputs/outputs
+#define WATCH_QUIET_MS 100      // lightpath watch compila tras este silencio sin eventos
+#define WATCH_MAX_DELAY_MS 2000 // ... o como mucho tras este tiempo si no paran
+#define INSPECT_FILE_US 15       // lightpath inspect: coste estimado de crear un archivo,
+#define INSPECT_LINK_US 10       // ... un enlace
+#define INSPECT_DIRECTORY_US 8   // ... un directorio
+#define INSPECT_WRITE_MBS 1500   // ... y velocidades de escritura y de descompresión
+#define INSPECT_DEFLATE_MBS 350
+#define INSPECT_FAST_MBS 2000
+#define INSPECT_MAX_MBS 120
+#define SERVER_SOCKET STATE_DIR "/server.sock" // lightpath server (ruta relativa: cabe en sun_path)
+#define SERVER_LOCK STATE_DIR "/server.lock"
+#define SERVER_MAGIC "LPSERVE1"
+#define SERVER_REFUSED (-1)      // respuesta: el cliente ejecuta la petición por su cuenta
+#define SERVER_MAX_REQUEST (16 << 20)
+#define PROJECT_CACHE_LAYOUT ((uint32_t)(sizeof(Command) | sizeof(FunctionBlock) << 10 | sizeof(ProjectRoot) << 20))
 
 // Tipos de tokens
 typedef enum {
@@ -31,69 +84,526 @@ typedef enum {
     TOKEN_UNKNOWN
 } TokenType;
 
-// Estructura de token
+// Estructura de token: el valor apunta al buffer del archivo, no es una copia.
+// Los strings se decodifican en el sitio y terminan en '\0'; los identificadores
+// sólo se delimitan por length.
 typedef struct {
     TokenType type;
-    char value[MAX_TOKEN_LENGTH];
+    char* value;
+    size_t length;
     int line;
     int column;
 } Token;
 
+// Códecs del payload (compression = "fast" | "max" | "none"; por defecto DEFLATE)
+typedef enum {
+    CODEC_DEFLATE,
+    CODEC_FAST,
+    CODEC_MAX,
+    CODEC_NONE
+} Codec;
+
+static const char* const codec_names[] = {"deflate", "fast", "max", "none"};
+
+// Desplazamiento dentro de la arena del proyecto (0 = nulo)
+typedef uint32_t ArenaRef;
+
+// Arena: una reserva de memoria virtual que sólo crece. La base no se mueve,
+// y el modelo se enlaza con desplazamientos para poder volcarlo tal cual.
+typedef struct {
+    unsigned char* base;
+    size_t size;
+    size_t committed;
+    size_t reserved;
+} Arena;
+
+#define ARENA_AT(arena, type, ref) ((type*)((arena)->base + (ref)))
+
 // Estructura para comandos con variables dinámicas
 typedef struct {
-    char command[MAX_COMMAND_LENGTH];
+    ArenaRef command;
     int build_version_at_time;
-    char path_mode_at_time[32];
+    ArenaRef path_mode_at_time;
+    int group;
 } Command;
 
 typedef struct {
-    Command commands[MAX_COMMANDS];
+    ArenaRef name;
+    int index;                 // posición entre las funciones personalizadas (-1 = build/main)
+    ArenaRef next;             // siguiente función del mismo cubo de la tabla hash
+    ArenaRef commands;         // Command[command_capacity]
     int command_count;
+    int command_capacity;
     int final_build_version;
-    char final_path_mode[32];
+    ArenaRef final_path_mode;
     int has_build;
     int required_lightpath_version;
+    int jobs;
+    int cache;
+    unsigned long long cache_limit;
+    int compression;           // Codec
+    ArenaRef needs;            // ArenaRef[needs_capacity] con los nombres
+    int needs_count;
+    int needs_capacity;
+    int group_count;
+    ArenaRef inputs;           // ArenaRef[input_capacity] con los patrones de inputs = "..."
+    int input_count;
+    int input_capacity;
+    ArenaRef outputs;          // ArenaRef[output_capacity] con los patrones de outputs = "..."
+    int output_count;
+    int output_capacity;
+    ArenaRef targets;          // ArenaRef[target_capacity]: funciones con otra variante de lightpath_app
+    int target_count;
+    int target_capacity;
+    ArenaRef hot;              // ArenaRef[hot_capacity]: patrones de hot = "..." (se extraen antes de arrancar)
+    int hot_count;
+    int hot_capacity;
+    ArenaRef hot_file;         // archivo de source/ con más patrones, uno por línea (0 = ninguno)
 } FunctionBlock;
 
+// Raíz del modelo, al principio de la arena
+typedef struct {
+    ArenaRef build_func;
+    ArenaRef main_func;
+    ArenaRef functions;        // ArenaRef[function_capacity] en orden de aparición
+    int function_count;
+    int function_capacity;
+    ArenaRef buckets;          // ArenaRef[bucket_count]: nombre -> función
+    int bucket_count;
+    ArenaRef default_path_mode;
+} ProjectRoot;
+
 // Estructura principal del proyecto
 typedef struct {
-    FunctionBlock build_func;
-    FunctionBlock main_func;
-    FunctionBlock custom_funcs[10];
-    char custom_func_names[10][64];
-    int custom_func_count;
+    Arena arena;
+    ProjectRoot* root;
 } LightPathProject;
 
+// Cabecera del modelo compilado (.lightpath/project.cache); le siguen los bytes de la arena
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t layout;           // tamaños de las estructuras del modelo
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t source_inode;
+    char source_hash[72];
+    uint64_t arena_size;
+    uint32_t root;
+    uint32_t format;           // PROJECT_CACHE_FORMAT: cambia con los campos del modelo
+} ProjectCacheHeader;
+
+// lightpath_app = ejecutable de lightpath + payload ZIP + tabla de comandos + AppFooter
+#define APP_MAGIC "LPAPP\x01\r\n"
+
+// Pie al final de lightpath_app (lo lee el mismo ejecutable, por eso el layout es nativo)
+typedef struct {
+    uint64_t payload_offset;
+    uint64_t payload_size;
+    uint64_t table_offset;
+    uint64_t table_size;
+    char magic[8];
+} AppFooter;
+
+// Petición de un cliente a lightpath server; le siguen length bytes con los
+// argumentos y el entorno, terminados en NUL
+typedef struct {
+    char magic[8];
+    uint64_t exe_device;
+    uint64_t exe_inode;
+    long long exe_mtime_ns;
+    uint32_t arg_count;
+    uint32_t env_count;
+    uint32_t file_mask;
+    uint32_t length;
+} ServerRequest;
+
+// lightpath_app abierto con mmap para diff/apply
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    AppFooter footer;
+} AppImage;
+
+// Parche de lightpath diff: cabecera y una lista de operaciones que rehacen el
+// binario nuevo copiando rangos del viejo o con datos nuevos (DEFLATE si ayuda)
+#define PATCH_MAGIC "LPPATCH1"
+#define PATCH_COPY 0
+#define PATCH_DATA 1
+#define PATCH_DEFLATE 2
+#define PATCH_END 3
+
+typedef struct {
+    char magic[8];
+    uint64_t old_size;
+    uint64_t new_size;
+    unsigned char old_hash[32];
+    unsigned char new_hash[32];
+} PatchHeader;
+
+typedef struct {
+    uint32_t kind;
+    uint32_t reserved;
+    uint64_t offset;           // PATCH_COPY: posición en el binario viejo
+    uint64_t length;           // bytes del binario nuevo
+    uint64_t stored_length;    // bytes que siguen en el parche (datos)
+} PatchOp;
+
+// Cabecera de la tabla de comandos del main
+typedef struct {
+    uint32_t command_count;
+    uint32_t cache;
+    uint64_t cache_limit;
+    uint32_t codec;
+    char payload_hash[68];
+    uint32_t hot_count;        // rutas del conjunto caliente, ordenadas, tras los comandos
+    uint32_t hot_size;
+} AppTableHeader;
+
+// Cada comando: cabecera + argc cadenas terminadas en NUL (rellenadas a 4 bytes)
+typedef struct {
+    uint32_t in_app_dir;
+    uint32_t use_shell;
+    uint32_t argc;
+    uint32_t length;
+} AppCommand;
+
+// Búfer de bytes dinámico
+typedef struct {
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} ByteBuffer;
+
+// Nodo del grafo de ejecución (command == NULL marca el fin de una función)
+typedef enum {
+    JOB_WAITING,
+    JOB_RUNNING,
+    JOB_DONE
+} JobState;
+
+typedef struct {
+    const char* command;
+    const char* function_name;
+    int index;
+    int* dependents;
+    int dependent_count;
+    int dependent_capacity;
+    int pending;
+    JobState state;
+    pid_t pid;
+    int out_fd;
+    int err_fd;
+    ByteBuffer out;
+    ByteBuffer err;
+    long long start_us;        // para --profile
+    int lane;
+    int memo;                  // MemoCheck del nodo de comprobación o de fin (-1 = ninguno)
+} JobNode;
+
+// Archivo de los inputs/outputs de una función
+typedef struct {
+    char* path;
+    unsigned long long size;
+    long long mtime_ns;
+    char hash[65];
+} MemoFile;
+
+typedef struct {
+    MemoFile* files;
+    size_t count;
+    size_t capacity;
+} MemoFileList;
+
+// Función con inputs/outputs en el grafo: su nodo check decide antes de los
+// comandos si se pueden saltar, y al llegar a barrier se guarda el registro
+typedef struct {
+    LightPathProject* project;
+    FunctionBlock* block;
+    int check;
+    int barrier;
+    char key[65];
+    MemoFileList inputs;
+    int up_to_date;
+} MemoCheck;
+
+typedef struct {
+    JobNode* nodes;
+    int count;
+    int capacity;
+    int* barriers;
+    int* visiting;
+    MemoCheck* memos;
+    int memo_count;
+    int memo_capacity;
+} JobGraph;
+
+// Evento de --profile (tiempos en microsegundos desde el arranque)
+typedef struct {
+    char* name;
+    const char* category;      // "phase" o "command"
+    const char* function_name;
+    int step;
+    int lane;                  // 0 = lightpath, 1.. = trabajo en paralelo
+    int exit_code;
+    long long start_us;
+    long long wall_us;
+    long long cpu_us;
+    long max_rss_kb;
+} ProfileEvent;
+
+typedef struct {
+    long long start_us;
+    long long cpu_us;
+} ProfileMark;
+
+// Registro de una entrada en el manifiesto de compilación
+typedef struct {
+    char* name;
+    unsigned long long size;
+    long long mtime_ns;
+    unsigned int mode;
+    char hash[65];
+    uint16_t method;
+    uint32_t crc;
+    unsigned long long compressed_size;
+    unsigned long long data_offset;
+} ManifestEntry;
+
+// Binario escrito con un payload (tamaño y fecha para saber si sigue intacto)
+typedef struct {
+    char* path;
+    unsigned long long size;
+    long long mtime_ns;
+} ManifestApp;
+
+// Estado de la compilación anterior (.lightpath/manifest, o manifest-<códec> para
+// las variantes con otro códec)
+typedef struct {
+    int valid;
+    char build_path_hash[65];
+    char payload_hash[65];
+    char runtime_hash[65];
+    ManifestApp* apps;
+    size_t app_count;
+    ManifestEntry* entries;
+    size_t count;
+    size_t capacity;
+    size_t reused_count;
+    size_t duplicate_count;
+    unsigned long long duplicate_bytes;
+    unsigned long long duplicate_packed_bytes;
+    int codec;
+} BuildManifest;
+
+// Entrada del archivo empaquetado
+typedef struct PackEntry {
+    char* name;
+    char* full_path;
+    mode_t mode;
+    long long mtime_ns;
+    int is_directory;
+    int sparse;                // menos bloques que tamaño: se extrae con huecos
+    dev_t device;
+    ino_t inode;               // los enlaces duros de source/ se guardan una vez
+    const ManifestEntry* previous;
+    const struct PackEntry* original;  // archivo anterior con el mismo contenido
+    int reused;
+    char hash[65];
+    unsigned char* data;
+    int data_fd;               // o bien los bytes están en un archivo (trozos, archivo anterior)
+    uint64_t data_offset;
+    int owns_data_fd;
+    size_t raw_size;
+    size_t compressed_size;
+    uint32_t crc;
+    uint16_t method;
+    int done;
+    int failed;
+} PackEntry;
+
+typedef struct {
+    PackEntry* entries;
+    size_t count;
+    size_t capacity;
+} PackList;
+
+// Variante de lightpath_app: main, o una función de targets = "..." del bloque build
+typedef struct {
+    LightPathProject* project;
+    FunctionBlock* block;
+    const PackList* list;
+    int codec;
+    char app_path[MAX_PATH_LENGTH];
+    const char* payload_path;
+    const char* payload_hash;
+    int ok;
+} AppVariant;
+
+// Cola de archivos por hashear antes de buscar duplicados
+typedef struct {
+    PackEntry** entries;
+    size_t count;
+    size_t next;
+    pthread_mutex_t lock;
+} HashQueue;
+
+// Cola compartida entre los hilos compresores y el escritor
+typedef struct {
+    PackList* list;
+    size_t next;
+    size_t written;
+    size_t window;
+    int codec;
+    int previous_fd;
+    pthread_mutex_t lock;
+    pthread_cond_t progress;
+} PackQueue;
+
+// Estado de lightpath watch: vigilancias de inotify y rutas cambiadas pendientes
+typedef struct {
+    int fd;
+    int project_wd;            // el directorio del proyecto (sólo interesa build.path)
+    char** directories;        // wd -> prefijo dentro de source/ ("" o "dir/")
+    int directory_count;
+    char** changes;            // rutas relativas a source/, sin '/' final
+    size_t change_count;
+    size_t change_capacity;
+    int build_path_changed;
+    int overflow;              // la cola de inotify se llenó: hay que recorrer todo
+    char build_path_hash[65];
+    char runtime_hash[65];
+} WatchState;
+
+// Estado de SHA-256
+typedef struct {
+    uint32_t state[8];
+    uint64_t length;
+    unsigned char block[64];
+    size_t used;
+} Sha256;
+
+// Número de trabajos pedido con -j (0 = automático)
+static int requested_jobs = 0;
+
+// --force: las funciones con inputs/outputs se ejecutan aunque estén al día
+static int force_run = 0;
+
+// Perfil pedido con --profile (NULL = desactivado)
+static const char* profile_path = NULL;
+static long long profile_origin_us;
+static ProfileEvent* profile_events;
+static size_t profile_count;
+static size_t profile_capacity;
+
+// En un ejecutor de lightpath server: source/ ya recorrido y vigilado (NULL = recorrerlo)
+static const WatchState* server_watch = NULL;
+static const PackList* server_source = NULL;
+
 // Variables globales para el tokenizer
 static char* source_code;
-static int current_pos;
+static size_t source_length;
+static size_t current_pos;
 static int current_line;
 static int current_column;
+static int tokenizer_failed;
 
 // Declaraciones de funciones
-void init_tokenizer(const char* code);
+void init_tokenizer(char* code, size_t length);
 void cleanup_tokenizer(void);
 char peek_char(void);
 char next_char(void);
 void skip_whitespace(void);
 void skip_comment(void);
 Token next_token(void);
-void init_function_block(FunctionBlock* block);
-void add_command_with_context(FunctionBlock* block, const char* command, int build_version, const char* path_mode);
+int token_is(const Token* token, const char* text);
+int next_setting_value(Token* token);
+unsigned long long parse_size(const char* text);
+int arena_init(Arena* arena);
+ArenaRef arena_alloc(Arena* arena, size_t size);
+ArenaRef arena_grow(Arena* arena, ArenaRef ref, size_t old_size, size_t new_size);
+ArenaRef arena_string(Arena* arena, const char* text, size_t length);
+int project_init(LightPathProject* project);
+const char* project_string(const LightPathProject* project, ArenaRef ref);
+FunctionBlock* project_block(const LightPathProject* project, ArenaRef ref);
+Command* block_command(const LightPathProject* project, const FunctionBlock* block, int index);
+FunctionBlock* find_function(const LightPathProject* project, const char* name, size_t length);
+FunctionBlock* add_custom_function(LightPathProject* project, const char* name, size_t length);
+void add_block_need(LightPathProject* project, FunctionBlock* block, const char* name);
+void add_block_pattern(LightPathProject* project, ArenaRef* patterns, int* count, int* capacity, const char* pattern);
+void add_block_target(LightPathProject* project, FunctionBlock* block, const char* name);
+void add_command_with_context(LightPathProject* project, FunctionBlock* block, const char* command, size_t length,
+                              int build_version, ArenaRef path_mode, int group);
 int parse_build_file(const char* filename, LightPathProject* project);
+int load_project(const char* filename, LightPathProject* project);
+void free_project(LightPathProject* project);
+int load_project_cache(const char* path, const char* source_path, const struct stat* source_stat,
+                       LightPathProject* project);
+int save_project_cache(const char* path, const struct stat* source_stat, const char* source_hash,
+                       const LightPathProject* project);
 int file_exists(const char* filename);
 int create_directory(const char* path);
-void execute_command(const char* command);
+void free_job_graph(JobGraph* graph);
+int add_function_to_graph(LightPathProject* project, JobGraph* graph, FunctionBlock* block);
+int run_job_graph(JobGraph* graph, int jobs);
+int run_function_block(LightPathProject* project, FunctionBlock* block);
+void* checked_realloc(void* pointer, size_t size);
+void buffer_append(ByteBuffer* buffer, const void* data, size_t length);
+void buffer_free(ByteBuffer* buffer);
+uint32_t crc32_update(uint32_t crc, const unsigned char* data, size_t length);
+void sha256_init(Sha256* ctx);
+void sha256_update(Sha256* ctx, const void* data, size_t length);
+void sha256_final(Sha256* ctx, unsigned char digest[32]);
+void sha256_hex(const unsigned char digest[32], char hex[65]);
+int sha256_file(const char* path, char hex[65]);
+int deflate_compress(const unsigned char* input, size_t length, int level, ByteBuffer* output);
+int deflate_compress_part(const unsigned char* input, size_t length, int level, int last, ByteBuffer* output);
+int fast_compress(const unsigned char* input, size_t length, ByteBuffer* output);
+int max_compress(const unsigned char* input, size_t length, ByteBuffer* output);
+int collect_source_entries(const char* dir_path, const char* prefix, PackList* list);
+void free_pack_list(PackList* list);
+int pack_source_directory(PackList* list, const char* archive_path, int jobs, int codec,
+                          const BuildManifest* previous, BuildManifest* current);
+void free_build_manifest(BuildManifest* manifest);
+int load_build_manifest(const char* path, BuildManifest* manifest);
+int save_build_manifest(const char* path, const BuildManifest* manifest);
+int source_tree_unchanged(const PackList* list, const BuildManifest* manifest);
+int resolve_job_count(LightPathProject* project);
+int split_command_words(const char* command, char*** words_out);
+void write_command_table(LightPathProject* project, const FunctionBlock* main_block, int codec,
+                         const char* payload_hash, const ByteBuffer* hot_names, uint32_t hot_count, ByteBuffer* table);
+int write_app_binary(const char* payload_path, const ByteBuffer* table, const char* app_path);
+int run_embedded_app(void);
+ProfileMark profile_begin(void);
+void profile_end(ProfileMark mark, const char* name);
+void profile_command(const JobNode* node, const struct rusage* usage, int exit_code);
+int write_profile(const char* run_name, int status);
+int build_app(LightPathProject* project, PackList* list, AppVariant* variants, int variant_count,
+              const BuildManifest* previous, BuildManifest* current);
+int build_apps(LightPathProject* project, PackList* list, const char* build_path_hash, const char* runtime_hash,
+               BuildManifest* main_previous);
 int build_project(LightPathProject* project);
 int run_custom_function(LightPathProject* project, const char* func_name);
+int watch_project(LightPathProject* project, const char* function_name);
+int parse_arguments(int argc, char* argv[], char** arguments, int* argument_count);
+int run_request(LightPathProject* project, char** arguments, int argument_count, ProfileMark total);
+int forward_to_server(int argc, char* argv[]);
+int serve_project(LightPathProject* project);
+int diff_apps(const char* old_path, const char* new_path);
+int apply_patch(const char* old_path, const char* patch_path, const char* new_path);
+int inspect_app(const char* path, int json);
+int run_inspect(char** arguments, int count);
 void show_usage(void);
 
 // Funciones del tokenizer
-void init_tokenizer(const char* code) {
-    source_code = strdup(code);
+void init_tokenizer(char* code, size_t length) {
+    // El tokenizer se queda con el buffer (se libera en cleanup_tokenizer)
+    source_code = code;
+    source_length = length;
     current_pos = 0;
     current_line = 1;
     current_column = 1;
+    tokenizer_failed = 0;
 }
 
 void cleanup_tokenizer(void) {
@@ -101,17 +611,18 @@ void cleanup_tokenizer(void) {
         free(source_code);
         source_code = NULL;
     }
+    source_length = 0;
 }
 
 char peek_char(void) {
-    if (!source_code || current_pos >= strlen(source_code)) {
+    if (current_pos >= source_length) {
         return '\0';
     }
     return source_code[current_pos];
 }
 
 char next_char(void) {
-    if (!source_code || current_pos >= strlen(source_code)) {
+    if (current_pos >= source_length) {
         return '\0';
     }
     
@@ -134,7 +645,7 @@ void skip_whitespace(void) {
 }
 
 void skip_comment(void) {
-    if (peek_char() == '/' && source_code[current_pos + 1] == '/') {
+    if (peek_char() == '/' && current_pos + 1 < source_length && source_code[current_pos + 1] == '/') {
         // Saltar comentario de línea
         while (peek_char() != '\n' && peek_char() != '\0') {
             next_char();
@@ -142,131 +653,325 @@ void skip_comment(void) {
     }
 }
 
+static int is_identifier_char(char c, int first) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+           (!first && c >= '0' && c <= '9');
+}
+
 Token next_token(void) {
-    Token token = {TOKEN_UNKNOWN, "", current_line, current_column};
+    Token token = {TOKEN_UNKNOWN, NULL, 0, current_line, current_column};
     
+    // Los comentarios pueden ir seguidos
     skip_whitespace();
-    skip_comment();
-    skip_whitespace();
+    while (peek_char() == '/' && current_pos + 1 < source_length && source_code[current_pos + 1] == '/') {
+        skip_comment();
+        skip_whitespace();
+    }
     
+    token.line = current_line;
+    token.column = current_column;
+    token.value = source_code + current_pos;
     char c = peek_char();
     
-    if (c == '\0') {
+    if (current_pos >= source_length) {
         token.type = TOKEN_EOF;
+        token.value = source_code + source_length;
         return token;
     }
     
-    if (c == '{') {
-        token.type = TOKEN_LBRACE;
-        strcpy(token.value, "{");
-        next_char();
-        return token;
-    }
-    
-    if (c == '}') {
-        token.type = TOKEN_RBRACE;
-        strcpy(token.value, "}");
-        next_char();
-        return token;
-    }
-    
-    if (c == '=') {
-        token.type = TOKEN_EQUALS;
-        strcpy(token.value, "=");
+    if (c == '{' || c == '}' || c == '=') {
+        token.type = c == '{' ? TOKEN_LBRACE : c == '}' ? TOKEN_RBRACE : TOKEN_EQUALS;
+        token.length = 1;
         next_char();
         return token;
     }
     
     if (c == '"') {
-        // String literal
+        // String literal: se decodifica en el mismo buffer (el resultado nunca es más largo)
         token.type = TOKEN_STRING;
         next_char(); // Saltar la comilla inicial
+        token.value = source_code + current_pos;
         
-        int i = 0;
-        c = peek_char();
-        while (c != '"' && c != '\0' && i < MAX_TOKEN_LENGTH - 1) {
-            token.value[i++] = next_char();
-            c = peek_char();
+        char* out = token.value;
+        while (current_pos < source_length && peek_char() != '"') {
+            c = next_char();
+            if (c == '\\' && current_pos < source_length) {
+                char escaped = next_char();
+                switch (escaped) {
+                    case '"':  c = '"'; break;
+                    case '\\': c = '\\'; break;
+                    case 'n':  c = '\n'; break;
+                    case 't':  c = '\t'; break;
+                    case 'r':  c = '\r'; break;
+                    default:
+                        // Escape desconocido: se conserva tal cual (p. ej. "\." para el shell)
+                        *out++ = '\\';
+                        c = escaped;
+                        break;
+                }
+            }
+            *out++ = c;
         }
-        token.value[i] = '\0';
         
-        if (c == '"') {
+        if (current_pos >= source_length) {
+            printf("Unterminated string at line %d, Error!\n", token.line);
+            tokenizer_failed = 1;
+        } else {
             next_char(); // Saltar la comilla final
         }
+        token.length = out - token.value;
+        *out = '\0';
         return token;
     }
     
-    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_') {
+    if (is_identifier_char(c, 1)) {
         // Identificador
         token.type = TOKEN_IDENTIFIER;
-        int i = 0;
-        
-        while (((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || 
-                (c >= '0' && c <= '9') || c == '_') && 
-               i < MAX_TOKEN_LENGTH - 1) {
-            token.value[i++] = next_char();
-            c = peek_char();
+        while (is_identifier_char(peek_char(), 0)) {
+            next_char();
         }
-        token.value[i] = '\0';
+        token.length = source_code + current_pos - token.value;
         return token;
     }
     
     // Token desconocido
-    token.value[0] = next_char();
-    token.value[1] = '\0';
+    next_char();
+    token.length = 1;
     return token;
 }
 
+int token_is(const Token* token, const char* text) {
+    size_t length = strlen(text);
+    return token->length == length && memcmp(token->value, text, length) == 0;
+}
+
 // Funciones del parser
-void init_function_block(FunctionBlock* block) {
-    block->command_count = 0;
+int next_setting_value(Token* token) {
+    // Formato: nombre = "valor"
+    *token = next_token();
+    if (token->type != TOKEN_EQUALS) {
+        return 0;
+    }
+    *token = next_token();
+    return token->type == TOKEN_STRING;
+}
+
+unsigned long long parse_size(const char* text) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    switch (*end) {
+        case 'k': case 'K': return value << 10;
+        case 'm': case 'M': return value << 20;
+        case 'g': case 'G': return value << 30;
+        case 't': case 'T': return value << 40;
+        default: return value;
+    }
+}
+
+// Funciones del modelo del proyecto (todo vive en la arena)
+static uint32_t hash_name(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static ArenaRef new_function_block(LightPathProject* project, const char* name, size_t length) {
+    ArenaRef ref = arena_alloc(&project->arena, sizeof(FunctionBlock));
+    ArenaRef name_ref = arena_string(&project->arena, name, length);
+    FunctionBlock* block = project_block(project, ref);
+    block->name = name_ref;
+    block->index = -1;
     block->final_build_version = 1;
-    strcpy(block->final_path_mode, "application");
+    block->final_path_mode = project->root->default_path_mode;
     block->required_lightpath_version = 1;
-    block->has_build = 0;
+    block->cache_limit = DEFAULT_CACHE_LIMIT;
+    return ref;
+}
+
+int project_init(LightPathProject* project) {
+    if (!arena_init(&project->arena)) {
+        printf("Out of memory, Error!\n");
+        return 0;
+    }
+    ArenaRef root = arena_alloc(&project->arena, sizeof(ProjectRoot));
+    project->root = ARENA_AT(&project->arena, ProjectRoot, root);
+    project->root->default_path_mode = arena_string(&project->arena, "application", 11);
+    project->root->build_func = new_function_block(project, "build", 5);
+    project->root->main_func = new_function_block(project, "main", 4);
+    return 1;
+}
+
+const char* project_string(const LightPathProject* project, ArenaRef ref) {
+    return ARENA_AT(&project->arena, const char, ref);
+}
+
+FunctionBlock* project_block(const LightPathProject* project, ArenaRef ref) {
+    return ARENA_AT(&project->arena, FunctionBlock, ref);
+}
+
+Command* block_command(const LightPathProject* project, const FunctionBlock* block, int index) {
+    return &ARENA_AT(&project->arena, Command, block->commands)[index];
+}
+
+FunctionBlock* find_function(const LightPathProject* project, const char* name, size_t length) {
+    const ProjectRoot* root = project->root;
+    if (root->bucket_count == 0) {
+        return NULL;
+    }
+    ArenaRef ref = ARENA_AT(&project->arena, ArenaRef, root->buckets)[hash_name(name, length) & (root->bucket_count - 1)];
+    while (ref) {
+        FunctionBlock* block = project_block(project, ref);
+        const char* block_name = project_string(project, block->name);
+        if (strncmp(block_name, name, length) == 0 && block_name[length] == '\0') {
+            return block;
+        }
+        ref = block->next;
+    }
+    return NULL;
+}
+
+static void index_function(LightPathProject* project, ArenaRef ref) {
+    ProjectRoot* root = project->root;
+    FunctionBlock* block = project_block(project, ref);
+    const char* name = project_string(project, block->name);
+    ArenaRef* bucket = &ARENA_AT(&project->arena, ArenaRef, root->buckets)[hash_name(name, strlen(name)) & (root->bucket_count - 1)];
+    block->next = *bucket;
+    *bucket = ref;
+}
+
+FunctionBlock* add_custom_function(LightPathProject* project, const char* name, size_t length) {
+    // Una función repetida continúa el bloque existente (igual que build y main)
+    FunctionBlock* existing = find_function(project, name, length);
+    if (existing) {
+        return existing;
+    }
+
+    ProjectRoot* root = project->root;
+    if (root->function_count == root->function_capacity) {
+        int capacity = root->function_capacity ? root->function_capacity * 2 : 16;
+        root->functions = arena_grow(&project->arena, root->functions, sizeof(ArenaRef) * root->function_capacity,
+                                     sizeof(ArenaRef) * capacity);
+        root->function_capacity = capacity;
+    }
+    ArenaRef ref = new_function_block(project, name, length);
+    project_block(project, ref)->index = root->function_count;
+    // Sin compression propia, una variante usa la del bloque build
+    project_block(project, ref)->compression = -1;
+    ARENA_AT(&project->arena, ArenaRef, root->functions)[root->function_count++] = ref;
+
+    // Tabla hash con potencias de dos; se duplica al llenarse
+    if (root->function_count > root->bucket_count) {
+        root->bucket_count = root->bucket_count ? root->bucket_count * 2 : 16;
+        root->buckets = arena_alloc(&project->arena, sizeof(ArenaRef) * root->bucket_count);
+        for (int i = 0; i < root->function_count; i++) {
+            index_function(project, ARENA_AT(&project->arena, ArenaRef, root->functions)[i]);
+        }
+    } else {
+        index_function(project, ref);
+    }
+    return project_block(project, ref);
+}
+
+void add_block_need(LightPathProject* project, FunctionBlock* block, const char* name) {
+    if (block->needs_count == block->needs_capacity) {
+        int capacity = block->needs_capacity ? block->needs_capacity * 2 : 4;
+        block->needs = arena_grow(&project->arena, block->needs, sizeof(ArenaRef) * block->needs_capacity,
+                                  sizeof(ArenaRef) * capacity);
+        block->needs_capacity = capacity;
+    }
+    ArenaRef name_ref = arena_string(&project->arena, name, strlen(name));
+    ARENA_AT(&project->arena, ArenaRef, block->needs)[block->needs_count++] = name_ref;
+}
+
+void add_block_target(LightPathProject* project, FunctionBlock* block, const char* name) {
+    if (block->target_count == block->target_capacity) {
+        int capacity = block->target_capacity ? block->target_capacity * 2 : 4;
+        block->targets = arena_grow(&project->arena, block->targets, sizeof(ArenaRef) * block->target_capacity,
+                                    sizeof(ArenaRef) * capacity);
+        block->target_capacity = capacity;
+    }
+    ArenaRef name_ref = arena_string(&project->arena, name, strlen(name));
+    ARENA_AT(&project->arena, ArenaRef, block->targets)[block->target_count++] = name_ref;
+}
+
+void add_block_pattern(LightPathProject* project, ArenaRef* patterns, int* count, int* capacity, const char* pattern) {
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 4;
+        *patterns = arena_grow(&project->arena, *patterns, sizeof(ArenaRef) * *capacity, sizeof(ArenaRef) * new_capacity);
+        *capacity = new_capacity;
+    }
+    // "./src/*.c" y "src/*.c" son el mismo patrón
+    while (strncmp(pattern, "./", 2) == 0) {
+        pattern += 2;
+    }
+    ArenaRef pattern_ref = arena_string(&project->arena, pattern, strlen(pattern));
+    ARENA_AT(&project->arena, ArenaRef, *patterns)[(*count)++] = pattern_ref;
 }
 
-void add_command_with_context(FunctionBlock* block, const char* command, 
-                             int build_version, const char* path_mode) {
-    if (block->command_count < MAX_COMMANDS) {
-        strcpy(block->commands[block->command_count].command, command);
-        block->commands[block->command_count].build_version_at_time = build_version;
-        strcpy(block->commands[block->command_count].path_mode_at_time, path_mode);
-        block->command_count++;
+void add_command_with_context(LightPathProject* project, FunctionBlock* block, const char* command, size_t length,
+                              int build_version, ArenaRef path_mode, int group) {
+    if (block->command_count == block->command_capacity) {
+        int capacity = block->command_capacity ? block->command_capacity * 2 : 8;
+        block->commands = arena_grow(&project->arena, block->commands, sizeof(Command) * block->command_capacity,
+                                     sizeof(Command) * capacity);
+        block->command_capacity = capacity;
     }
+    ArenaRef command_ref = arena_string(&project->arena, command, length);
+    Command* entry = block_command(project, block, block->command_count++);
+    entry->command = command_ref;
+    entry->build_version_at_time = build_version;
+    entry->path_mode_at_time = path_mode;
+    entry->group = group;
 }
 
 int parse_build_file(const char* filename, LightPathProject* project) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         printf("Cannot open %s, Error!\n", filename);
         return 0;
     }
     
-    // Leer todo el archivo
-    fseek(file, 0, SEEK_END);
-    long file_size = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    
-    char* content = malloc(file_size + 1);
-    fread(content, 1, file_size, file);
-    content[file_size] = '\0';
-    fclose(file);
+    // Leer todo el archivo de una vez; el tokenizer trabaja sobre este buffer
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        printf("Cannot read %s, Error!\n", filename);
+        close(fd);
+        return 0;
+    }
+    size_t file_size = st.st_size;
+    char* content = checked_realloc(NULL, file_size + 1);
+    size_t done = 0;
+    while (done < file_size) {
+        ssize_t n = read(fd, content + done, file_size - done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    content[done] = '\0';
     
     // Inicializar proyecto
-    init_function_block(&project->build_func);
-    init_function_block(&project->main_func);
-    project->custom_func_count = 0;
+    if (!project_init(project)) {
+        free(content);
+        return 0;
+    }
     
-    // Inicializar tokenizer
-    init_tokenizer(content);
-    free(content);
+    // Inicializar tokenizer (se queda con el buffer)
+    init_tokenizer(content, done);
     
     Token token;
     while ((token = next_token()).type != TOKEN_EOF) {
         if (token.type == TOKEN_IDENTIFIER) {
+            const char* block_name = token.value;
+            size_t block_name_length = token.length;
             char func_name[64];
-            strcpy(func_name, token.value);
+            snprintf(func_name, sizeof(func_name), "%.*s", (int)token.length, token.value);
             
             // Esperar '{'
             token = next_token();
@@ -277,37 +982,100 @@ int parse_build_file(const char* filename, LightPathProject* project) {
             }
             
             // Determinar el tipo de función
-            FunctionBlock* current_block = NULL;
+            FunctionBlock* current_block;
             if (strcmp(func_name, "build") == 0) {
-                current_block = &project->build_func;
+                current_block = project_block(project, project->root->build_func);
             } else if (strcmp(func_name, "main") == 0) {
-                current_block = &project->main_func;
+                current_block = project_block(project, project->root->main_func);
             } else {
                 // Función personalizada
-                if (project->custom_func_count < 10) {
-                    strcpy(project->custom_func_names[project->custom_func_count], func_name);
-                    init_function_block(&project->custom_funcs[project->custom_func_count]);
-                    current_block = &project->custom_funcs[project->custom_func_count];
-                    project->custom_func_count++;
-                }
+                current_block = add_custom_function(project, block_name, block_name_length);
             }
             
             // Variables dinámicas para esta función
             int current_build_version = 1;
-            char current_path_mode[32] = "application";
+            ArenaRef current_path_mode = project->root->default_path_mode;
             
             // Parsear el contenido de la función
             if (current_block) {
-                while ((token = next_token()).type != TOKEN_RBRACE && token.type != TOKEN_EOF) {
+                int current_group = 0;
+                while ((token = next_token()).type != TOKEN_EOF) {
+                    if (token.type == TOKEN_RBRACE) {
+                        if (current_group) {
+                            // Fin de un grupo parallel { ... }
+                            current_group = 0;
+                            continue;
+                        }
+                        break;
+                    }
                     if (token.type == TOKEN_IDENTIFIER) {
-                        if (strcmp(token.value, "command") == 0) {
+                        if (token_is(&token, "command")) {
                             // Parsear comando con contexto actual
                             token = next_token();
                             if (token.type == TOKEN_STRING) {
-                                add_command_with_context(current_block, token.value, 
-                                                       current_build_version, current_path_mode);
+                                add_command_with_context(project, current_block, token.value, token.length,
+                                                         current_build_version, current_path_mode,
+                                                         current_group);
+                            }
+                        } else if (token_is(&token, "parallel")) {
+                            // Los comandos del grupo no dependen entre sí
+                            token = next_token();
+                            if (token.type != TOKEN_LBRACE || current_group) {
+                                printf("Expected '{' after parallel, Error!\n");
+                                cleanup_tokenizer();
+                                return 0;
+                            }
+                            current_group = ++current_block->group_count;
+                        } else if (token_is(&token, "needs")) {
+                            // Funciones que deben terminar antes: needs = "lint test"
+                            if (next_setting_value(&token)) {
+                                char* saveptr;
+                                for (char* name = strtok_r(token.value, " ,", &saveptr); name;
+                                     name = strtok_r(NULL, " ,", &saveptr)) {
+                                    add_block_need(project, current_block, name);
+                                }
+                            }
+                        } else if (token_is(&token, "inputs") || token_is(&token, "outputs")) {
+                            // Memorización: inputs = "src/**/*.c", outputs = "out/lib.a"
+                            int is_inputs = token_is(&token, "inputs");
+                            if (next_setting_value(&token)) {
+                                char* saveptr;
+                                for (char* pattern = strtok_r(token.value, " ,", &saveptr); pattern;
+                                     pattern = strtok_r(NULL, " ,", &saveptr)) {
+                                    if (is_inputs) {
+                                        add_block_pattern(project, &current_block->inputs, &current_block->input_count,
+                                                          &current_block->input_capacity, pattern);
+                                    } else {
+                                        add_block_pattern(project, &current_block->outputs, &current_block->output_count,
+                                                          &current_block->output_capacity, pattern);
+                                    }
+                                }
+                            }
+                        } else if (token_is(&token, "hot")) {
+                            // Conjunto caliente: hot = "start.sh lib/*.so" (rutas de source/)
+                            if (next_setting_value(&token)) {
+                                char* saveptr;
+                                for (char* pattern = strtok_r(token.value, " ,", &saveptr); pattern;
+                                     pattern = strtok_r(NULL, " ,", &saveptr)) {
+                                    add_block_pattern(project, &current_block->hot, &current_block->hot_count,
+                                                      &current_block->hot_capacity, pattern);
+                                }
+                            }
+                        } else if (token_is(&token, "hot_file")) {
+                            // Lista grabada con LIGHTPATH_RECORD_HOT y guardada en source/
+                            if (next_setting_value(&token)) {
+                                current_block->hot_file = arena_string(&project->arena, token.value, strlen(token.value));
+                            }
+                        } else if (token_is(&token, "targets")) {
+                            // Variantes de lightpath_app: targets = "debug release"
+                            if (next_setting_value(&token)) {
+                                char* saveptr;
+                                for (char* name = strtok_r(token.value, " ,", &saveptr); name;
+                                     name = strtok_r(NULL, " ,", &saveptr)) {
+                                    add_block_target(project, current_block, name);
+                                }
                             }
-                        } else if (strcmp(token.value, "build_version") == 0) {
+                        } else if (token_is(&token, "build_version")) {
                             // Actualizar build_version dinámicamente
                             token = next_token(); // =
                             if (token.type == TOKEN_EQUALS) {
@@ -329,17 +1097,48 @@ int parse_build_file(const char* filename, LightPathProject* project) {
                                     }
                                 }
                             }
-                        } else if (strcmp(token.value, "path_mode") == 0) {
+                        } else if (token_is(&token, "path_mode")) {
                             // Actualizar path_mode dinámicamente
                             token = next_token(); // =
                             if (token.type == TOKEN_EQUALS) {
                                 token = next_token();
                                 if (token.type == TOKEN_STRING) {
-                                    strcpy(current_path_mode, token.value);
-                                    strcpy(current_block->final_path_mode, token.value);
+                                    current_path_mode = arena_string(&project->arena, token.value, token.length);
+                                    current_block->final_path_mode = current_path_mode;
+                                }
+                            }
+                        } else if (token_is(&token, "jobs")) {
+                            // Número de hilos para empaquetar ("auto" = núcleos disponibles)
+                            if (next_setting_value(&token)) {
+                                current_block->jobs = atoi(token.value);
+                            }
+                        } else if (token_is(&token, "cache")) {
+                            // Caché de extracción del binario final
+                            if (next_setting_value(&token)) {
+                                current_block->cache = strcmp(token.value, "true") == 0 ||
+                                                       strcmp(token.value, "on") == 0;
+                            }
+                        } else if (token_is(&token, "compression")) {
+                            // Códec del payload: "fast", "max", "none" o "deflate"
+                            if (next_setting_value(&token)) {
+                                int codec = -1;
+                                for (int c = 0; c <= CODEC_NONE; c++) {
+                                    if (strcmp(token.value, codec_names[c]) == 0) {
+                                        codec = c;
+                                    }
                                 }
+                                if (codec < 0) {
+                                    printf("Unknown compression \"%s\", Error!\n", token.value);
+                                    cleanup_tokenizer();
+                                    return 0;
+                                }
+                                current_block->compression = codec;
+                            }
+                        } else if (token_is(&token, "cache_limit")) {
+                            if (next_setting_value(&token)) {
+                                current_block->cache_limit = parse_size(token.value);
                             }
-                        } else if (strcmp(token.value, "build") == 0) {
+                        } else if (token_is(&token, "build")) {
                             current_block->has_build = 1;
                         }
                     }
@@ -349,9 +1148,140 @@ int parse_build_file(const char* filename, LightPathProject* project) {
     }
     
     cleanup_tokenizer();
+    return !tokenizer_failed;
+}
+
+// Modelo compilado: build.path ya analizado, listo para mapear sin volver a parsear
+static long long stat_mtime_ns(const struct stat* st) {
+    return (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+int load_project_cache(const char* path, const char* source_path, const struct stat* source_stat,
+                       LightPathProject* project) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat cache_stat;
+    if (fstat(fd, &cache_stat) != 0 || (size_t)cache_stat.st_size < sizeof(ProjectCacheHeader)) {
+        close(fd);
+        return 0;
+    }
+    void* mapped = mmap(NULL, cache_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+
+    // La versión de lightpath y la forma de las estructuras deben coincidir
+    const ProjectCacheHeader* header = mapped;
+    int ok = memcmp(header->magic, "LPMODEL", 8) == 0 && header->version == LIGHTPATH_VERSION &&
+             header->layout == PROJECT_CACHE_LAYOUT && header->format == PROJECT_CACHE_FORMAT &&
+             header->arena_size == cache_stat.st_size - sizeof(ProjectCacheHeader) &&
+             header->root + sizeof(ProjectRoot) <= header->arena_size &&
+             header->source_size == (uint64_t)source_stat->st_size;
+
+    // Mismo tamaño pero otra fecha o inodo: se decide por el contenido
+    if (ok && (header->source_mtime_ns != stat_mtime_ns(source_stat) ||
+               header->source_inode != (uint64_t)source_stat->st_ino)) {
+        char hash[65];
+        ok = sha256_file(source_path, hash) && strcmp(hash, header->source_hash) == 0;
+        if (ok) {
+            // Se actualiza la cabecera para no volver a calcular el hash
+            ProjectCacheHeader refreshed = *header;
+            refreshed.source_mtime_ns = stat_mtime_ns(source_stat);
+            refreshed.source_inode = source_stat->st_ino;
+            int write_fd = open(path, O_WRONLY);
+            if (write_fd >= 0) {
+                if (pwrite(write_fd, &refreshed, sizeof(refreshed), 0) != sizeof(refreshed)) {
+                    // Sin actualizar sólo se repite el hash la próxima vez
+                }
+                close(write_fd);
+            }
+        }
+    }
+    if (!ok) {
+        munmap(mapped, cache_stat.st_size);
+        return 0;
+    }
+
+    // La arena mapeada es de sólo lectura (reserved = 0: no admite más reservas)
+    memset(&project->arena, 0, sizeof(Arena));
+    project->arena.base = (unsigned char*)mapped + sizeof(ProjectCacheHeader);
+    project->arena.size = header->arena_size;
+    project->root = ARENA_AT(&project->arena, ProjectRoot, header->root);
+    return 1;
+}
+
+int save_project_cache(const char* path, const struct stat* source_stat, const char* source_hash,
+                       const LightPathProject* project) {
+    ProjectCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LPMODEL", 8);
+    header.version = LIGHTPATH_VERSION;
+    header.layout = PROJECT_CACHE_LAYOUT;
+    header.format = PROJECT_CACHE_FORMAT;
+    header.source_size = source_stat->st_size;
+    header.source_mtime_ns = stat_mtime_ns(source_stat);
+    header.source_inode = source_stat->st_ino;
+    snprintf(header.source_hash, sizeof(header.source_hash), "%s", source_hash);
+    header.arena_size = project->arena.size;
+    header.root = (unsigned char*)project->root - project->arena.base;
+
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s.%d.tmp", path, (int)getpid());
+    FILE* file = fopen(temp_path, "wb");
+    if (!file) {
+        return 0;
+    }
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(project->arena.base, 1, project->arena.size, file) == project->arena.size;
+    if (fclose(file) != 0 || !ok || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Carga el proyecto desde el modelo compilado o, si build.path cambió, lo analiza de nuevo
+int load_project(const char* filename, LightPathProject* project) {
+    struct stat before;
+    if (stat(filename, &before) != 0) {
+        return parse_build_file(filename, project);
+    }
+    if (load_project_cache(PROJECT_CACHE, filename, &before, project)) {
+        return 1;
+    }
+
+    char hash[65];
+    int have_hash = sha256_file(filename, hash);
+    if (!parse_build_file(filename, project)) {
+        return 0;
+    }
+
+    // Sólo se guarda si build.path no cambió mientras se analizaba
+    struct stat after;
+    if (have_hash && stat(filename, &after) == 0 && after.st_size == before.st_size &&
+        stat_mtime_ns(&after) == stat_mtime_ns(&before) && create_directory(STATE_DIR)) {
+        save_project_cache(PROJECT_CACHE, &before, hash, project);
+    }
     return 1;
 }
 
+// Libera el modelo (lightpath watch lo reemplaza al cambiar build.path)
+void free_project(LightPathProject* project) {
+    if (!project->arena.base) {
+        return;
+    }
+    if (project->arena.reserved) {
+        munmap(project->arena.base, project->arena.reserved);
+    } else {
+        // Arena mapeada desde .lightpath/project.cache, detrás de su cabecera
+        munmap(project->arena.base - sizeof(ProjectCacheHeader), project->arena.size + sizeof(ProjectCacheHeader));
+    }
+    memset(project, 0, sizeof(LightPathProject));
+}
+
 // Funciones de utilidad del sistema
 int file_exists(const char* filename) {
     struct stat buffer;
@@ -362,237 +1292,6906 @@ int create_directory(const char* path) {
     return mkdir(path, 0755) == 0 || errno == EEXIST;
 }
 
-void execute_command(const char* command) {
-    // Ejecutar comando sin output de lightpath
-    system(command);
-}
 
-// Funciones de empaquetado real
-int pack_source_directory(const char* source_dir) {
-    // Crear un archivo ZIP con todos los archivos de source
-    char zip_command[1024];
-    snprintf(zip_command, sizeof(zip_command), "cd %s && zip -r ../source_packed.zip . >/dev/null 2>&1", source_dir);
-    
-    if (system(zip_command) != 0) {
-        printf("Zip command failed, Error!\n");
-        return 0;
+// Funciones de memoria
+void* checked_realloc(void* pointer, size_t size) {
+    void* result = realloc(pointer, size ? size : 1);
+    if (!result) {
+        printf("Out of memory, Error!\n");
+        exit(1);
     }
-    
-    return 1;
+    return result;
 }
 
-int generate_runtime_c_code(LightPathProject* project) {
-    FILE* runtime_file = fopen("lightpath_runtime.c", "w");
-    if (!runtime_file) {
-        printf("Cannot create runtime file, Error!\n");
-        return 0;
+void buffer_append(ByteBuffer* buffer, const void* data, size_t length) {
+    if (buffer->size + length > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while (capacity < buffer->size + length) {
+            capacity *= 2;
+        }
+        buffer->data = checked_realloc(buffer->data, capacity);
+        buffer->capacity = capacity;
     }
-    
-    // Generar código C del runtime
-    fprintf(runtime_file, "/*\n * LightPath Runtime - Generado automáticamente con fe en Jehová\n */\n\n");
-    fprintf(runtime_file, "#include <stdio.h>\n");
-    fprintf(runtime_file, "#include <stdlib.h>\n");
-    fprintf(runtime_file, "#include <string.h>\n");
-    fprintf(runtime_file, "#include <unistd.h>\n");
-    fprintf(runtime_file, "#include <sys/stat.h>\n");
-    fprintf(runtime_file, "#include <sys/wait.h>\n\n");
-    
-    // Incluir datos del ZIP como array de bytes
-    fprintf(runtime_file, "// Datos empaquetados (se incluyen automáticamente)\n");
-    fprintf(runtime_file, "extern unsigned char source_data[];\n");
-    fprintf(runtime_file, "extern unsigned int source_data_len;\n\n");
-    
-    fprintf(runtime_file, "int extract_and_run() {\n");
-    fprintf(runtime_file, "    // Crear directorio temporal\n");
-    fprintf(runtime_file, "    char temp_dir[] = \"/tmp/lightpath_XXXXXX\";\n");
-    fprintf(runtime_file, "    if (!mkdtemp(temp_dir)) {\n");
-    fprintf(runtime_file, "        return 1;\n");
-    fprintf(runtime_file, "    }\n\n");
-    
-    fprintf(runtime_file, "    // Escribir ZIP a archivo temporal\n");
-    fprintf(runtime_file, "    char zip_path[1024];\n");
-    fprintf(runtime_file, "    snprintf(zip_path, sizeof(zip_path), \"%%s/app.zip\", temp_dir);\n");
-    fprintf(runtime_file, "    FILE* zip_file = fopen(zip_path, \"wb\");\n");
-    fprintf(runtime_file, "    if (!zip_file) {\n");
-    fprintf(runtime_file, "        return 1;\n");
-    fprintf(runtime_file, "    }\n");
-    fprintf(runtime_file, "    fwrite(source_data, 1, source_data_len, zip_file);\n");
-    fprintf(runtime_file, "    fclose(zip_file);\n\n");
-    
-    fprintf(runtime_file, "    // Extraer ZIP\n");
-    fprintf(runtime_file, "    char unzip_cmd[1024];\n");
-    fprintf(runtime_file, "    snprintf(unzip_cmd, sizeof(unzip_cmd), \"cd %%s && unzip -q app.zip >/dev/null 2>&1\", temp_dir);\n");
-    fprintf(runtime_file, "    if (system(unzip_cmd) != 0) {\n");
-    fprintf(runtime_file, "        return 1;\n");
-    fprintf(runtime_file, "    }\n\n");
-    
-    // Generar comandos del main
-    fprintf(runtime_file, "    // Ejecutar comandos principales\n");
-    fprintf(runtime_file, "    char old_cwd[1024];\n");
-    fprintf(runtime_file, "    getcwd(old_cwd, sizeof(old_cwd));\n\n");
-    
-    for (int i = 0; i < project->main_func.command_count; i++) {
-        Command* cmd = &project->main_func.commands[i];
-        
-        if (strcmp(cmd->path_mode_at_time, "application") == 0) {
-            fprintf(runtime_file, "    chdir(temp_dir);\n");
-        } else {
-            fprintf(runtime_file, "    chdir(old_cwd);\n");
+    memcpy(buffer->data + buffer->size, data, length);
+    buffer->size += length;
+}
+
+void buffer_free(ByteBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->size = 0;
+    buffer->capacity = 0;
+}
+
+// Arena del modelo: sólo se reserva espacio de direcciones y las páginas se
+// habilitan al crecer, así los punteros no cambian mientras se construye
+int arena_init(Arena* arena) {
+    memset(arena, 0, sizeof(Arena));
+    for (size_t reserve = ARENA_RESERVE; reserve >= ARENA_COMMIT_STEP; reserve /= 2) {
+        void* base = mmap(NULL, reserve, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base != MAP_FAILED) {
+            arena->base = base;
+            arena->reserved = reserve;
+            arena->size = 8; // el desplazamiento 0 es la referencia nula
+            return 1;
         }
-        
-        fprintf(runtime_file, "    system(\"%s\");\n", cmd->command);
     }
-    
-    fprintf(runtime_file, "    // Limpiar directorio temporal\n");
-    fprintf(runtime_file, "    char cleanup_cmd[1024];\n");
-    fprintf(runtime_file, "    snprintf(cleanup_cmd, sizeof(cleanup_cmd), \"rm -rf %%s\", temp_dir);\n");
-    fprintf(runtime_file, "    system(cleanup_cmd);\n");
-    fprintf(runtime_file, "    chdir(old_cwd);\n\n");
-    
-    fprintf(runtime_file, "    return 0;\n");
-    fprintf(runtime_file, "}\n\n");
-    
-    fprintf(runtime_file, "int main() {\n");
-    fprintf(runtime_file, "    return extract_and_run();\n");
-    fprintf(runtime_file, "}\n");
-    
-    fclose(runtime_file);
-    return 1;
+    return 0;
 }
 
-int convert_zip_to_object(void) {
-    // Usar xxd para convertir el ZIP a un archivo .c
-    char xxd_command[512];
-    snprintf(xxd_command, sizeof(xxd_command), "xxd -i source_packed.zip > source_data.c 2>/dev/null");
-    
-    if (system(xxd_command) != 0) {
-        // Método alternativo: crear el archivo .c manualmente
-        FILE* zip_file = fopen("source_packed.zip", "rb");
-        FILE* c_file = fopen("source_data.c", "w");
-        
-        if (!zip_file || !c_file) {
-            printf("Cannot process zip file, Error!\n");
-            return 0;
+// Devuelve memoria a cero (las páginas anónimas nuevas ya lo están)
+ArenaRef arena_alloc(Arena* arena, size_t size) {
+    size_t offset = (arena->size + 7) & ~(size_t)7;
+    if (offset + size > arena->reserved) {
+        printf("Out of memory, Error!\n");
+        exit(1);
+    }
+    if (offset + size > arena->committed) {
+        size_t committed = (offset + size + ARENA_COMMIT_STEP - 1) & ~(size_t)(ARENA_COMMIT_STEP - 1);
+        if (committed > arena->reserved) {
+            committed = arena->reserved;
         }
-        
-        fseek(zip_file, 0, SEEK_END);
-        long file_size = ftell(zip_file);
-        fseek(zip_file, 0, SEEK_SET);
-        
-        fprintf(c_file, "unsigned char source_data[] = {\n");
-        
-        for (long i = 0; i < file_size; i++) {
-            if (i % 12 == 0) fprintf(c_file, "\n  ");
-            fprintf(c_file, "0x%02x", fgetc(zip_file));
-            if (i < file_size - 1) fprintf(c_file, ", ");
+        if (mprotect(arena->base + arena->committed, committed - arena->committed, PROT_READ | PROT_WRITE) != 0) {
+            printf("Out of memory, Error!\n");
+            exit(1);
         }
-        
-        fprintf(c_file, "\n};\n");
-        fprintf(c_file, "unsigned int source_data_len = %ld;\n", file_size);
-        
-        fclose(zip_file);
-        fclose(c_file);
-    } else {
-        // Renombrar las variables generadas por xxd
-        system("sed -i 's/source_packed_zip/source_data/g' source_data.c 2>/dev/null");
+        arena->committed = committed;
     }
-    
-    return 1;
+    arena->size = offset + size;
+    return (ArenaRef)offset;
 }
 
-int build_project(LightPathProject* project) {
-    // Ejecutar comandos de build con sus contextos
-    for (int i = 0; i < project->build_func.command_count; i++) {
-        Command* cmd = &project->build_func.commands[i];
-        execute_command(cmd->command);
+ArenaRef arena_grow(Arena* arena, ArenaRef ref, size_t old_size, size_t new_size) {
+    // Si es lo último que se reservó crece en el sitio; si no, se copia
+    if (ref && (old_size & 7) == 0 && ref + old_size == arena->size) {
+        arena_alloc(arena, new_size - old_size);
+        return ref;
     }
-    
-    if (project->build_func.has_build) {
-        // Verificar que existe la carpeta source
+    ArenaRef grown = arena_alloc(arena, new_size);
+    if (old_size) {
+        memcpy(arena->base + grown, arena->base + ref, old_size);
+    }
+    return grown;
+}
+
+ArenaRef arena_string(Arena* arena, const char* text, size_t length) {
+    ArenaRef ref = arena_alloc(arena, length + 1);
+    memcpy(arena->base + ref, text, length);
+    return ref;
+}
+
+static void put_le16(unsigned char* p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+}
+
+static void put_le32(unsigned char* p, uint32_t value) {
+    p[0] = value & 0xff;
+    p[1] = (value >> 8) & 0xff;
+    p[2] = (value >> 16) & 0xff;
+    p[3] = (value >> 24) & 0xff;
+}
+
+static void put_le64(unsigned char* p, uint64_t value) {
+    put_le32(p, (uint32_t)value);
+    put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+// CRC-32 (polinomio de ZIP)
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+static void crc32_build_table(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        crc32_table[i] = c;
+    }
+}
+
+uint32_t crc32_update(uint32_t crc, const unsigned char* data, size_t length) {
+    pthread_once(&crc32_table_once, crc32_build_table);
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// SHA-256 (FIPS 180-4) para identificar contenido
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_transform(Sha256* ctx, const unsigned char* block) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[i * 4] << 24) | ((uint32_t)block[i * 4 + 1] << 16) |
+               ((uint32_t)block[i * 4 + 2] << 8) | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+        uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = ctx->state[0], b = ctx->state[1], c = ctx->state[2], d = ctx->state[3];
+    uint32_t e = ctx->state[4], f = ctx->state[5], g = ctx->state[6], h = ctx->state[7];
+    for (int i = 0; i < 64; i++) {
+        uint32_t s1 = SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    ctx->state[0] += a;
+    ctx->state[1] += b;
+    ctx->state[2] += c;
+    ctx->state[3] += d;
+    ctx->state[4] += e;
+    ctx->state[5] += f;
+    ctx->state[6] += g;
+    ctx->state[7] += h;
+}
+
+void sha256_init(Sha256* ctx) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(ctx->state, initial, sizeof(initial));
+    ctx->length = 0;
+    ctx->used = 0;
+}
+
+void sha256_update(Sha256* ctx, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    ctx->length += length;
+    if (ctx->used) {
+        size_t take = 64 - ctx->used < length ? 64 - ctx->used : length;
+        memcpy(ctx->block + ctx->used, bytes, take);
+        ctx->used += take;
+        bytes += take;
+        length -= take;
+        if (ctx->used < 64) return;
+        sha256_transform(ctx, ctx->block);
+        ctx->used = 0;
+    }
+    while (length >= 64) {
+        sha256_transform(ctx, bytes);
+        bytes += 64;
+        length -= 64;
+    }
+    memcpy(ctx->block, bytes, length);
+    ctx->used = length;
+}
+
+void sha256_final(Sha256* ctx, unsigned char digest[32]) {
+    uint64_t bits = ctx->length * 8;
+    unsigned char pad = 0x80;
+    sha256_update(ctx, &pad, 1);
+    pad = 0;
+    while (ctx->used != 56) {
+        sha256_update(ctx, &pad, 1);
+    }
+    unsigned char length_bytes[8];
+    for (int i = 0; i < 8; i++) {
+        length_bytes[i] = (unsigned char)(bits >> (56 - 8 * i));
+    }
+    sha256_update(ctx, length_bytes, 8);
+    for (int i = 0; i < 8; i++) {
+        digest[i * 4] = ctx->state[i] >> 24;
+        digest[i * 4 + 1] = ctx->state[i] >> 16;
+        digest[i * 4 + 2] = ctx->state[i] >> 8;
+        digest[i * 4 + 3] = ctx->state[i];
+    }
+}
+
+void sha256_hex(const unsigned char digest[32], char hex[65]) {
+    for (int i = 0; i < 32; i++) {
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+    }
+}
+
+int sha256_file(const char* path, char hex[65]) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    Sha256 ctx;
+    unsigned char chunk[65536];
+    unsigned char digest[32];
+    ssize_t got;
+    sha256_init(&ctx);
+    while ((got = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return 0;
+        }
+        sha256_update(&ctx, chunk, got);
+    }
+    close(fd);
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, hex);
+    return 1;
+}
+
+// Tablas de DEFLATE (RFC 1951)
+static const uint16_t deflate_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t deflate_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t deflate_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t deflate_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t deflate_codelen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_BLOCK_SYMBOLS 16384
+
+static int deflate_length_code(int length) {
+    int l = length - 3;
+    if (l < 8) return l;
+    if (l == 255) return 28;
+    int msb = 31 - __builtin_clz(l);
+    return 4 * (msb - 1) + ((l >> (msb - 2)) & 3);
+}
+
+static int deflate_dist_code(int dist) {
+    int d = dist - 1;
+    if (d < 4) return d;
+    int msb = 31 - __builtin_clz(d);
+    return 2 * msb + ((d >> (msb - 1)) & 1);
+}
+
+// Escritor de bits (LSB primero, como pide DEFLATE)
+typedef struct {
+    ByteBuffer* out;
+    uint64_t bits;
+    int count;
+} BitWriter;
+
+static void put_bits(BitWriter* writer, uint32_t value, int count) {
+    writer->bits |= (uint64_t)value << writer->count;
+    writer->count += count;
+    while (writer->count >= 8) {
+        unsigned char byte = writer->bits & 0xff;
+        buffer_append(writer->out, &byte, 1);
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+}
+
+static void align_bits(BitWriter* writer) {
+    if (writer->count > 0) {
+        put_bits(writer, 0, 8 - writer->count);
+    }
+}
+
+// Longitudes de Huffman limitadas a max_bits (se reducen frecuencias si se excede)
+typedef struct {
+    uint32_t freq;
+    int symbol;
+} HuffmanLeaf;
+
+static int compare_huffman_leaves(const void* a, const void* b) {
+    const HuffmanLeaf* x = a;
+    const HuffmanLeaf* y = b;
+    if (x->freq != y->freq) return x->freq < y->freq ? -1 : 1;
+    return x->symbol - y->symbol;
+}
+
+static void build_huffman_lengths(const uint32_t* freq, int count, int max_bits, uint8_t* lengths) {
+    HuffmanLeaf leaves[320];
+    uint32_t weight[640];
+    int parent[640];
+    int used = 0;
+
+    memset(lengths, 0, count);
+    for (int i = 0; i < count; i++) {
+        if (freq[i]) {
+            leaves[used].freq = freq[i];
+            leaves[used].symbol = i;
+            used++;
+        }
+    }
+    if (used == 0) return;
+    if (used == 1) {
+        lengths[leaves[0].symbol] = 1;
+        return;
+    }
+
+    for (;;) {
+        qsort(leaves, used, sizeof(HuffmanLeaf), compare_huffman_leaves);
+        for (int i = 0; i < used; i++) {
+            weight[i] = leaves[i].freq;
+        }
+
+        // Dos colas: hojas ordenadas y nodos internos (creados en orden creciente)
+        int leaf = 0, node = used, next_node = used;
+        for (int merged = 0; merged < used - 1; merged++) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < used && (node >= next_node || weight[leaf] <= weight[node])) {
+                    pick[k] = leaf++;
+                } else {
+                    pick[k] = node++;
+                }
+            }
+            weight[next_node] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = next_node;
+            parent[pick[1]] = next_node;
+            next_node++;
+        }
+
+        int root = next_node - 1;
+        int depth[640];
+        int too_deep = 0;
+        depth[root] = 0;
+        for (int i = root - 1; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+        }
+        for (int i = 0; i < used; i++) {
+            if (depth[i] > max_bits) too_deep = 1;
+        }
+        if (!too_deep) {
+            for (int i = 0; i < used; i++) {
+                lengths[leaves[i].symbol] = depth[i];
+            }
+            return;
+        }
+        for (int i = 0; i < used; i++) {
+            leaves[i].freq = (leaves[i].freq + 1) / 2;
+        }
+    }
+}
+
+// Códigos canónicos, ya invertidos para el escritor LSB
+static void build_canonical_codes(const uint8_t* lengths, int count, uint16_t* codes) {
+    int bl_count[16] = {0};
+    int next_code[16];
+    for (int i = 0; i < count; i++) {
+        bl_count[lengths[i]]++;
+    }
+    bl_count[0] = 0;
+    int code = 0;
+    for (int bits = 1; bits < 16; bits++) {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+    for (int i = 0; i < count; i++) {
+        int len = lengths[i];
+        if (len) {
+            int c = next_code[len]++;
+            int reversed = 0;
+            for (int b = 0; b < len; b++) {
+                reversed = (reversed << 1) | ((c >> b) & 1);
+            }
+            codes[i] = reversed;
+        } else {
+            codes[i] = 0;
+        }
+    }
+}
+
+typedef struct {
+    int max_chain;
+    int nice_length;
+    int lazy;
+} DeflateLevel;
+
+static DeflateLevel deflate_level_params(int level) {
+    DeflateLevel params;
+    if (level <= 1) {
+        params.max_chain = 4;
+        params.nice_length = 16;
+        params.lazy = 0;
+    } else if (level < 9) {
+        params.max_chain = 128;
+        params.nice_length = 128;
+        params.lazy = 1;
+    } else {
+        params.max_chain = 4096;
+        params.nice_length = DEFLATE_MAX_MATCH;
+        params.lazy = 1;
+    }
+    return params;
+}
+
+// Símbolos de un bloque: dist == 0 significa literal
+typedef struct {
+    uint16_t value;
+    uint16_t dist;
+} DeflateSymbol;
+
+static void deflate_write_block(BitWriter* writer, const DeflateSymbol* symbols, int symbol_count,
+                                const unsigned char* raw, size_t raw_length, int final) {
+    uint32_t ll_freq[286] = {0};
+    uint32_t d_freq[30] = {0};
+    uint8_t ll_len[286], d_len[30];
+    uint16_t ll_code[288], d_code[30];
+
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].dist == 0) {
+            ll_freq[symbols[i].value]++;
+        } else {
+            ll_freq[257 + deflate_length_code(symbols[i].value)]++;
+            d_freq[deflate_dist_code(symbols[i].dist)]++;
+        }
+    }
+    ll_freq[256] = 1;
+
+    build_huffman_lengths(ll_freq, 286, 15, ll_len);
+    build_huffman_lengths(d_freq, 30, 15, d_len);
+
+    // Siempre al menos dos códigos de distancia para decodificadores antiguos
+    int d_used = 0;
+    for (int i = 0; i < 30; i++) {
+        if (d_len[i]) d_used++;
+    }
+    if (d_used < 2) {
+        for (int i = 0; i < 30 && d_used < 2; i++) {
+            if (!d_len[i]) {
+                d_len[i] = 1;
+                d_used++;
+            } else {
+                d_len[i] = 1;
+            }
+        }
+    }
+
+    int hlit = 286;
+    while (hlit > 257 && ll_len[hlit - 1] == 0) hlit--;
+    int hdist = 30;
+    while (hdist > 1 && d_len[hdist - 1] == 0) hdist--;
+
+    // Codificar las longitudes con RLE (símbolos 16, 17 y 18)
+    uint8_t lengths[316];
+    uint8_t rle_symbol[316], rle_extra[316];
+    int rle_count = 0;
+    memcpy(lengths, ll_len, hlit);
+    memcpy(lengths + hlit, d_len, hdist);
+    int total = hlit + hdist;
+    for (int i = 0; i < total;) {
+        int run = 1;
+        while (i + run < total && lengths[i + run] == lengths[i]) run++;
+        if (lengths[i] == 0 && run >= 3) {
+            if (run > 138) run = 138;
+            rle_symbol[rle_count] = run >= 11 ? 18 : 17;
+            rle_extra[rle_count++] = run >= 11 ? run - 11 : run - 3;
+            i += run;
+        } else if (lengths[i] != 0 && i > 0 && lengths[i - 1] == lengths[i] && run >= 3) {
+            if (run > 6) run = 6;
+            rle_symbol[rle_count] = 16;
+            rle_extra[rle_count++] = run - 3;
+            i += run;
+        } else {
+            rle_symbol[rle_count] = lengths[i];
+            rle_extra[rle_count++] = 0;
+            i++;
+        }
+    }
+
+    uint32_t cl_freq[19] = {0};
+    uint8_t cl_len[19];
+    uint16_t cl_code[19];
+    for (int i = 0; i < rle_count; i++) {
+        cl_freq[rle_symbol[i]]++;
+    }
+    build_huffman_lengths(cl_freq, 19, 7, cl_len);
+    int hclen = 19;
+    while (hclen > 4 && cl_len[deflate_codelen_order[hclen - 1]] == 0) hclen--;
+
+    // Comparar costos: dinámico, fijo y almacenado
+    uint8_t fixed_ll_len[288], fixed_d_len[30];
+    for (int i = 0; i < 288; i++) {
+        fixed_ll_len[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    for (int i = 0; i < 30; i++) {
+        fixed_d_len[i] = 5;
+    }
+
+    uint64_t dynamic_bits = 3 + 14 + 3 * hclen;
+    uint64_t fixed_bits = 3;
+    for (int i = 0; i < rle_count; i++) {
+        int s = rle_symbol[i];
+        dynamic_bits += cl_len[s] + (s == 16 ? 2 : s == 17 ? 3 : s == 18 ? 7 : 0);
+    }
+    for (int i = 0; i < 286; i++) {
+        uint32_t extra = i >= 257 ? deflate_length_extra[i - 257] : 0;
+        dynamic_bits += (uint64_t)ll_freq[i] * (ll_len[i] + extra);
+        fixed_bits += (uint64_t)ll_freq[i] * (fixed_ll_len[i] + extra);
+    }
+    for (int i = 0; i < 30; i++) {
+        dynamic_bits += (uint64_t)d_freq[i] * (d_len[i] + deflate_dist_extra[i]);
+        fixed_bits += (uint64_t)d_freq[i] * (fixed_d_len[i] + deflate_dist_extra[i]);
+    }
+    size_t stored_chunks = raw_length ? (raw_length + 65534) / 65535 : 1;
+    uint64_t stored_bits = (uint64_t)raw_length * 8 + stored_chunks * (3 + 7 + 32);
+
+    if (stored_bits <= dynamic_bits && stored_bits <= fixed_bits) {
+        size_t offset = 0;
+        do {
+            size_t chunk = raw_length - offset > 65535 ? 65535 : raw_length - offset;
+            int last = final && offset + chunk == raw_length;
+            put_bits(writer, last, 1);
+            put_bits(writer, 0, 2);
+            align_bits(writer);
+            unsigned char header[4];
+            put_le16(header, chunk);
+            put_le16(header + 2, ~chunk & 0xffff);
+            buffer_append(writer->out, header, 4);
+            buffer_append(writer->out, raw + offset, chunk);
+            offset += chunk;
+        } while (offset < raw_length);
+        return;
+    }
+
+    const uint8_t* use_ll_len = ll_len;
+    const uint8_t* use_d_len = d_len;
+    put_bits(writer, final, 1);
+    if (fixed_bits <= dynamic_bits) {
+        put_bits(writer, 1, 2);
+        use_ll_len = fixed_ll_len;
+        use_d_len = fixed_d_len;
+        build_canonical_codes(fixed_ll_len, 288, ll_code);
+        build_canonical_codes(fixed_d_len, 30, d_code);
+    } else {
+        put_bits(writer, 2, 2);
+        build_canonical_codes(ll_len, 286, ll_code);
+        build_canonical_codes(d_len, 30, d_code);
+        build_canonical_codes(cl_len, 19, cl_code);
+        put_bits(writer, hlit - 257, 5);
+        put_bits(writer, hdist - 1, 5);
+        put_bits(writer, hclen - 4, 4);
+        for (int i = 0; i < hclen; i++) {
+            put_bits(writer, cl_len[deflate_codelen_order[i]], 3);
+        }
+        for (int i = 0; i < rle_count; i++) {
+            int s = rle_symbol[i];
+            put_bits(writer, cl_code[s], cl_len[s]);
+            if (s == 16) put_bits(writer, rle_extra[i], 2);
+            if (s == 17) put_bits(writer, rle_extra[i], 3);
+            if (s == 18) put_bits(writer, rle_extra[i], 7);
+        }
+    }
+
+    for (int i = 0; i < symbol_count; i++) {
+        if (symbols[i].dist == 0) {
+            put_bits(writer, ll_code[symbols[i].value], use_ll_len[symbols[i].value]);
+        } else {
+            int lc = deflate_length_code(symbols[i].value);
+            int dc = deflate_dist_code(symbols[i].dist);
+            put_bits(writer, ll_code[257 + lc], use_ll_len[257 + lc]);
+            put_bits(writer, symbols[i].value - deflate_length_base[lc], deflate_length_extra[lc]);
+            put_bits(writer, d_code[dc], use_d_len[dc]);
+            put_bits(writer, symbols[i].dist - deflate_dist_base[dc], deflate_dist_extra[dc]);
+        }
+    }
+    put_bits(writer, ll_code[256], use_ll_len[256]);
+}
+
+static uint32_t deflate_hash(const unsigned char* p) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+}
+
+// Compresor DEFLATE con cadenas hash y emparejamiento perezoso
+int deflate_compress(const unsigned char* input, size_t length, int level, ByteBuffer* output) {
+    return deflate_compress_part(input, length, level, 1, output);
+}
+
+// Un trozo de un flujo DEFLATE: si no es el último termina con un bloque
+// almacenado vacío (como Z_SYNC_FLUSH), así los trozos se concatenan en bytes
+int deflate_compress_part(const unsigned char* input, size_t length, int level, int last, ByteBuffer* output) {
+    DeflateLevel params = deflate_level_params(level);
+    BitWriter writer = {output, 0, 0};
+    int32_t* head = malloc(sizeof(int32_t) << DEFLATE_HASH_BITS);
+    int32_t* prev = malloc(sizeof(int32_t) * DEFLATE_WINDOW_SIZE);
+    DeflateSymbol* symbols = malloc(sizeof(DeflateSymbol) * DEFLATE_BLOCK_SYMBOLS);
+    if (!head || !prev || !symbols) {
+        free(head);
+        free(prev);
+        free(symbols);
+        return 0;
+    }
+    memset(head, 0xff, sizeof(int32_t) << DEFLATE_HASH_BITS);
+
+    int symbol_count = 0;
+    size_t block_start = 0;
+    size_t pos = 0;
+
+    #define INSERT_POSITION(p) do { \
+        if ((p) + DEFLATE_MIN_MATCH <= length) { \
+            uint32_t h_ = deflate_hash(input + (p)); \
+            prev[(p) & DEFLATE_WINDOW_MASK] = head[h_]; \
+            head[h_] = (int32_t)(p); \
+        } \
+    } while (0)
+
+    while (pos < length) {
+        if (symbol_count >= DEFLATE_BLOCK_SYMBOLS - 2) {
+            deflate_write_block(&writer, symbols, symbol_count, input + block_start, pos - block_start, 0);
+            symbol_count = 0;
+            block_start = pos;
+        }
+
+        int best_length = 0, best_dist = 0;
+        for (int attempt = 0; attempt < 2; attempt++) {
+            size_t at = pos + attempt;
+            int found_length = 0, found_dist = 0;
+            if (at + DEFLATE_MIN_MATCH <= length) {
+                int max_length = length - at > DEFLATE_MAX_MATCH ? DEFLATE_MAX_MATCH : (int)(length - at);
+                int32_t candidate = head[deflate_hash(input + at)];
+                int chain = params.max_chain;
+                while (candidate >= 0 && at - candidate <= DEFLATE_WINDOW_SIZE && chain-- > 0) {
+                    const unsigned char* a = input + candidate;
+                    const unsigned char* b = input + at;
+                    if (a[found_length] == b[found_length] && a[0] == b[0]) {
+                        int l = 0;
+                        while (l < max_length && a[l] == b[l]) l++;
+                        if (l > found_length) {
+                            found_length = l;
+                            found_dist = at - candidate;
+                            if (l >= params.nice_length) break;
+                        }
+                    }
+                    int32_t next = prev[candidate & DEFLATE_WINDOW_MASK];
+                    if (next >= candidate) break;
+                    candidate = next;
+                }
+                if (found_length == DEFLATE_MIN_MATCH && found_dist > 4096) {
+                    found_length = 0;
+                }
+            }
+            if (attempt == 0) {
+                INSERT_POSITION(pos);
+                best_length = found_length;
+                best_dist = found_dist;
+                if (!params.lazy || best_length < DEFLATE_MIN_MATCH || best_length >= params.nice_length) break;
+            } else if (found_length > best_length) {
+                // Mejor coincidencia un byte después: emitir literal y repetir
+                symbols[symbol_count].value = input[pos];
+                symbols[symbol_count++].dist = 0;
+                pos++;
+                INSERT_POSITION(pos);
+                best_length = found_length;
+                best_dist = found_dist;
+                if (best_length < params.nice_length && symbol_count < DEFLATE_BLOCK_SYMBOLS - 2) {
+                    attempt = 0;
+                }
+            }
+        }
+
+        if (best_length >= DEFLATE_MIN_MATCH) {
+            symbols[symbol_count].value = best_length;
+            symbols[symbol_count++].dist = best_dist;
+            for (int i = 1; i < best_length; i++) {
+                INSERT_POSITION(pos + i);
+            }
+            pos += best_length;
+        } else {
+            symbols[symbol_count].value = input[pos];
+            symbols[symbol_count++].dist = 0;
+            pos++;
+        }
+    }
+    #undef INSERT_POSITION
+
+    deflate_write_block(&writer, symbols, symbol_count, input + block_start, pos - block_start, last);
+    if (!last) {
+        put_bits(&writer, 0, 3);
+        align_bits(&writer);
+        put_bits(&writer, 0xffff0000u, 32);
+    }
+    align_bits(&writer);
+
+    free(head);
+    free(prev);
+    free(symbols);
+    return 1;
+}
+
+// Códec "fast": formato de bloque LZ4 (una sola prueba por posición, descompresión muy rápida)
+#define FAST_HASH_BITS 16
+#define FAST_MIN_MATCH 4
+#define FAST_MAX_OFFSET 65535
+
+static uint32_t fast_hash(const unsigned char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - FAST_HASH_BITS);
+}
+
+static void fast_put_length(ByteBuffer* output, size_t length) {
+    unsigned char byte = 255;
+    while (length >= 255) {
+        buffer_append(output, &byte, 1);
+        length -= 255;
+    }
+    byte = length;
+    buffer_append(output, &byte, 1);
+}
+
+// Secuencia LZ4: literales y (salvo la última) una coincidencia
+static void fast_put_sequence(ByteBuffer* output, const unsigned char* literals, size_t literal_length,
+                              size_t match_length, size_t offset) {
+    size_t extra = match_length ? match_length - FAST_MIN_MATCH : 0;
+    unsigned char token = (literal_length >= 15 ? 15 : literal_length) << 4;
+    if (match_length) {
+        token |= extra >= 15 ? 15 : extra;
+    }
+    buffer_append(output, &token, 1);
+    if (literal_length >= 15) {
+        fast_put_length(output, literal_length - 15);
+    }
+    buffer_append(output, literals, literal_length);
+    if (match_length) {
+        unsigned char le_offset[2] = {offset & 0xff, offset >> 8};
+        buffer_append(output, le_offset, 2);
+        if (extra >= 15) {
+            fast_put_length(output, extra - 15);
+        }
+    }
+}
+
+int fast_compress(const unsigned char* input, size_t length, ByteBuffer* output) {
+    uint32_t* table = calloc(1u << FAST_HASH_BITS, sizeof(uint32_t));
+    if (!table) {
+        return 0;
+    }
+
+    // LZ4 exige que los últimos 5 bytes sean literales y que la última
+    // coincidencia empiece al menos 12 bytes antes del final
+    size_t anchor = 0, pos = 0;
+    if (length >= 13) {
+        size_t last_start = length - 12;
+        size_t match_limit = length - 5;
+        while (pos <= last_start) {
+            uint32_t h = fast_hash(input + pos);
+            size_t candidate = table[h];
+            table[h] = pos + 1;
+            if (!candidate || pos + 1 - candidate > FAST_MAX_OFFSET ||
+                memcmp(input + candidate - 1, input + pos, FAST_MIN_MATCH) != 0) {
+                // Sin coincidencia: avanzar más deprisa en datos incompresibles
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            size_t match = candidate - 1;
+            while (pos > anchor && match > 0 && input[pos - 1] == input[match - 1]) {
+                pos--;
+                match--;
+            }
+            size_t match_length = FAST_MIN_MATCH;
+            while (pos + match_length < match_limit && input[match + match_length] == input[pos + match_length]) {
+                match_length++;
+            }
+            fast_put_sequence(output, input + anchor, pos - anchor, match_length, pos - match);
+            pos += match_length;
+            anchor = pos;
+            if (pos - 2 <= last_start) {
+                table[fast_hash(input + pos - 2)] = pos - 1;
+            }
+        }
+    }
+    fast_put_sequence(output, input + anchor, length - anchor, 0, 0);
+    free(table);
+    return 1;
+}
+
+// Códec "max": LZ77 con ventana de 4 MB y codificador de rango binario
+// adaptativo (modelo al estilo de LZMA, sin sus repeticiones 1-3)
+#define LZR_WINDOW_SIZE (1 << 22)
+#define LZR_HASH_BITS 22     // máximo; la tabla se ajusta al tamaño de la entrada
+#define LZR_MIN_MATCH 2
+#define LZR_MAX_MATCH 273
+#define LZR_MAX_CHAIN 64
+#define LZR_NICE_MATCH 64    // una coincidencia así de larga basta (como nice_len de xz)
+#define LZR_STATES 12
+#define LZR_POS_STATES 4
+#define LZR_PROB_INIT 1024
+
+typedef uint16_t LzrProb;
+
+typedef struct {
+    LzrProb choice;
+    LzrProb choice2;
+    LzrProb low[LZR_POS_STATES][8];
+    LzrProb mid[LZR_POS_STATES][8];
+    LzrProb high[256];
+} LzrLengthModel;
+
+typedef struct {
+    LzrProb is_match[LZR_STATES][LZR_POS_STATES];
+    LzrProb is_rep[LZR_STATES];
+    LzrProb literal[8][0x300];
+    LzrProb dist_slot[4][64];
+    LzrProb dist_special[114];
+    LzrProb align[16];
+    LzrLengthModel length;
+    LzrLengthModel rep_length;
+} LzrModel;
+
+typedef struct {
+    ByteBuffer* output;
+    uint64_t low;
+    uint32_t range;
+    unsigned char cache;
+    uint64_t cache_size;
+} RangeEncoder;
+
+static void lzr_init_model(LzrModel* model) {
+    LzrProb* probs = (LzrProb*)model;
+    for (size_t i = 0; i < sizeof(LzrModel) / sizeof(LzrProb); i++) {
+        probs[i] = LZR_PROB_INIT;
+    }
+}
+
+static void rc_shift_low(RangeEncoder* rc) {
+    if ((uint32_t)rc->low < 0xff000000u || (rc->low >> 32) != 0) {
+        unsigned char carry = rc->low >> 32;
+        unsigned char byte = rc->cache;
+        do {
+            unsigned char out = byte + carry;
+            buffer_append(rc->output, &out, 1);
+            byte = 0xff;
+        } while (--rc->cache_size != 0);
+        rc->cache = (rc->low >> 24) & 0xff;
+    }
+    rc->cache_size++;
+    rc->low = (rc->low & 0x00ffffff) << 8;
+}
+
+static void rc_bit(RangeEncoder* rc, LzrProb* prob, int bit) {
+    uint32_t bound = (rc->range >> 11) * *prob;
+    if (!bit) {
+        rc->range = bound;
+        *prob += (2048 - *prob) >> 5;
+    } else {
+        rc->low += bound;
+        rc->range -= bound;
+        *prob -= *prob >> 5;
+    }
+    while (rc->range < (1u << 24)) {
+        rc->range <<= 8;
+        rc_shift_low(rc);
+    }
+}
+
+static void rc_direct_bits(RangeEncoder* rc, uint32_t value, int count) {
+    while (count-- > 0) {
+        rc->range >>= 1;
+        if ((value >> count) & 1) {
+            rc->low += rc->range;
+        }
+        while (rc->range < (1u << 24)) {
+            rc->range <<= 8;
+            rc_shift_low(rc);
+        }
+    }
+}
+
+static void rc_bit_tree(RangeEncoder* rc, LzrProb* probs, int bits, uint32_t value) {
+    uint32_t m = 1;
+    while (bits-- > 0) {
+        int bit = (value >> bits) & 1;
+        rc_bit(rc, &probs[m], bit);
+        m = (m << 1) | bit;
+    }
+}
+
+static void rc_reverse_bit_tree(RangeEncoder* rc, LzrProb* probs, int bits, uint32_t value) {
+    uint32_t m = 1;
+    for (int i = 0; i < bits; i++) {
+        int bit = (value >> i) & 1;
+        rc_bit(rc, &probs[m], bit);
+        m = (m << 1) | bit;
+    }
+}
+
+static void lzr_put_length(RangeEncoder* rc, LzrLengthModel* model, int pos_state, int length) {
+    length -= LZR_MIN_MATCH;
+    if (length < 8) {
+        rc_bit(rc, &model->choice, 0);
+        rc_bit_tree(rc, model->low[pos_state], 3, length);
+    } else if (length < 16) {
+        rc_bit(rc, &model->choice, 1);
+        rc_bit(rc, &model->choice2, 0);
+        rc_bit_tree(rc, model->mid[pos_state], 3, length - 8);
+    } else {
+        rc_bit(rc, &model->choice, 1);
+        rc_bit(rc, &model->choice2, 1);
+        rc_bit_tree(rc, model->high, 8, length - 16);
+    }
+}
+
+static void lzr_put_distance(RangeEncoder* rc, LzrModel* model, int length, uint32_t dist) {
+    int slot;
+    if (dist < 4) {
+        slot = dist;
+    } else {
+        int top = 31 - __builtin_clz(dist);
+        slot = (top << 1) | ((dist >> (top - 1)) & 1);
+    }
+    int length_state = length - LZR_MIN_MATCH < 3 ? length - LZR_MIN_MATCH : 3;
+    rc_bit_tree(rc, model->dist_slot[length_state], 6, slot);
+    if (slot < 4) {
+        return;
+    }
+    int footer_bits = (slot >> 1) - 1;
+    uint32_t base = (2 | (slot & 1)) << footer_bits;
+    uint32_t reduced = dist - base;
+    if (slot < 14) {
+        rc_reverse_bit_tree(rc, model->dist_special + base - slot - 1, footer_bits, reduced);
+    } else {
+        rc_direct_bits(rc, reduced >> 4, footer_bits - 4);
+        rc_reverse_bit_tree(rc, model->align, 4, reduced & 15);
+    }
+}
+
+static void lzr_put_literal(RangeEncoder* rc, LzrModel* model, const unsigned char* input, size_t pos,
+                            int state, uint32_t rep0) {
+    LzrProb* probs = model->literal[pos ? input[pos - 1] >> 5 : 0];
+    uint32_t symbol = input[pos] | 0x100;
+    uint32_t m = 1;
+    if (state >= 7) {
+        // Literal tras una coincidencia: se modela junto al byte que se habría repetido
+        uint32_t match_byte = input[pos - rep0 - 1];
+        for (int i = 7; i >= 0; i--) {
+            int bit = (symbol >> i) & 1;
+            int match_bit = (match_byte >> i) & 1;
+            rc_bit(rc, &probs[((1 + match_bit) << 8) + m], bit);
+            m = (m << 1) | bit;
+            if (match_bit != bit) {
+                for (i--; i >= 0; i--) {
+                    bit = (symbol >> i) & 1;
+                    rc_bit(rc, &probs[m], bit);
+                    m = (m << 1) | bit;
+                }
+                break;
+            }
+        }
+        return;
+    }
+    rc_bit_tree(rc, probs, 8, input[pos]);
+}
+
+static int lzr_match_length(const unsigned char* input, size_t length, size_t pos, size_t match) {
+    size_t max_length = length - pos > LZR_MAX_MATCH ? LZR_MAX_MATCH : length - pos;
+    size_t l = 0;
+    while (l < max_length && input[match + l] == input[pos + l]) {
+        l++;
+    }
+    return l;
+}
+
+static uint32_t lzr_hash(const unsigned char* p, int bits) {
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - bits);
+}
+
+// Mejor coincidencia en la cadena hash (longitud 0 si no hay)
+static int lzr_find_match(const unsigned char* input, size_t length, size_t pos,
+                          const int32_t* head, int hash_bits, const int32_t* prev, uint32_t* dist) {
+    if (pos + 3 > length) {
+        return 0;
+    }
+    int best = 0;
+    int32_t candidate = head[lzr_hash(input + pos, hash_bits)];
+    int chain = LZR_MAX_CHAIN;
+    while (candidate >= 0 && pos - candidate <= LZR_WINDOW_SIZE && chain-- > 0) {
+        if (input[candidate + best] == input[pos + best]) {
+            int l = lzr_match_length(input, length, pos, candidate);
+            if (l > best) {
+                best = l;
+                *dist = pos - candidate - 1;
+                if (l >= LZR_NICE_MATCH) break;
+            }
+        }
+        candidate = prev[candidate];
+    }
+    // Coincidencias de 3 bytes lejanas cuestan más que los literales
+    if (best < 3 || (best == 3 && *dist >= 0x4000)) {
+        return 0;
+    }
+    return best;
+}
+
+int max_compress(const unsigned char* input, size_t length, ByteBuffer* output) {
+    // Cerca de un cubo por posición de la ventana: con menos, las cadenas se llenan
+    // de colisiones y cada salto es un fallo de caché (muy lento en datos aleatorios)
+    int hash_bits = 12;
+    while (hash_bits < LZR_HASH_BITS && ((size_t)1 << hash_bits) < length) {
+        hash_bits++;
+    }
+    LzrModel* model = malloc(sizeof(LzrModel));
+    int32_t* head = malloc(sizeof(int32_t) << hash_bits);
+    int32_t* prev = malloc(sizeof(int32_t) * (length ? length : 1));
+    if (!model || !head || !prev || length > INT32_MAX) {
+        free(model);
+        free(head);
+        free(prev);
+        return 0;
+    }
+    lzr_init_model(model);
+    memset(head, 0xff, sizeof(int32_t) << hash_bits);
+    RangeEncoder rc = {output, 0, 0xffffffffu, 0, 1};
+
+    #define LZR_INSERT(p) do { \
+        if ((p) + 3 <= length) { \
+            uint32_t h_ = lzr_hash(input + (p), hash_bits); \
+            prev[p] = head[h_]; \
+            head[h_] = (int32_t)(p); \
+        } \
+    } while (0)
+
+    int state = 0;
+    uint32_t rep0 = 0;
+    size_t pos = 0;
+    size_t literal_run = 0;
+    while (pos < length) {
+        int pos_state = pos & (LZR_POS_STATES - 1);
+        int rep_length = pos > rep0 ? lzr_match_length(input, length, pos, pos - rep0 - 1) : 0;
+        uint32_t dist = 0;
+        int match_length = 0;
+        // Tras muchos literales seguidos (datos aleatorios o ya comprimidos) se busca
+        // sólo en una de cada 2..16 posiciones, como hacen LZ4 y zstd
+        size_t step = literal_run < 256 ? 1 : 1 + (literal_run >> 8 < 15 ? literal_run >> 8 : 15);
+        if (literal_run % step == 0) {
+            match_length = lzr_find_match(input, length, pos, head, hash_bits, prev, &dist);
+            LZR_INSERT(pos);
+        }
+
+        // Emparejamiento perezoso: si un byte después hay algo mejor, literal ahora
+        if (match_length > rep_length + 1 && match_length < LZR_MAX_MATCH) {
+            uint32_t next_dist = 0;
+            int next_length = lzr_find_match(input, length, pos + 1, head, hash_bits, prev, &next_dist);
+            if (next_length > match_length + (next_dist >> 7 > dist ? 1 : 0)) {
+                match_length = 0;
+                rep_length = 0;
+            }
+        }
+
+        if (rep_length >= LZR_MIN_MATCH && rep_length + 1 >= match_length) {
+            rc_bit(&rc, &model->is_match[state][pos_state], 1);
+            rc_bit(&rc, &model->is_rep[state], 1);
+            lzr_put_length(&rc, &model->rep_length, pos_state, rep_length);
+            state = state < 7 ? 8 : 11;
+            literal_run = 0;
+            for (int i = 1; i < rep_length; i++) {
+                LZR_INSERT(pos + i);
+            }
+            pos += rep_length;
+        } else if (match_length >= 3) {
+            rc_bit(&rc, &model->is_match[state][pos_state], 1);
+            rc_bit(&rc, &model->is_rep[state], 0);
+            lzr_put_length(&rc, &model->length, pos_state, match_length);
+            lzr_put_distance(&rc, model, match_length, dist);
+            rep0 = dist;
+            state = state < 7 ? 7 : 10;
+            literal_run = 0;
+            for (int i = 1; i < match_length; i++) {
+                LZR_INSERT(pos + i);
+            }
+            pos += match_length;
+        } else {
+            rc_bit(&rc, &model->is_match[state][pos_state], 0);
+            lzr_put_literal(&rc, model, input, pos, state, rep0);
+            state = state < 4 ? 0 : state < 10 ? state - 3 : state - 6;
+            literal_run++;
+            pos++;
+        }
+    }
+    #undef LZR_INSERT
+
+    for (int i = 0; i < 5; i++) {
+        rc_shift_low(&rc);
+    }
+    free(model);
+    free(head);
+    free(prev);
+    return 1;
+}
+
+// Funciones de empaquetado real
+static int compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Datos de lstat: un enlace simbólico ocupa la longitud de su destino
+static void set_pack_entry_stat(PackEntry* entry, const struct stat* st) {
+    entry->mode = st->st_mode;
+    entry->mtime_ns = (long long)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    entry->raw_size = S_ISDIR(st->st_mode) ? 0 : (size_t)st->st_size;
+    entry->is_directory = S_ISDIR(st->st_mode);
+    entry->sparse = S_ISREG(st->st_mode) && (unsigned long long)st->st_blocks * 512 < (unsigned long long)st->st_size;
+    entry->device = st->st_dev;
+    entry->inode = st->st_ino;
+}
+
+static void add_pack_entry(PackList* list, const char* name, const char* full_path, const struct stat* st) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->entries = checked_realloc(list->entries, list->capacity * sizeof(PackEntry));
+    }
+    PackEntry* entry = &list->entries[list->count++];
+    memset(entry, 0, sizeof(PackEntry));
+    entry->name = strdup(name);
+    entry->full_path = strdup(full_path);
+    entry->data_fd = -1;
+    set_pack_entry_stat(entry, st);
+    entry->done = entry->is_directory;
+}
+
+static void release_pack_data(PackEntry* entry) {
+    free(entry->data);
+    entry->data = NULL;
+    if (entry->owns_data_fd) {
+        close(entry->data_fd);
+    }
+    entry->data_fd = -1;
+    entry->owns_data_fd = 0;
+}
+
+void free_pack_list(PackList* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->entries[i].name);
+        free(list->entries[i].full_path);
+        release_pack_data(&list->entries[i]);
+    }
+    free(list->entries);
+    list->entries = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
+
+// Recorre source/ en orden alfabético para que el archivo sea determinista
+int collect_source_entries(const char* dir_path, const char* prefix, PackList* list) {
+    DIR* dir = opendir(dir_path);
+    if (!dir) {
+        printf("Cannot open %s, Error!\n", dir_path);
+        return 0;
+    }
+
+    char** names = NULL;
+    size_t name_count = 0, name_capacity = 0;
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) {
+            continue;
+        }
+        if (name_count == name_capacity) {
+            name_capacity = name_capacity ? name_capacity * 2 : 64;
+            names = checked_realloc(names, name_capacity * sizeof(char*));
+        }
+        names[name_count++] = strdup(item->d_name);
+    }
+    closedir(dir);
+    qsort(names, name_count, sizeof(char*), compare_names);
+
+    int ok = 1;
+    for (size_t i = 0; i < name_count; i++) {
+        char full_path[MAX_PATH_LENGTH];
+        char name[MAX_PATH_LENGTH];
+        struct stat st;
+        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, names[i]);
+        snprintf(name, sizeof(name), "%s%s", prefix, names[i]);
+
+        // Los enlaces simbólicos se guardan como tales (y no se siguen)
+        if (ok && lstat(full_path, &st) != 0) {
+            printf("Cannot open %s, Error!\n", full_path);
+            ok = 0;
+        }
+        if (ok && S_ISDIR(st.st_mode)) {
+            strncat(name, "/", sizeof(name) - strlen(name) - 1);
+            add_pack_entry(list, name, full_path, &st);
+            ok = collect_source_entries(full_path, name, list);
+        } else if (ok && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode))) {
+            add_pack_entry(list, name, full_path, &st);
+        }
+        free(names[i]);
+    }
+    free(names);
+    return ok;
+}
+
+static int read_whole_file(const char* path, unsigned char** data, size_t* length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    size_t capacity = st.st_size > 0 ? (size_t)st.st_size : 0;
+    unsigned char* buffer = checked_realloc(NULL, capacity + 1);
+    size_t used = 0;
+    for (;;) {
+        if (used == capacity) {
+            capacity = capacity ? capacity * 2 : 4096;
+            buffer = checked_realloc(buffer, capacity + 1);
+        }
+        ssize_t got = read(fd, buffer + used, capacity - used);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            free(buffer);
+            close(fd);
+            return 0;
+        }
+        if (got == 0) break;
+        used += got;
+    }
+    close(fd);
+    buffer[used] = '\0';
+    *data = buffer;
+    *length = used;
+    return 1;
+}
+
+// Reutiliza los bytes comprimidos de la compilación anterior
+static int reuse_previous_entry(PackEntry* entry, const ManifestEntry* previous, int previous_fd) {
+    if (previous_fd < 0 || (previous->method != METHOD_STORED && previous->method != METHOD_DEFLATE &&
+                            previous->method != METHOD_FAST && previous->method != METHOD_MAX)) {
+        return 0;
+    }
+    if (previous->compressed_size > PACK_CHUNK_SIZE) {
+        // Grande: el escritor copia el rango directamente del archivo anterior
+        entry->data_fd = previous_fd;
+        entry->data_offset = previous->data_offset;
+    } else {
+        unsigned char* data = checked_realloc(NULL, previous->compressed_size);
+        size_t done = 0;
+        while (done < previous->compressed_size) {
+            ssize_t got = pread(previous_fd, data + done, previous->compressed_size - done,
+                                previous->data_offset + done);
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                free(data);
+                return 0;
+            }
+            done += got;
+        }
+        entry->data = data;
+    }
+    entry->compressed_size = previous->compressed_size;
+    entry->raw_size = previous->size;
+    entry->method = previous->method;
+    entry->crc = previous->crc;
+    memcpy(entry->hash, previous->hash, sizeof(entry->hash));
+    entry->reused = 1;
+    return 1;
+}
+
+// Un duplicado se guarda como enlace simbólico relativo al original
+// (unzip lo restaura como symlink; lightpath_app como enlace duro)
+static void link_pack_entry(PackEntry* entry) {
+    ByteBuffer target = {0};
+    for (const char* p = entry->name; *p; p++) {
+        if (*p == '/') {
+            buffer_append(&target, "../", 3);
+        }
+    }
+    buffer_append(&target, entry->original->name, strlen(entry->original->name));
+    entry->data = target.data;
+    entry->compressed_size = target.size;
+    entry->crc = crc32_update(0, target.data, target.size);
+    entry->method = METHOD_STORED;
+}
+
+// Un enlace simbólico de source/ guarda su destino (sin comprimir, como unzip espera)
+static void symlink_pack_entry(PackEntry* entry) {
+    char target[MAX_PATH_LENGTH];
+    ssize_t length = readlink(entry->full_path, target, sizeof(target));
+    if (length < 0 || length == sizeof(target)) {
+        entry->failed = 1;
+        return;
+    }
+    Sha256 ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    sha256_update(&ctx, target, length);
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, entry->hash);
+    entry->data = checked_realloc(NULL, length);
+    memcpy(entry->data, target, length);
+    entry->raw_size = length;
+    entry->compressed_size = length;
+    entry->crc = crc32_update(0, entry->data, length);
+    entry->method = METHOD_STORED;
+}
+
+static int read_exactly(int fd, unsigned char* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t got = read(fd, buffer + done, length - done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        done += got;
+    }
+    return 1;
+}
+
+static int write_exactly(int fd, const unsigned char* buffer, size_t length) {
+    size_t done = 0;
+    while (done < length) {
+        ssize_t written = write(fd, buffer + done, length - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        done += written;
+    }
+    return 1;
+}
+
+// Copia length bytes desde offset al final de to (copy_file_range si se puede)
+static int copy_file_part(int from, uint64_t offset, uint64_t length, int to) {
+    loff_t position = offset;
+    int use_copy_range = 1;
+    while (length > 0) {
+        size_t step = length > (1 << 30) ? (1 << 30) : (size_t)length;
+        ssize_t copied;
+        if (use_copy_range) {
+            copied = copy_file_range(from, &position, to, NULL, step, 0);
+            if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                use_copy_range = 0;
+                continue;
+            }
+        } else {
+            unsigned char buffer[65536];
+            copied = pread(from, buffer, step < sizeof(buffer) ? step : sizeof(buffer), position);
+            if (copied > 0 && !write_exactly(to, buffer, copied)) return 0;
+            if (copied > 0) position += copied;
+        }
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied <= 0) return 0;
+        length -= copied;
+    }
+    return 1;
+}
+
+// Archivo temporal sin nombre en .lightpath/ para la salida comprimida de un archivo grande
+static int open_spill_file(void) {
+    int fd = open(STATE_DIR, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        char path[] = STATE_DIR "/spill.XXXXXX";
+        fd = mkstemp(path);
+        if (fd >= 0) unlink(path);
+    }
+    return fd;
+}
+
+// Archivo mayor que PACK_CHUNK_SIZE: se lee y comprime por trozos, así la
+// memoria no depende del tamaño. DEFLATE sigue siendo un solo flujo estándar;
+// "fast" y "max" guardan cada trozo como [longitud de 32 bits][datos] (si la
+// longitud es la del trozo, va sin comprimir).
+static void stream_pack_entry(PackEntry* entry, int codec, int previous_fd) {
+    const ManifestEntry* previous = entry->previous;
+    int fd = open(entry->full_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        entry->failed = 1;
+        return;
+    }
+
+    // Archivo tocado pero con el mismo contenido
+    if (previous && previous->size == entry->raw_size && sha256_file(entry->full_path, entry->hash) &&
+        strcmp(previous->hash, entry->hash) == 0 && reuse_previous_entry(entry, previous, previous_fd)) {
+        close(fd);
+        return;
+    }
+
+    int spill = codec == CODEC_NONE ? -1 : open_spill_file();
+    // Un byte más, como read_whole_file: los compresores pueden mirar uno más allá del final
+    unsigned char* raw = checked_realloc(NULL, PACK_CHUNK_SIZE + 1);
+    raw[PACK_CHUNK_SIZE] = 0;
+    ByteBuffer compressed = {0};
+    Sha256 ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    uint32_t crc = 0;
+    uint64_t read_total = 0, packed_total = 0;
+    int ok = codec == CODEC_NONE || spill >= 0;
+    while (ok && read_total < entry->raw_size) {
+        size_t length = entry->raw_size - read_total < PACK_CHUNK_SIZE ? entry->raw_size - read_total : PACK_CHUNK_SIZE;
+        ok = read_exactly(fd, raw, length);
+        if (!ok) break;
+        sha256_update(&ctx, raw, length);
+        crc = crc32_update(crc, raw, length);
+        read_total += length;
+
+        compressed.size = 0;
+        if (codec == CODEC_DEFLATE) {
+            ok = deflate_compress_part(raw, length, 6, read_total == entry->raw_size, &compressed);
+        } else if (codec == CODEC_FAST || codec == CODEC_MAX) {
+            unsigned char header[4] = {0};
+            buffer_append(&compressed, header, sizeof(header));
+            int packed = codec == CODEC_FAST ? fast_compress(raw, length, &compressed)
+                                             : max_compress(raw, length, &compressed);
+            if (!packed || compressed.size - sizeof(header) >= length) {
+                compressed.size = sizeof(header);
+                buffer_append(&compressed, raw, length);
+            }
+            put_le32(compressed.data, compressed.size - sizeof(header));
+        }
+        ok = ok && (spill < 0 || write_exactly(spill, compressed.data, compressed.size));
+        packed_total += compressed.size;
+    }
+    free(raw);
+    buffer_free(&compressed);
+    if (!ok) {
+        if (spill >= 0) close(spill);
+        close(fd);
+        entry->failed = 1;
+        return;
+    }
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, entry->hash);
+    entry->crc = crc;
+    entry->owns_data_fd = 1;
+    entry->data_offset = 0;
+    if (spill >= 0 && packed_total < entry->raw_size) {
+        entry->method = codec == CODEC_DEFLATE ? METHOD_DEFLATE : codec == CODEC_FAST ? METHOD_FAST : METHOD_MAX;
+        entry->compressed_size = packed_total;
+        entry->data_fd = spill;
+        close(fd);
+    } else {
+        // Sin compresión (o no ayuda): el escritor copia el propio archivo
+        entry->method = METHOD_STORED;
+        entry->compressed_size = entry->raw_size;
+        entry->data_fd = fd;
+        if (spill >= 0) close(spill);
+    }
+}
+
+static void compress_pack_entry(PackEntry* entry, int codec, int previous_fd) {
+    const ManifestEntry* previous = entry->previous;
+    if (entry->original) {
+        link_pack_entry(entry);
+        return;
+    }
+    if (S_ISLNK(entry->mode)) {
+        symlink_pack_entry(entry);
+        return;
+    }
+
+    // Mismo tamaño, fecha y modo: se asume el mismo contenido (como make)
+    if (previous && previous->size == entry->raw_size && previous->mtime_ns == entry->mtime_ns &&
+        previous->mode == (unsigned int)entry->mode && reuse_previous_entry(entry, previous, previous_fd)) {
+        return;
+    }
+    if (entry->raw_size > PACK_CHUNK_SIZE) {
+        stream_pack_entry(entry, codec, previous_fd);
+        return;
+    }
+
+    unsigned char* raw;
+    size_t raw_length;
+    if (!read_whole_file(entry->full_path, &raw, &raw_length)) {
+        entry->failed = 1;
+        return;
+    }
+
+    Sha256 ctx;
+    unsigned char digest[32];
+    sha256_init(&ctx);
+    sha256_update(&ctx, raw, raw_length);
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, entry->hash);
+
+    // Archivo tocado pero con el mismo contenido
+    if (previous && previous->size == raw_length && strcmp(previous->hash, entry->hash) == 0 &&
+        reuse_previous_entry(entry, previous, previous_fd)) {
+        free(raw);
+        return;
+    }
+
+    ByteBuffer compressed = {0};
+    int method = METHOD_STORED;
+    entry->raw_size = raw_length;
+    entry->crc = crc32_update(0, raw, raw_length);
+    if (raw_length > 0 && codec == CODEC_DEFLATE && deflate_compress(raw, raw_length, 6, &compressed)) {
+        method = METHOD_DEFLATE;
+    } else if (raw_length > 0 && codec == CODEC_FAST && fast_compress(raw, raw_length, &compressed)) {
+        method = METHOD_FAST;
+    } else if (raw_length > 0 && codec == CODEC_MAX && max_compress(raw, raw_length, &compressed)) {
+        method = METHOD_MAX;
+        // En archivos pequeños el modelo adaptativo apenas aprende: probar DEFLATE -9
+        ByteBuffer alternative = {0};
+        if (raw_length < 65536 && deflate_compress(raw, raw_length, 9, &alternative) &&
+            alternative.size < compressed.size) {
+            buffer_free(&compressed);
+            compressed = alternative;
+            method = METHOD_DEFLATE;
+        } else {
+            buffer_free(&alternative);
+        }
+    }
+    if (method != METHOD_STORED && compressed.size < raw_length) {
+        entry->method = method;
+        entry->data = compressed.data;
+        entry->compressed_size = compressed.size;
+        free(raw);
+    } else {
+        // Guardar sin comprimir si el códec no ayuda
+        buffer_free(&compressed);
+        entry->method = METHOD_STORED;
+        entry->data = raw;
+        entry->compressed_size = raw_length;
+    }
+}
+
+static void* pack_worker(void* arg) {
+    PackQueue* queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->next < queue->list->count &&
+               queue->next >= queue->written + queue->window) {
+            pthread_cond_wait(&queue->progress, &queue->lock);
+        }
+        if (queue->next >= queue->list->count) {
+            pthread_mutex_unlock(&queue->lock);
+            return NULL;
+        }
+        PackEntry* entry = &queue->list->entries[queue->next++];
+        pthread_mutex_unlock(&queue->lock);
+
+        if (!entry->is_directory) {
+            compress_pack_entry(entry, queue->codec, queue->previous_fd);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        entry->done = 1;
+        pthread_cond_broadcast(&queue->progress);
+        pthread_mutex_unlock(&queue->lock);
+    }
+}
+
+static void* hash_worker(void* arg) {
+    HashQueue* queue = arg;
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) {
+            return NULL;
+        }
+        // El hash de la compilación anterior vale si el archivo no se tocó
+        PackEntry* entry = queue->entries[index];
+        const ManifestEntry* previous = entry->previous;
+        if (previous && previous->size == entry->raw_size && previous->mtime_ns == entry->mtime_ns &&
+            previous->mode == (unsigned int)entry->mode && strlen(previous->hash) == 64) {
+            memcpy(entry->hash, previous->hash, sizeof(entry->hash));
+        } else if (!sha256_file(entry->full_path, entry->hash)) {
+            entry->hash[0] = '\0';
+        }
+    }
+}
+
+static int compare_entry_sizes(const void* a, const void* b) {
+    const PackEntry* x = *(const PackEntry* const*)a;
+    const PackEntry* y = *(const PackEntry* const*)b;
+    if (x->raw_size != y->raw_size) {
+        return x->raw_size < y->raw_size ? -1 : 1;
+    }
+    return x < y ? -1 : x > y;
+}
+
+static int compare_entry_contents(const void* a, const void* b) {
+    const PackEntry* x = *(const PackEntry* const*)a;
+    const PackEntry* y = *(const PackEntry* const*)b;
+    int order = strcmp(x->hash, y->hash);
+    if (order == 0 && (x->mode & 07777) != (y->mode & 07777)) {
+        order = (x->mode & 07777) < (y->mode & 07777) ? -1 : 1;
+    }
+    return order ? order : (x < y ? -1 : x > y);
+}
+
+static int compare_entry_inodes(const void* a, const void* b) {
+    const PackEntry* x = *(const PackEntry* const*)a;
+    const PackEntry* y = *(const PackEntry* const*)b;
+    if (x->device != y->device) {
+        return x->device < y->device ? -1 : 1;
+    }
+    if (x->inode != y->inode) {
+        return x->inode < y->inode ? -1 : 1;
+    }
+    return x < y ? -1 : x > y;
+}
+
+// Marca los archivos con el mismo contenido y permisos que otro anterior.
+// Los enlaces duros (mismo inodo) no hace falta hashearlos; del resto sólo
+// se hashean los archivos cuyo tamaño coincide con el de otro.
+static void find_duplicate_entries(PackList* list, int jobs) {
+    PackEntry** files = checked_realloc(NULL, sizeof(PackEntry*) * (list->count + 1));
+    size_t file_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (S_ISREG(list->entries[i].mode)) {
+            files[file_count++] = &list->entries[i];
+        }
+    }
+    qsort(files, file_count, sizeof(PackEntry*), compare_entry_inodes);
+    for (size_t i = 1; i < file_count; i++) {
+        const PackEntry* before = files[i - 1];
+        if (before->device == files[i]->device && before->inode == files[i]->inode) {
+            files[i]->original = before->original ? before->original : before;
+        }
+    }
+    size_t unique_count = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        if (!files[i]->original && files[i]->raw_size > 0) {
+            files[unique_count++] = files[i];
+        }
+    }
+    file_count = unique_count;
+    qsort(files, file_count, sizeof(PackEntry*), compare_entry_sizes);
+
+    size_t candidate_count = 0;
+    for (size_t i = 0; i < file_count; i++) {
+        if ((i > 0 && files[i - 1]->raw_size == files[i]->raw_size) ||
+            (i + 1 < file_count && files[i + 1]->raw_size == files[i]->raw_size)) {
+            files[candidate_count++] = files[i];
+        }
+    }
+
+    HashQueue queue;
+    queue.entries = files;
+    queue.count = candidate_count;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    if (jobs > (int)candidate_count) {
+        jobs = (int)candidate_count;
+    }
+    pthread_t* workers = checked_realloc(NULL, sizeof(pthread_t) * (jobs + 1));
+    int started = 0;
+    for (int i = 1; i < jobs; i++) {
+        if (pthread_create(&workers[started], NULL, hash_worker, &queue) == 0) {
+            started++;
+        }
+    }
+    hash_worker(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+
+    // El primero en el orden del archivo se guarda; los demás apuntan a él
+    qsort(files, candidate_count, sizeof(PackEntry*), compare_entry_contents);
+    for (size_t i = 1; i < candidate_count; i++) {
+        PackEntry* first = files[i - 1]->original ? (PackEntry*)files[i - 1]->original : files[i - 1];
+        if (files[i]->hash[0] && strcmp(files[i]->hash, first->hash) == 0 &&
+            (files[i]->mode & 07777) == (first->mode & 07777)) {
+            files[i]->original = first;
+        }
+    }
+    free(files);
+
+    // Si el primero de un grupo de enlaces duros resultó ser una copia, el resto
+    // del grupo apunta también al original de verdad (nunca a otra copia)
+    for (size_t i = 0; i < list->count; i++) {
+        const PackEntry* root = list->entries[i].original;
+        while (root && root->original) {
+            root = root->original;
+        }
+        list->entries[i].original = root;
+    }
+}
+
+static int compare_manifest_names(const void* a, const void* b) {
+    const ManifestEntry* x = *(const ManifestEntry* const*)a;
+    const ManifestEntry* y = *(const ManifestEntry* const*)b;
+    return strcmp(x->name, y->name);
+}
+
+static const ManifestEntry* find_manifest_entry(ManifestEntry** index, size_t count, const char* name) {
+    ManifestEntry key;
+    ManifestEntry* key_pointer = &key;
+    key.name = (char*)name;
+    ManifestEntry** found = bsearch(&key_pointer, index, count, sizeof(ManifestEntry*), compare_manifest_names);
+    return found ? *found : NULL;
+}
+
+static void add_manifest_entry(BuildManifest* manifest, const ManifestEntry* entry) {
+    if (manifest->count == manifest->capacity) {
+        manifest->capacity = manifest->capacity ? manifest->capacity * 2 : 256;
+        manifest->entries = checked_realloc(manifest->entries, manifest->capacity * sizeof(ManifestEntry));
+    }
+    manifest->entries[manifest->count] = *entry;
+    manifest->entries[manifest->count].name = strdup(entry->name);
+    manifest->count++;
+}
+
+int pack_source_directory(PackList* list, const char* archive_path, int jobs, int codec,
+                          const BuildManifest* previous, BuildManifest* current) {
+    // Índice de la compilación anterior para reutilizar entradas sin cambios
+    // (sólo si se comprimió con el mismo códec)
+    ManifestEntry** index = NULL;
+    size_t index_count = 0;
+    int previous_fd = -1;
+    if (previous && previous->valid && previous->codec == codec) {
+        index = checked_realloc(NULL, sizeof(ManifestEntry*) * previous->count);
+        for (size_t i = 0; i < previous->count; i++) {
+            index[index_count++] = &previous->entries[i];
+        }
+        qsort(index, index_count, sizeof(ManifestEntry*), compare_manifest_names);
+        previous_fd = open(archive_path, O_RDONLY);
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        // La lista puede venir de una compilación anterior (lightpath watch)
+        PackEntry* entry = &list->entries[i];
+        entry->previous = find_manifest_entry(index, index_count, entry->name);
+        entry->original = NULL;
+        entry->reused = 0;
+        entry->failed = 0;
+        entry->done = entry->is_directory;
+        entry->hash[0] = '\0';
+        entry->compressed_size = 0;
+    }
+    ProfileMark phase = profile_begin();
+    find_duplicate_entries(list, jobs);
+    profile_end(phase, "find duplicates");
+
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", archive_path);
+    FILE* archive = fopen(temp_path, "wb");
+    if (!archive) {
+        printf("Cannot create %s, Error!\n", temp_path);
+        free(index);
+        if (previous_fd >= 0) close(previous_fd);
+        return 0;
+    }
+
+    // Comprimir en paralelo; el hilo principal escribe en orden
+    PackQueue queue;
+    queue.list = list;
+    queue.next = 0;
+    queue.written = 0;
+    queue.window = (size_t)jobs * 4;
+    queue.codec = codec;
+    queue.previous_fd = previous_fd;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.progress, NULL);
+
+    pthread_t* workers = checked_realloc(NULL, sizeof(pthread_t) * jobs);
+    int started = 0;
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&workers[i], NULL, pack_worker, &queue) == 0) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        // Sin hilos disponibles: comprimir aquí mismo
+        queue.window = (size_t)-1;
+        pack_worker(&queue);
+    }
+
+    ByteBuffer central = {0};
+    uint64_t offset = 0;
+    int ok = 1;
+    for (size_t i = 0; i < list->count; i++) {
+        PackEntry* entry = &list->entries[i];
+        pthread_mutex_lock(&queue.lock);
+        while (!entry->done) {
+            pthread_cond_wait(&queue.progress, &queue.lock);
+        }
+        pthread_mutex_unlock(&queue.lock);
+
+        if (entry->failed) {
+            printf("Cannot read %s, Error!\n", entry->full_path);
+            ok = 0;
+        }
+        if (ok) {
+            // Fecha fija (1980-01-01 00:00): el archivo sólo depende del contenido de source/
+            uint16_t dos_time = 0, dos_date = (1 << 5) | 1;
+            size_t name_length = strlen(entry->name);
+            unsigned char header[46];
+
+            // Un duplicado ocupa sólo la ruta de su original
+            const PackEntry* original = entry->original;
+            uint64_t stored_size = original ? entry->compressed_size : entry->raw_size;
+            uint32_t attributes = ((uint32_t)entry->mode << 16) | (entry->is_directory ? 0x10 : 0);
+            if (original) {
+                attributes = (uint32_t)(S_IFLNK | 0777) << 16;
+            }
+
+            // ZIP64: los tamaños y desplazamientos que no caben en 32 bits van en el campo extra
+            unsigned char local_extra[20], extra[28];
+            size_t local_extra_length = 0, extra_length = 0;
+            int zip64 = stored_size >= ZIP64_LIMIT || entry->compressed_size >= ZIP64_LIMIT;
+            if (zip64) {
+                put_le16(local_extra, ZIP64_EXTRA_ID);
+                put_le16(local_extra + 2, 16);
+                put_le64(local_extra + 4, stored_size);
+                put_le64(local_extra + 12, entry->compressed_size);
+                local_extra_length = 20;
+                put_le64(extra + 4, stored_size);
+                put_le64(extra + 12, entry->compressed_size);
+                extra_length = 20;
+            }
+            if (offset >= ZIP64_LIMIT) {
+                put_le64(extra + (extra_length ? extra_length : 4), offset);
+                extra_length = (extra_length ? extra_length : 4) + 8;
+            }
+            if (extra_length) {
+                put_le16(extra, ZIP64_EXTRA_ID);
+                put_le16(extra + 2, extra_length - 4);
+            }
+            int needs_zip64 = zip64 || offset >= ZIP64_LIMIT;
+
+            put_le32(header, 0x04034b50);
+            put_le16(header + 4, needs_zip64 ? 45 : 20);
+            put_le16(header + 6, 0);
+            put_le16(header + 8, entry->method);
+            put_le16(header + 10, dos_time);
+            put_le16(header + 12, dos_date);
+            put_le32(header + 14, entry->crc);
+            put_le32(header + 18, zip64 ? 0xffffffffu : entry->compressed_size);
+            put_le32(header + 22, zip64 ? 0xffffffffu : stored_size);
+            put_le16(header + 26, name_length);
+            put_le16(header + 28, local_extra_length);
+            fwrite(header, 1, 30, archive);
+            fwrite(entry->name, 1, name_length, archive);
+            fwrite(local_extra, 1, local_extra_length, archive);
+            if (entry->data) {
+                fwrite(entry->data, 1, entry->compressed_size, archive);
+            } else if (entry->data_fd >= 0 && entry->compressed_size) {
+                // Archivo grande: se copia de un archivo sin pasar por memoria
+                if (fflush(archive) != 0 ||
+                    !copy_file_part(entry->data_fd, entry->data_offset, entry->compressed_size, fileno(archive))) {
+                    printf("Cannot write %s, Error!\n", temp_path);
+                    ok = 0;
+                }
+            }
+
+            put_le32(header, 0x02014b50);
+            put_le16(header + 4, (3 << 8) | (needs_zip64 ? 45 : 20));
+            put_le16(header + 6, needs_zip64 ? 45 : 20);
+            put_le16(header + 8, 0);
+            put_le16(header + 10, entry->method);
+            put_le16(header + 12, dos_time);
+            put_le16(header + 14, dos_date);
+            put_le32(header + 16, entry->crc);
+            put_le32(header + 20, zip64 ? 0xffffffffu : entry->compressed_size);
+            put_le32(header + 24, zip64 ? 0xffffffffu : stored_size);
+            put_le16(header + 28, name_length);
+            put_le16(header + 30, extra_length + (original ? 4 + strlen(original->name) : 0) +
+                                  (entry->sparse && !original ? 4 : 0));
+            put_le16(header + 32, 0);
+            put_le16(header + 34, 0);
+            put_le16(header + 36, 0);
+            put_le32(header + 38, attributes);
+            put_le32(header + 42, offset >= ZIP64_LIMIT ? 0xffffffffu : (uint32_t)offset);
+            buffer_append(&central, header, 46);
+            buffer_append(&central, entry->name, name_length);
+            buffer_append(&central, extra, extra_length);
+            if (original) {
+                unsigned char link_extra[4];
+                put_le16(link_extra, LINK_EXTRA_ID);
+                put_le16(link_extra + 2, strlen(original->name));
+                buffer_append(&central, link_extra, 4);
+                buffer_append(&central, original->name, strlen(original->name));
+            } else if (entry->sparse) {
+                unsigned char sparse_extra[4];
+                put_le16(sparse_extra, SPARSE_EXTRA_ID);
+                put_le16(sparse_extra + 2, 0);
+                buffer_append(&central, sparse_extra, 4);
+            }
+
+            if (current) {
+                ManifestEntry record;
+                record.name = entry->name;
+                record.size = entry->raw_size;
+                record.mtime_ns = entry->mtime_ns;
+                record.mode = entry->mode;
+                snprintf(record.hash, sizeof(record.hash), "%s", entry->hash[0] ? entry->hash : "-");
+                record.method = original ? METHOD_LINK : entry->method;
+                record.crc = entry->crc;
+                record.compressed_size = entry->compressed_size;
+                record.data_offset = offset + 30 + name_length + local_extra_length;
+                add_manifest_entry(current, &record);
+                current->reused_count += entry->reused;
+                if (original) {
+                    current->duplicate_count++;
+                    current->duplicate_bytes += entry->raw_size;
+                    current->duplicate_packed_bytes += original->compressed_size;
+                }
+            }
+            offset += 30 + name_length + local_extra_length + entry->compressed_size;
+        }
+
+        release_pack_data(entry);
+        pthread_mutex_lock(&queue.lock);
+        queue.written++;
+        pthread_cond_broadcast(&queue.progress);
+        pthread_mutex_unlock(&queue.lock);
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    free(index);
+    if (previous_fd >= 0) {
+        close(previous_fd);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.progress);
+
+    if (ok) {
+        fwrite(central.data, 1, central.size, archive);
+        // Más de 65535 entradas o más de 4 GB: registro final ZIP64 y su localizador
+        int zip64 = list->count >= 0xffff || central.size >= ZIP64_LIMIT || offset >= ZIP64_LIMIT;
+        if (zip64) {
+            unsigned char record[76];
+            put_le32(record, 0x06064b50);
+            put_le64(record + 4, 44);
+            put_le16(record + 12, (3 << 8) | 45);
+            put_le16(record + 14, 45);
+            put_le32(record + 16, 0);
+            put_le32(record + 20, 0);
+            put_le64(record + 24, list->count);
+            put_le64(record + 32, list->count);
+            put_le64(record + 40, central.size);
+            put_le64(record + 48, offset);
+            put_le32(record + 56, 0x07064b50);
+            put_le32(record + 60, 0);
+            put_le64(record + 64, offset + central.size);
+            put_le32(record + 72, 1);
+            fwrite(record, 1, sizeof(record), archive);
+        }
+        unsigned char end[22];
+        put_le32(end, 0x06054b50);
+        put_le16(end + 4, 0);
+        put_le16(end + 6, 0);
+        put_le16(end + 8, zip64 ? 0xffff : list->count);
+        put_le16(end + 10, zip64 ? 0xffff : list->count);
+        put_le32(end + 12, zip64 ? 0xffffffffu : central.size);
+        // El comentario del archivo registra el códec usado
+        char comment[64];
+        int comment_length = snprintf(comment, sizeof(comment), "lightpath codec=%s", codec_names[codec]);
+        put_le32(end + 16, zip64 ? 0xffffffffu : (uint32_t)offset);
+        put_le16(end + 20, comment_length);
+        fwrite(end, 1, 22, archive);
+        fwrite(comment, 1, comment_length, archive);
+    }
+    if (fclose(archive) != 0 && ok) {
+        printf("Cannot write %s, Error!\n", temp_path);
+        ok = 0;
+    }
+    buffer_free(&central);
+
+    // Reemplazar el archivo anterior sólo cuando el nuevo está completo
+    if (ok && rename(temp_path, archive_path) != 0) {
+        printf("Cannot create %s, Error!\n", archive_path);
+        ok = 0;
+    }
+    if (!ok) {
+        unlink(temp_path);
+    }
+    return ok;
+}
+
+int resolve_job_count(LightPathProject* project) {
+    if (requested_jobs > 0) {
+        return requested_jobs;
+    }
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    if (build_block->jobs > 0) {
+        return build_block->jobs;
+    }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+// Manifiesto de compilación (.lightpath/manifest)
+void free_build_manifest(BuildManifest* manifest) {
+    for (size_t i = 0; i < manifest->count; i++) {
+        free(manifest->entries[i].name);
+    }
+    for (size_t i = 0; i < manifest->app_count; i++) {
+        free(manifest->apps[i].path);
+    }
+    free(manifest->entries);
+    free(manifest->apps);
+    memset(manifest, 0, sizeof(BuildManifest));
+}
+
+int load_build_manifest(const char* path, BuildManifest* manifest) {
+    memset(manifest, 0, sizeof(BuildManifest));
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    int version = 0, ok = 1;
+    unsigned int chunk_size = 0;
+    while (ok && (length = getline(&line, &line_capacity, file)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        ManifestEntry entry;
+        ManifestApp app;
+        unsigned int method;
+        int name_offset = 0;
+        char codec_name[16];
+        if (strncmp(line, "lightpath-manifest ", 19) == 0) {
+            version = atoi(line + 19);
+        } else if (sscanf(line, "codec %15s", codec_name) == 1) {
+            for (int c = 0; c <= CODEC_NONE; c++) {
+                if (strcmp(codec_name, codec_names[c]) == 0) {
+                    manifest->codec = c;
+                }
+            }
+        } else if (sscanf(line, "build_path %64s", manifest->build_path_hash) == 1 ||
+                   sscanf(line, "chunk %u", &chunk_size) == 1 ||
+                   sscanf(line, "payload %64s", manifest->payload_hash) == 1 ||
+                   sscanf(line, "runtime %64s", manifest->runtime_hash) == 1) {
+            continue;
+        } else if (sscanf(line, "app %llu %lld%n", &app.size, &app.mtime_ns, &name_offset) == 2 &&
+                   line[name_offset] == ' ') {
+            // Sólo un espacio antes de la ruta: un nombre puede empezar por espacios
+            manifest->apps = checked_realloc(manifest->apps, (manifest->app_count + 1) * sizeof(ManifestApp));
+            app.path = strdup(line + name_offset + 1);
+            manifest->apps[manifest->app_count++] = app;
+        } else if (sscanf(line, "entry %llu %lld %o %64s %u %x %llu %llu%n",
+                          &entry.size, &entry.mtime_ns, &entry.mode, entry.hash, &method,
+                          &entry.crc, &entry.compressed_size, &entry.data_offset, &name_offset) == 8 &&
+                   line[name_offset] == ' ') {
+            entry.name = line + name_offset + 1;
+            entry.method = method;
+            add_manifest_entry(manifest, &entry);
+        } else {
+            ok = 0;
+        }
+    }
+    free(line);
+    fclose(file);
+
+    // Un manifiesto de otra versión de lightpath (u otro tamaño de trozo) no se reutiliza
+    manifest->valid = ok && version == LIGHTPATH_VERSION && chunk_size == PACK_CHUNK_SIZE;
+    if (!manifest->valid) {
+        free_build_manifest(manifest);
+    }
+    return manifest->valid;
+}
+
+int save_build_manifest(const char* path, const BuildManifest* manifest) {
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        return 0;
+    }
+    fprintf(file, "lightpath-manifest %d\n", LIGHTPATH_VERSION);
+    fprintf(file, "build_path %s\n", manifest->build_path_hash);
+    fprintf(file, "payload %s\n", manifest->payload_hash);
+    fprintf(file, "runtime %s\n", manifest->runtime_hash);
+    fprintf(file, "codec %s\n", codec_names[manifest->codec]);
+    fprintf(file, "chunk %u\n", (unsigned int)PACK_CHUNK_SIZE);
+    for (size_t i = 0; i < manifest->app_count; i++) {
+        fprintf(file, "app %llu %lld %s\n", manifest->apps[i].size, manifest->apps[i].mtime_ns, manifest->apps[i].path);
+    }
+    for (size_t i = 0; i < manifest->count; i++) {
+        const ManifestEntry* entry = &manifest->entries[i];
+        fprintf(file, "entry %llu %lld %o %s %u %08x %llu %llu %s\n",
+                entry->size, entry->mtime_ns, entry->mode, entry->hash, entry->method,
+                entry->crc, entry->compressed_size, entry->data_offset, entry->name);
+    }
+    if (fclose(file) != 0 || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Compara el árbol recorrido con la compilación anterior (tamaño, fecha y modo)
+int source_tree_unchanged(const PackList* list, const BuildManifest* manifest) {
+    if (!manifest->valid || manifest->count != list->count) {
+        return 0;
+    }
+    for (size_t i = 0; i < list->count; i++) {
+        const PackEntry* entry = &list->entries[i];
+        const ManifestEntry* record = &manifest->entries[i];
+        if (strcmp(entry->name, record->name) != 0 || record->mode != (unsigned int)entry->mode ||
+            (!entry->is_directory && (record->size != entry->raw_size || record->mtime_ns != entry->mtime_ns))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Copia el resto de un archivo (copy_file_range si el sistema lo permite)
+static int copy_file_contents(int from, int to, uint64_t* offset) {
+    int use_copy_range = 1;
+    for (;;) {
+        ssize_t copied;
+        if (use_copy_range) {
+            copied = copy_file_range(from, NULL, to, NULL, 1 << 30, 0);
+            if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)) {
+                use_copy_range = 0;
+                continue;
+            }
+        } else {
+            char buffer[65536];
+            copied = read(from, buffer, sizeof(buffer));
+            for (ssize_t done = 0; copied > 0 && done < copied;) {
+                ssize_t written = write(to, buffer + done, copied - done);
+                if (written < 0 && errno == EINTR) continue;
+                if (written <= 0) return 0;
+                done += written;
+            }
+        }
+        if (copied < 0 && errno == EINTR) continue;
+        if (copied < 0) return 0;
+        if (copied == 0) return 1;
+        *offset += copied;
+    }
+}
+
+// Runtime de lightpath_app (el mismo ejecutable de lightpath hace de stub)
+
+// Descompresor DEFLATE (RFC 1951)
+#define LP_FAST_BITS 10
+
+typedef struct {
+    uint16_t fast[1 << LP_FAST_BITS];
+    uint16_t count[16];
+    uint16_t symbol[320];
+} lp_huffman;
+
+typedef struct {
+    const unsigned char* in;
+    size_t in_len;
+    size_t pos;
+    uint64_t bitbuf;
+    int bitcnt;
+} lp_bits_state;
+
+static const uint16_t lp_length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t lp_length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t lp_dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t lp_dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+static const uint8_t lp_codelen_order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+static void lp_refill(lp_bits_state* s) {
+    while (s->bitcnt <= 56 && s->pos < s->in_len) {
+        s->bitbuf |= (uint64_t)s->in[s->pos++] << s->bitcnt;
+        s->bitcnt += 8;
+    }
+}
+
+static int lp_bits(lp_bits_state* s, int n, uint32_t* value) {
+    if (s->bitcnt < n) {
+        lp_refill(s);
+        if (s->bitcnt < n) return 0;
+    }
+    *value = (uint32_t)(s->bitbuf & ((1u << n) - 1));
+    s->bitbuf >>= n;
+    s->bitcnt -= n;
+    return 1;
+}
+
+static int lp_build_huffman(lp_huffman* h, const uint8_t* lengths, int n) {
+    uint16_t offsets[16];
+    memset(h->count, 0, sizeof(h->count));
+    for (int i = 0; i < n; i++) {
+        h->count[lengths[i]]++;
+    }
+    h->count[0] = 0;
+    int left = 1;
+    for (int len = 1; len < 16; len++) {
+        left <<= 1;
+        left -= h->count[len];
+        if (left < 0) return 0;
+    }
+    offsets[1] = 0;
+    for (int len = 1; len < 15; len++) {
+        offsets[len + 1] = offsets[len] + h->count[len];
+    }
+    for (int i = 0; i < n; i++) {
+        if (lengths[i]) h->symbol[offsets[lengths[i]]++] = i;
+    }
+
+    // Tabla rápida para códigos de hasta LP_FAST_BITS bits
+    memset(h->fast, 0, sizeof(h->fast));
+    int code = 0, index = 0;
+    for (int len = 1; len <= LP_FAST_BITS; len++) {
+        for (int k = 0; k < h->count[len]; k++) {
+            int reversed = 0;
+            for (int b = 0; b < len; b++) {
+                reversed = (reversed << 1) | ((code >> b) & 1);
+            }
+            for (int fill = reversed; fill < (1 << LP_FAST_BITS); fill += 1 << len) {
+                h->fast[fill] = (uint16_t)((h->symbol[index] << 4) | len);
+            }
+            code++;
+            index++;
+        }
+        code <<= 1;
+    }
+    return 1;
+}
+
+static int lp_decode(lp_bits_state* s, const lp_huffman* h) {
+    if (s->bitcnt < 15) lp_refill(s);
+    uint16_t entry = h->fast[s->bitbuf & ((1 << LP_FAST_BITS) - 1)];
+    if (entry && (entry & 15) <= s->bitcnt) {
+        s->bitbuf >>= entry & 15;
+        s->bitcnt -= entry & 15;
+        return entry >> 4;
+    }
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len < 16 && len <= s->bitcnt; len++) {
+        code |= (s->bitbuf >> (len - 1)) & 1;
+        int count = h->count[len];
+        if (code - count < first) {
+            s->bitbuf >>= len;
+            s->bitcnt -= len;
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+    return -1;
+}
+
+// Descomprime bloques hasta el final del flujo o, si out ya está lleno, hasta
+// el bloque almacenado vacío que cierra cada trozo de un archivo grande
+static int lp_inflate_part(lp_bits_state* bits, lp_huffman* lencode, unsigned char* out, size_t out_len,
+                           uint32_t* final) {
+    lp_bits_state s = *bits;
+    const unsigned char* in = s.in;
+    size_t in_len = s.in_len;
+    lp_huffman* distcode = lencode + 1;
+    size_t o = 0;
+    uint32_t type, value;
+    int ok = 1;
+
+    while (ok && !*final) {
+        if (!lp_bits(&s, 1, final) || !lp_bits(&s, 2, &type)) {
+            ok = 0;
+            break;
+        }
+        if (type == 0) {
+            // Bloque almacenado: devolver los bytes completos del búfer de bits
+            s.bitbuf >>= s.bitcnt & 7;
+            s.bitcnt -= s.bitcnt & 7;
+            s.pos -= s.bitcnt / 8;
+            s.bitbuf = 0;
+            s.bitcnt = 0;
+            if (s.pos + 4 > in_len) { ok = 0; break; }
+            size_t len = in[s.pos] | (in[s.pos + 1] << 8);
+            size_t nlen = in[s.pos + 2] | (in[s.pos + 3] << 8);
+            s.pos += 4;
+            if (len != (~nlen & 0xffff) || s.pos + len > in_len || o + len > out_len) { ok = 0; break; }
+            memcpy(out + o, in + s.pos, len);
+            s.pos += len;
+            o += len;
+            if (len == 0 && o == out_len) break;
+            continue;
+        }
+
+        uint8_t lengths[320];
+        if (type == 1) {
+            for (int i = 0; i < 288; i++) lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            for (int i = 0; i < 30; i++) lengths[288 + i] = 5;
+            ok = lp_build_huffman(lencode, lengths, 288) && lp_build_huffman(distcode, lengths + 288, 30);
+        } else if (type == 2) {
+            uint32_t hlit, hdist, hclen;
+            uint8_t cl_lengths[19] = {0};
+            if (!lp_bits(&s, 5, &hlit) || !lp_bits(&s, 5, &hdist) || !lp_bits(&s, 4, &hclen)) { ok = 0; break; }
+            hlit += 257;
+            hdist += 1;
+            hclen += 4;
+            for (uint32_t i = 0; i < hclen; i++) {
+                if (!lp_bits(&s, 3, &value)) { ok = 0; break; }
+                cl_lengths[lp_codelen_order[i]] = value;
+            }
+            if (!ok || !lp_build_huffman(lencode, cl_lengths, 19)) { ok = 0; break; }
+            uint32_t index = 0;
+            while (ok && index < hlit + hdist) {
+                int symbol = lp_decode(&s, lencode);
+                if (symbol < 0) { ok = 0; break; }
+                if (symbol < 16) {
+                    lengths[index++] = symbol;
+                    continue;
+                }
+                uint8_t repeat_value = 0;
+                uint32_t repeat;
+                if (symbol == 16) {
+                    if (index == 0 || !lp_bits(&s, 2, &repeat)) { ok = 0; break; }
+                    repeat_value = lengths[index - 1];
+                    repeat += 3;
+                } else if (symbol == 17) {
+                    if (!lp_bits(&s, 3, &repeat)) { ok = 0; break; }
+                    repeat += 3;
+                } else {
+                    if (!lp_bits(&s, 7, &repeat)) { ok = 0; break; }
+                    repeat += 11;
+                }
+                if (index + repeat > hlit + hdist) { ok = 0; break; }
+                while (repeat--) lengths[index++] = repeat_value;
+            }
+            ok = ok && lp_build_huffman(lencode, lengths, hlit) &&
+                 lp_build_huffman(distcode, lengths + hlit, hdist);
+        } else {
+            ok = 0;
+        }
+
+        while (ok) {
+            int symbol = lp_decode(&s, lencode);
+            if (symbol < 0) { ok = 0; break; }
+            if (symbol < 256) {
+                if (o >= out_len) { ok = 0; break; }
+                out[o++] = symbol;
+                continue;
+            }
+            if (symbol == 256) break;
+            symbol -= 257;
+            if (symbol >= 29 || !lp_bits(&s, lp_length_extra[symbol], &value)) { ok = 0; break; }
+            size_t len = lp_length_base[symbol] + value;
+            int dist_symbol = lp_decode(&s, distcode);
+            if (dist_symbol < 0 || dist_symbol >= 30 || !lp_bits(&s, lp_dist_extra[dist_symbol], &value)) { ok = 0; break; }
+            size_t dist = lp_dist_base[dist_symbol] + value;
+            if (dist > o || o + len > out_len) { ok = 0; break; }
+            unsigned char* dst = out + o;
+            const unsigned char* src = dst - dist;
+            for (size_t i = 0; i < len; i++) dst[i] = src[i];
+            o += len;
+        }
+    }
+
+    *bits = s;
+    return ok && o == out_len;
+}
+
+static int lp_inflate(const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len) {
+    lp_bits_state s = {in, in_len, 0, 0, 0};
+    lp_huffman* lencode = malloc(sizeof(lp_huffman) * 2);
+    uint32_t final = 0;
+    int ok = lencode && lp_inflate_part(&s, lencode, out, out_len, &final);
+    free(lencode);
+    return ok;
+}
+
+// Códec "fast" (bloque LZ4)
+static int lp_fast_decode(const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len) {
+    size_t i = 0, o = 0;
+    while (i < in_len) {
+        unsigned token = in[i++];
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            unsigned char b;
+            do {
+                if (i >= in_len) return 0;
+                b = in[i++];
+                literals += b;
+            } while (b == 255);
+        }
+        if (literals > in_len - i || literals > out_len - o) return 0;
+        memcpy(out + o, in + i, literals);
+        i += literals;
+        o += literals;
+        if (i == in_len) break;
+        if (in_len - i < 2) return 0;
+        size_t offset = in[i] | (in[i + 1] << 8);
+        i += 2;
+        size_t length = token & 15;
+        if (length == 15) {
+            unsigned char b;
+            do {
+                if (i >= in_len) return 0;
+                b = in[i++];
+                length += b;
+            } while (b == 255);
+        }
+        length += 4;
+        if (offset == 0 || offset > o || length > out_len - o) return 0;
+        if (offset >= length) {
+            memcpy(out + o, out + o - offset, length);
+        } else {
+            for (size_t k = 0; k < length; k++) out[o + k] = out[o + k - offset];
+        }
+        o += length;
+    }
+    return o == out_len;
+}
+
+// Códec "max": LZ77 + codificador de rango (mismo LzrModel que el compresor)
+typedef struct {
+    const unsigned char* in;
+    size_t in_len, pos;
+    uint32_t range, code;
+    int overrun;
+} lp_range_decoder;
+
+static void lp_rc_normalize(lp_range_decoder* rc) {
+    if (rc->range < (1u << 24)) {
+        rc->range <<= 8;
+        if (rc->pos < rc->in_len) rc->code = (rc->code << 8) | rc->in[rc->pos++];
+        else { rc->code <<= 8; rc->overrun = 1; }
+    }
+}
+
+static int lp_rc_bit(lp_range_decoder* rc, LzrProb* prob) {
+    uint32_t bound = (rc->range >> 11) * *prob;
+    int bit;
+    if (rc->code < bound) {
+        rc->range = bound;
+        *prob += (2048 - *prob) >> 5;
+        bit = 0;
+    } else {
+        rc->code -= bound;
+        rc->range -= bound;
+        *prob -= *prob >> 5;
+        bit = 1;
+    }
+    lp_rc_normalize(rc);
+    return bit;
+}
+
+static uint32_t lp_rc_direct(lp_range_decoder* rc, int count) {
+    uint32_t value = 0;
+    while (count-- > 0) {
+        rc->range >>= 1;
+        int bit = rc->code >= rc->range;
+        if (bit) rc->code -= rc->range;
+        value = (value << 1) | bit;
+        lp_rc_normalize(rc);
+    }
+    return value;
+}
+
+static uint32_t lp_rc_tree(lp_range_decoder* rc, LzrProb* probs, int bits) {
+    uint32_t m = 1;
+    for (int i = 0; i < bits; i++) m = (m << 1) | lp_rc_bit(rc, &probs[m]);
+    return m - (1u << bits);
+}
+
+static uint32_t lp_rc_reverse_tree(lp_range_decoder* rc, LzrProb* probs, int bits) {
+    uint32_t m = 1, value = 0;
+    for (int i = 0; i < bits; i++) {
+        int bit = lp_rc_bit(rc, &probs[m]);
+        m = (m << 1) | bit;
+        value |= (uint32_t)bit << i;
+    }
+    return value;
+}
+
+static int lp_lzr_length(lp_range_decoder* rc, LzrLengthModel* model, int pos_state) {
+    if (!lp_rc_bit(rc, &model->choice)) return 2 + lp_rc_tree(rc, model->low[pos_state], 3);
+    if (!lp_rc_bit(rc, &model->choice2)) return 10 + lp_rc_tree(rc, model->mid[pos_state], 3);
+    return 18 + lp_rc_tree(rc, model->high, 8);
+}
+
+static int lp_max_decode(const unsigned char* in, size_t in_len, unsigned char* out, size_t out_len) {
+    LzrModel* model = malloc(sizeof(LzrModel));
+    if (!model) return 0;
+    lzr_init_model(model);
+    lp_range_decoder rc = {in, in_len, 0, 0xffffffffu, 0, 0};
+    for (int i = 0; i < 5; i++) rc.code = (rc.code << 8) | (rc.pos < in_len ? in[rc.pos++] : 0);
+
+    int state = 0, ok = 1;
+    uint32_t rep0 = 0;
+    size_t o = 0;
+    while (ok && o < out_len && !rc.overrun) {
+        int pos_state = o & 3;
+        if (!lp_rc_bit(&rc, &model->is_match[state][pos_state])) {
+            LzrProb* lit = model->literal[o ? out[o - 1] >> 5 : 0];
+            uint32_t symbol = 1;
+            if (state >= 7) {
+                uint32_t match_byte = out[o - rep0 - 1];
+                do {
+                    int match_bit = (match_byte >> 7) & 1;
+                    match_byte <<= 1;
+                    int bit = lp_rc_bit(&rc, &lit[((1 + match_bit) << 8) + symbol]);
+                    symbol = (symbol << 1) | bit;
+                    if (match_bit != bit) break;
+                } while (symbol < 0x100);
+            }
+            while (symbol < 0x100) symbol = (symbol << 1) | lp_rc_bit(&rc, &lit[symbol]);
+            out[o++] = symbol & 0xff;
+            state = state < 4 ? 0 : state < 10 ? state - 3 : state - 6;
+            continue;
+        }
+        int length;
+        if (lp_rc_bit(&rc, &model->is_rep[state])) {
+            length = lp_lzr_length(&rc, &model->rep_length, pos_state);
+            state = state < 7 ? 8 : 11;
+        } else {
+            length = lp_lzr_length(&rc, &model->length, pos_state);
+            int length_state = length - 2 < 3 ? length - 2 : 3;
+            uint32_t slot = lp_rc_tree(&rc, model->dist_slot[length_state], 6);
+            if (slot < 4) {
+                rep0 = slot;
+            } else {
+                int footer_bits = (slot >> 1) - 1;
+                rep0 = (2 | (slot & 1)) << footer_bits;
+                if (slot < 14) {
+                    rep0 += lp_rc_reverse_tree(&rc, model->dist_special + rep0 - slot - 1, footer_bits);
+                } else {
+                    rep0 += lp_rc_direct(&rc, footer_bits - 4) << 4;
+                    rep0 += lp_rc_reverse_tree(&rc, model->align, 4);
+                }
+            }
+            state = state < 7 ? 7 : 10;
+        }
+        if (rep0 >= o || (size_t)length > out_len - o) { ok = 0; break; }
+        for (int k = 0; k < length; k++, o++) out[o] = out[o - rep0 - 1];
+    }
+    free(model);
+    return ok && o == out_len && !rc.overrun;
+}
+
+// Índice del ZIP embebido (se lee directamente de la imagen del binario)
+typedef struct {
+    char path[1024];
+    uint16_t method;
+    uint32_t mode;
+    size_t compressed_size;
+    size_t size;
+    const unsigned char* data;
+    char* link;                // ruta del original si es un duplicado (NULL si no)
+    int sparse;                // los bloques a cero se dejan como huecos
+    size_t local;              // cabecera local: la entrada ocupa [local, data + compressed_size)
+} lp_entry;
+
+typedef struct {
+    lp_entry* entries;
+    size_t count;
+    size_t next;
+    const char* target;
+    int atomic;                // nombre temporal y rename: el archivo aparece ya completo
+    int failed;
+    pthread_mutex_t lock;
+} lp_extract_state;
+
+// LIGHTPATH_TRACE: una línea JSON por fase y por comando (desactivado: fd < 0)
+static int lp_trace_fd = -1;
+static long long lp_trace_origin_us;
+static unsigned long long lp_extracted_bytes;  // última llamada a lp_extract
+static size_t lp_extracted_files;
+
+static long long lp_trace_now(void) {
+    if (lp_trace_fd < 0) return 0;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000 - lp_trace_origin_us;
+}
+
+// LIGHTPATH_TRACE=1 (o "stderr") escribe en stderr; cualquier otro valor es un archivo
+static void lp_trace_open(void) {
+    const char* target = getenv("LIGHTPATH_TRACE");
+    if (!target || !*target || strcmp(target, "0") == 0) return;
+    if (strcmp(target, "1") == 0 || strcmp(target, "stderr") == 0) {
+        lp_trace_fd = fcntl(2, F_DUPFD_CLOEXEC, 3);
+    } else {
+        lp_trace_fd = open(target, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    }
+    lp_trace_origin_us = 0;
+    lp_trace_origin_us = lp_trace_now();
+}
+
+static void lp_trace_string(char* out, size_t size, const char* text) {
+    size_t used = 0;
+    for (; *text && used + 7 < size; text++) {
+        unsigned char c = *text;
+        if (c == '"' || c == '\\') {
+            out[used++] = '\\';
+            out[used++] = c;
+        } else if (c < 0x20) {
+            used += snprintf(out + used, size - used, "\\u%04x", c);
+        } else {
+            out[used++] = c;
+        }
+    }
+    out[used] = '\0';
+}
+
+// Una sola escritura con O_APPEND: el extractor en segundo plano y el
+// vigilante de limpieza comparten el archivo sin mezclar líneas
+static void lp_trace(const char* event, long long start_us, const char* format, ...) {
+    if (lp_trace_fd < 0) return;
+    char line[2048];
+    int used = snprintf(line, sizeof(line), "{\"event\": \"%s\", \"pid\": %d, \"start_us\": %lld, \"wall_us\": %lld",
+                        event, (int)getpid(), start_us, lp_trace_now() - start_us);
+    if (format && used < (int)sizeof(line)) {
+        va_list args;
+        va_start(args, format);
+        used += vsnprintf(line + used, sizeof(line) - used, format, args);
+        va_end(args);
+    }
+    if (used > (int)sizeof(line) - 3) used = sizeof(line) - 3;
+    memcpy(line + used, "}\n", 2);
+    used += 2;
+    if (write(lp_trace_fd, line, used) != used) {
+        // Sin traza no se detiene la aplicación
+    }
+}
+
+static uint32_t lp_le16(const unsigned char* p) { return p[0] | (p[1] << 8); }
+static uint32_t lp_le32(const unsigned char* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint64_t lp_le64(const unsigned char* p) { return lp_le32(p) | (uint64_t)lp_le32(p + 4) << 32; }
+
+// Rechaza rutas absolutas o con componentes ".."
+static int lp_safe_path(const char* path) {
+    if (path[0] == '/' || path[0] == '\0') return 0;
+    for (const char* p = path; *p; ) {
+        const char* slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') return 0;
+        if (!slash) break;
+        p = slash + 1;
+    }
+    return 1;
+}
+
+static void lp_free_index(lp_entry* entries, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(entries[i].link);
+    }
+    free(entries);
+}
+
+static int lp_read_index(const unsigned char* payload, size_t length, lp_entry** entries, size_t* count) {
+    if (length < 22) return 0;
+    size_t end = length - 22;
+    while (lp_le32(payload + end) != 0x06054b50) {
+        if (end == 0 || length - end > 22 + 65535) return 0;
+        end--;
+    }
+    uint64_t total = lp_le16(payload + end + 10);
+    uint64_t offset = lp_le32(payload + end + 16);
+    // ZIP64: el localizador justo antes del final apunta al registro de 64 bits
+    if (end >= 20 && lp_le32(payload + end - 20) == 0x07064b50) {
+        uint64_t record = lp_le64(payload + end - 12);
+        if (record + 56 > length || lp_le32(payload + record) != 0x06064b50) return 0;
+        total = lp_le64(payload + record + 32);
+        offset = lp_le64(payload + record + 48);
+    }
+    if (total > length / 46) return 0;
+    lp_entry* list = calloc(total ? total : 1, sizeof(lp_entry));
+    if (!list) return 0;
+    for (size_t i = 0; i < total; i++) {
+        const unsigned char* cd = payload + offset;
+        if (offset + 46 > length || lp_le32(cd) != 0x02014b50) { lp_free_index(list, total); return 0; }
+        size_t name_length = lp_le16(cd + 28);
+        size_t extra_length = lp_le16(cd + 30);
+        if (name_length >= sizeof(list[i].path) || offset + 46 + name_length + extra_length > length) { lp_free_index(list, total); return 0; }
+        memcpy(list[i].path, cd + 46, name_length);
+        list[i].path[name_length] = '\0';
+        list[i].method = lp_le16(cd + 10);
+        list[i].compressed_size = lp_le32(cd + 20);
+        list[i].size = lp_le32(cd + 24);
+        list[i].mode = lp_le32(cd + 38) >> 16;
+        uint64_t local = lp_le32(cd + 42);
+
+        // Campos extra: ZIP64, ruta del original de un duplicado, archivo disperso
+        size_t extra = offset + 46 + name_length;
+        size_t extra_end = extra + extra_length;
+        while (extra + 4 <= extra_end) {
+            size_t id = lp_le16(payload + extra);
+            size_t field_length = lp_le16(payload + extra + 2);
+            size_t field = extra + 4;
+            size_t field_end = field + field_length;
+            if (field_end > extra_end) break;
+            if (id == ZIP64_EXTRA_ID) {
+                // Sólo están los valores que no cupieron, en este orden
+                if (lp_le32(cd + 24) == 0xffffffffu && field + 8 <= field_end) {
+                    list[i].size = lp_le64(payload + field);
+                    field += 8;
+                }
+                if (lp_le32(cd + 20) == 0xffffffffu && field + 8 <= field_end) {
+                    list[i].compressed_size = lp_le64(payload + field);
+                    field += 8;
+                }
+                if (local == 0xffffffffu && field + 8 <= field_end) {
+                    local = lp_le64(payload + field);
+                }
+            } else if (id == LINK_EXTRA_ID && field_length < sizeof(list[i].path) && !list[i].link) {
+                list[i].link = strndup((const char*)payload + field, field_length);
+                if (!list[i].link || strlen(list[i].link) != field_length || !lp_safe_path(list[i].link)) {
+                    lp_free_index(list, total);
+                    return 0;
+                }
+            } else if (id == SPARSE_EXTRA_ID) {
+                list[i].sparse = 1;
+            }
+            extra += 4 + field_length;
+        }
+
+        if (local + 30 > length) { lp_free_index(list, total); return 0; }
+        uint64_t data = local + 30 + lp_le16(payload + local + 26) + lp_le16(payload + local + 28);
+        if (data > length || list[i].compressed_size > length - data || !lp_safe_path(list[i].path)) { lp_free_index(list, total); return 0; }
+        list[i].data = payload + data;
+        list[i].local = local;
+        offset += 46 + name_length + extra_length + lp_le16(cd + 32);
+    }
+    *entries = list;
+    *count = total;
+    return 1;
+}
+
+static int lp_make_parents(char* path) {
+    for (char* p = path + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            int ok = mkdir(path, 0755) == 0 || errno == EEXIST;
+            *p = '/';
+            if (!ok) return 0;
+        }
+    }
+    return 1;
+}
+
+// Escribe un trozo en su posición; en un archivo disperso los bloques a cero quedan como huecos
+static int lp_write_chunk(int fd, const unsigned char* data, size_t length, uint64_t offset, int sparse) {
+    static const unsigned char zeros[4096] = {0};
+    size_t done = 0;
+    while (done < length) {
+        size_t run = length - done;
+        if (sparse) {
+            size_t block = run < sizeof(zeros) ? run : sizeof(zeros);
+            if (memcmp(data + done, zeros, block) == 0) {
+                done += block;
+                continue;
+            }
+            run = block;
+        }
+        ssize_t n = pwrite(fd, data + done, run, offset + done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        done += n;
+    }
+    return 1;
+}
+
+// Archivo grande: se descomprime trozo a trozo (PACK_CHUNK_SIZE), así la memoria
+// usada no depende del tamaño del archivo
+static int lp_extract_chunks(int fd, const lp_entry* entry) {
+    unsigned char* buffer = malloc(PACK_CHUNK_SIZE);
+    lp_huffman* lencode = malloc(sizeof(lp_huffman) * 2);
+    lp_bits_state bits = {entry->data, entry->compressed_size, 0, 0, 0};
+    uint32_t final = 0;
+    size_t in = 0;
+    uint64_t out = 0;
+    int ok = buffer && lencode;
+    while (ok && out < entry->size) {
+        size_t length = entry->size - out < PACK_CHUNK_SIZE ? entry->size - out : PACK_CHUNK_SIZE;
+        const unsigned char* chunk = buffer;
+        if (entry->method == METHOD_STORED) {
+            ok = out + length <= entry->compressed_size;
+            chunk = entry->data + out;
+        } else if (entry->method == METHOD_DEFLATE) {
+            ok = lp_inflate_part(&bits, lencode, buffer, length, &final);
+        } else if (entry->method == METHOD_FAST || entry->method == METHOD_MAX) {
+            // [longitud][datos]; la longitud del trozo entero indica que va sin comprimir
+            size_t packed = in + 4 <= entry->compressed_size ? lp_le32(entry->data + in) : (size_t)-1;
+            ok = packed <= entry->compressed_size - in - 4;
+            if (ok && packed == length) {
+                chunk = entry->data + in + 4;
+            } else if (ok && entry->method == METHOD_FAST) {
+                ok = lp_fast_decode(entry->data + in + 4, packed, buffer, length);
+            } else if (ok) {
+                ok = lp_max_decode(entry->data + in + 4, packed, buffer, length);
+            }
+            in += 4 + packed;
+        } else {
+            ok = 0;
+        }
+        ok = ok && lp_write_chunk(fd, chunk, length, out, entry->sparse);
+        out += length;
+    }
+    free(buffer);
+    free(lencode);
+    // El tamaño final también crea el hueco del final de un archivo disperso
+    return ok && ftruncate(fd, entry->size) == 0;
+}
+
+// Disperso de hasta PACK_CHUNK_SIZE: el empaquetador lo guarda en un solo bloque
+// (sin trozos), así que se descomprime entero y se escribe dejando los huecos
+static int lp_extract_sparse_block(int fd, const lp_entry* entry) {
+    unsigned char* buffer = NULL;
+    const unsigned char* data = entry->data;
+    int ok;
+    if (entry->method == METHOD_STORED) {
+        ok = entry->compressed_size >= entry->size;
+    } else {
+        buffer = malloc(entry->size ? entry->size : 1);
+        data = buffer;
+        if (!buffer) ok = 0;
+        else if (entry->method == METHOD_DEFLATE) ok = lp_inflate(entry->data, entry->compressed_size, buffer, entry->size);
+        else if (entry->method == METHOD_FAST) ok = lp_fast_decode(entry->data, entry->compressed_size, buffer, entry->size);
+        else if (entry->method == METHOD_MAX) ok = lp_max_decode(entry->data, entry->compressed_size, buffer, entry->size);
+        else ok = 0;
+    }
+    ok = ok && lp_write_chunk(fd, data, entry->size, 0, 1) && ftruncate(fd, entry->size) == 0;
+    free(buffer);
+    return ok;
+}
+
+static int lp_extract_entry(const char* target, const lp_entry* entry, int atomic) {
+    char path[2048], temp[2100];
+    snprintf(path, sizeof(path), "%s/%s", target, entry->path);
+    if (!lp_make_parents(path)) return 0;
+    size_t name_length = strlen(path);
+    if (path[name_length - 1] == '/') {
+        // Los permisos de los directorios se aplican al final (pueden no admitir escritura)
+        return mkdir(path, 0755) == 0 || errno == EEXIST;
+    }
+    // La aplicación ya está en marcha: escribir en un nombre oculto y renombrar
+    const char* base = strrchr(path, '/') + 1;
+    snprintf(temp, sizeof(temp), "%.*s.lightpath-%s", (int)(base - path), path, base);
+
+    int fd = open(atomic ? temp : path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) return 0;
+    int ok = 1;
+    // Misma condición que compress_pack_entry para elegir el formato en trozos
+    if (entry->size > PACK_CHUNK_SIZE) {
+        ok = lp_extract_chunks(fd, entry);
+    } else if (entry->sparse) {
+        ok = lp_extract_sparse_block(fd, entry);
+    } else if (entry->method == METHOD_STORED) {
+        // Almacenado: escribir directamente desde la imagen del binario
+        size_t written = 0;
+        while (ok && written < entry->size) {
+            ssize_t n = write(fd, entry->data + written, entry->size - written);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) ok = 0; else written += n;
+        }
+    } else if (entry->method == METHOD_DEFLATE || entry->method == METHOD_FAST || entry->method == METHOD_MAX) {
+        // Comprimido: descomprimir directo sobre el archivo mapeado
+        if (entry->size > 0) {
+            unsigned char* out = MAP_FAILED;
+            if (ftruncate(fd, entry->size) == 0) {
+                out = mmap(NULL, entry->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (out == MAP_FAILED) {
+                ok = 0;
+            } else {
+                if (entry->method == METHOD_DEFLATE) ok = lp_inflate(entry->data, entry->compressed_size, out, entry->size);
+                else if (entry->method == METHOD_FAST) ok = lp_fast_decode(entry->data, entry->compressed_size, out, entry->size);
+                else ok = lp_max_decode(entry->data, entry->compressed_size, out, entry->size);
+                munmap(out, entry->size);
+            }
+        }
+    } else {
+        ok = 0;
+    }
+    // Permisos exactos de source/, sin pasar por la umask
+    fchmod(fd, (entry->mode & 07777) ? (entry->mode & 07777) : 0644);
+    ok = close(fd) == 0 && ok;
+    if (atomic && (!ok || rename(temp, path) != 0)) {
+        unlink(temp);
+        return 0;
+    }
+    return ok;
+}
+
+// Enlace simbólico de source/: los datos son su destino
+static int lp_symlink_entry(const char* target, const lp_entry* entry) {
+    char path[2048], destination[1024];
+    if (entry->method != METHOD_STORED || entry->compressed_size >= sizeof(destination)) return 0;
+    memcpy(destination, entry->data, entry->compressed_size);
+    destination[entry->compressed_size] = '\0';
+    snprintf(path, sizeof(path), "%s/%s", target, entry->path);
+    if (!lp_make_parents(path)) return 0;
+    unlink(path);
+    return symlink(destination, path) == 0;
+}
+
+// Un duplicado se enlaza al original ya extraído (o se copia si no se puede)
+static int lp_link_entry(const char* target, const lp_entry* entry) {
+    char path[2048], original[2048];
+    snprintf(path, sizeof(path), "%s/%s", target, entry->path);
+    snprintf(original, sizeof(original), "%s/%s", target, entry->link);
+    if (!lp_make_parents(path)) return 0;
+    unlink(path);
+    if (link(original, path) == 0) return 1;
+
+    struct stat st;
+    int from = open(original, O_RDONLY | O_CLOEXEC);
+    if (from < 0 || fstat(from, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (from >= 0) close(from);
+        return 0;
+    }
+    int to = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777);
+    uint64_t copied = 0;
+    int ok = to >= 0 && copy_file_contents(from, to, &copied) && copied == (uint64_t)st.st_size;
+    close(from);
+    return to >= 0 && close(to) == 0 && ok;
+}
+
+static void* lp_extract_worker(void* arg) {
+    lp_extract_state* state = arg;
+    for (;;) {
+        pthread_mutex_lock(&state->lock);
+        size_t index = state->next++;
+        pthread_mutex_unlock(&state->lock);
+        if (index >= state->count) return NULL;
+        if (!lp_extract_entry(state->target, &state->entries[index], state->atomic)) {
+            pthread_mutex_lock(&state->lock);
+            state->failed = 1;
+            pthread_mutex_unlock(&state->lock);
+        }
+    }
+}
+
+static int lp_compare_size(const void* a, const void* b) {
+    const lp_entry* x = a;
+    const lp_entry* y = b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+static void lp_extract_files(lp_extract_state* state) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t workers = cpus > 0 ? (size_t)cpus : 1;
+    if (workers > state->count) workers = state->count;
+    pthread_t threads[256];
+    if (workers > 256) workers = 256;
+    size_t started = 0;
+    for (size_t i = 1; i < workers; i++) {
+        if (pthread_create(&threads[started], NULL, lp_extract_worker, state) == 0) started++;
+    }
+    lp_extract_worker(state);
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static int lp_compare_hot(const void* a, const void* b) {
+    return strcmp((const char*)a, *(const char* const*)b);
+}
+
+static int lp_is_hot(const char* const* hot, size_t hot_count, const char* path) {
+    return hot_count && bsearch(path, hot, hot_count, sizeof(const char*), lp_compare_hot) != NULL;
+}
+
+// Enlaces y permisos de directorios: lo último de una extracción
+static int lp_finish_extract(const char* target, lp_entry* links, size_t link_count, lp_entry* directories,
+                             size_t directory_count) {
+    int ok = 1;
+    for (size_t i = 0; i < link_count; i++) {
+        if (!(links[i].link ? lp_link_entry(target, &links[i]) : lp_symlink_entry(target, &links[i]))) ok = 0;
+    }
+    // Permisos de los directorios, de dentro hacia fuera
+    for (size_t i = directory_count; i-- > 0;) {
+        char path[2048];
+        snprintf(path, sizeof(path), "%s/%s", target, directories[i].path);
+        if ((directories[i].mode & 07777) && chmod(path, directories[i].mode & 07777) != 0) ok = 0;
+    }
+    return ok;
+}
+
+// Con conjunto caliente (hot, ordenado) sólo se extrae eso antes de volver; el
+// resto lo escribe en segundo plano un nieto que mantiene un flock exclusivo sobre
+// target/.lightpath-extracting hasta terminar (*background = 1).
+static int lp_extract(const unsigned char* payload, size_t length, const char* target, const char* const* hot,
+                      size_t hot_count, int* background) {
+    lp_entry* entries;
+    size_t count;
+    *background = 0;
+    if (!lp_read_index(payload, length, &entries, &count)) return 0;
+
+    // Los directorios primero, en orden; luego los archivos grandes antes
+    // y por último los enlaces (los duplicados necesitan a su original)
+    lp_extract_state state = {entries, count, 0, target, 0, 0, PTHREAD_MUTEX_INITIALIZER};
+    lp_entry* links = calloc(count ? count : 1, sizeof(lp_entry));
+    lp_entry* directories = calloc(count ? count : 1, sizeof(lp_entry));
+    size_t files = 0, link_count = 0, directory_count = 0;
+    if (!links || !directories) {
+        free(links);
+        free(directories);
+        lp_free_index(entries, count);
+        return 0;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t len = strlen(entries[i].path);
+        if (entries[i].link || S_ISLNK(entries[i].mode)) {
+            links[link_count++] = entries[i];
+        } else if (len && entries[i].path[len - 1] == '/') {
+            if (!lp_extract_entry(target, &entries[i], 0)) state.failed = 1;
+            directories[directory_count++] = entries[i];
+        } else {
+            entries[files++] = entries[i];
+        }
+    }
+
+    // Calientes delante; los demás se quedan para el segundo plano
+    size_t hot_files = files, hot_links = link_count;
+    if (hot_count) {
+        hot_files = 0;
+        for (size_t i = 0; i < files; i++) {
+            if (lp_is_hot(hot, hot_count, entries[i].path)) {
+                lp_entry swap = entries[hot_files];
+                entries[hot_files++] = entries[i];
+                entries[i] = swap;
+            }
+        }
+        hot_links = 0;
+        for (size_t i = 0; i < link_count; i++) {
+            // Los enlaces simbólicos no tienen datos: siempre delante
+            if (!links[i].link || lp_is_hot(hot, hot_count, links[i].path)) {
+                lp_entry swap = links[hot_links];
+                links[hot_links++] = links[i];
+                links[i] = swap;
+            }
+        }
+    }
+    qsort(entries, hot_files, sizeof(lp_entry), lp_compare_size);
+    state.count = hot_files;
+    lp_extract_files(&state);
+    lp_extracted_bytes = 0;
+    lp_extracted_files = hot_files;
+    for (size_t i = 0; i < hot_files; i++) {
+        lp_extracted_bytes += entries[i].size;
+    }
+
+    int lock_fd = -1;
+    if (hot_files == files && hot_links == link_count) {
+        if (!lp_finish_extract(target, links, link_count, directories, directory_count)) state.failed = 1;
+    } else if (!state.failed) {
+        for (size_t i = 0; i < hot_links; i++) {
+            if (!(links[i].link ? lp_link_entry(target, &links[i]) : lp_symlink_entry(target, &links[i]))) {
+                fprintf(stderr, "lightpath_app could not extract %s, Error!\n", links[i].path);
+                state.failed = 1;
+            }
+        }
+        char lock_path[2048];
+        snprintf(lock_path, sizeof(lock_path), "%s/.lightpath-extracting", target);
+        lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) state.failed = 1;
+    }
+    if (lock_fd >= 0 && !state.failed) {
+        // El lock pertenece a la descripción de archivo: pasa al nieto con el fork
+        pid_t child = fork();
+        if (child == 0) {
+            if (fork() != 0) _exit(0);
+            long long start_us = lp_trace_now();
+            unsigned long long bytes = 0;
+            lp_extract_state rest = {entries + hot_files, files - hot_files, 0, target, 1, 0,
+                                     PTHREAD_MUTEX_INITIALIZER};
+            qsort(rest.entries, rest.count, sizeof(lp_entry), lp_compare_size);
+            lp_extract_files(&rest);
+            int ok = lp_finish_extract(target, links + hot_links, link_count - hot_links, directories,
+                                       directory_count) && !rest.failed;
+            if (!ok) {
+                fprintf(stderr, "lightpath_app could not extract every file of %s, Error!\n", target);
+            }
+            for (size_t i = 0; i < rest.count; i++) {
+                bytes += rest.entries[i].size;
+            }
+            lp_trace("extract_background", start_us, ", \"bytes\": %llu, \"files\": %zu, \"ok\": %d", bytes,
+                     rest.count, ok);
+            _exit(0);
+        }
+        if (child < 0) {
+            state.failed = 1;
+        } else {
+            while (waitpid(child, NULL, 0) < 0 && errno == EINTR) {
+            }
+            *background = 1;
+        }
+    }
+    if (lock_fd >= 0) close(lock_fd);
+    lp_free_index(links, link_count);
+    free(directories);
+    free(entries);
+    return !state.failed;
+}
+
+// Espera a que termine la extracción en segundo plano (si la hay) antes de borrar
+static void lp_wait_extraction(const char* target) {
+    char lock_path[2048];
+    snprintf(lock_path, sizeof(lock_path), "%s/.lightpath-extracting", target);
+    int fd = open(lock_path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        while (flock(fd, LOCK_SH) != 0 && errno == EINTR) {
+        }
+        close(fd);
+    }
+}
+
+static int lp_remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)flag; (void)ftw;
+    remove(path);
+    return 0;
+}
+
+static void lp_remove_tree(const char* path) {
+    nftw(path, lp_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Caché de extracción por contenido (~/.cache/lightpath/<hash>)
+typedef struct {
+    char name[sizeof(((struct dirent*)0)->d_name)];
+    time_t used;
+    unsigned long long bytes;
+} lp_cache_item;
+
+static unsigned long long lp_tree_bytes;
+
+static int lp_count_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)path; (void)flag; (void)ftw;
+    lp_tree_bytes += (unsigned long long)st->st_blocks * 512;
+    return 0;
+}
+
+static int lp_compare_used(const void* a, const void* b) {
+    const lp_cache_item* x = a;
+    const lp_cache_item* y = b;
+    return x->used < y->used ? -1 : x->used > y->used ? 1 : 0;
+}
+
+static int lp_cache_root(char* root, size_t size) {
+    const char* dir = getenv("LIGHTPATH_CACHE_DIR");
+    if (dir && *dir) {
+        snprintf(root, size, "%s", dir);
+    } else if ((dir = getenv("XDG_CACHE_HOME")) && *dir) {
+        snprintf(root, size, "%s/lightpath", dir);
+    } else if ((dir = getenv("HOME")) && *dir) {
+        snprintf(root, size, "%s/.cache/lightpath", dir);
+    } else {
+        return 0;
+    }
+    char path[1100];
+    snprintf(path, sizeof(path), "%s/", root);
+    return lp_make_parents(path);
+}
+
+// Abre una entrada publicada y la marca en uso (bloqueo compartido)
+static int lp_cache_open(const char* entry) {
+    for (int attempt = 0; attempt < 8; attempt++) {
+        int fd = open(entry, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) return -1;
+        struct stat opened, current;
+        if (flock(fd, LOCK_SH) == 0 && fstat(fd, &opened) == 0 && stat(entry, &current) == 0 &&
+            opened.st_ino == current.st_ino && opened.st_dev == current.st_dev) {
+            futimens(fd, NULL);
+            return fd;
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+// Borra las entradas menos usadas hasta quedar bajo el límite
+static void lp_cache_evict(const char* root, const char* keep, unsigned long long limit) {
+    DIR* dir = opendir(root);
+    if (!dir) return;
+    lp_cache_item* items = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long total = 0;
+    time_t now = time(NULL);
+    struct dirent* item;
+    while ((item = readdir(dir)) != NULL) {
+        char path[1200];
+        struct stat st;
+        if (item->d_name[0] == '.' || strlen(item->d_name) >= sizeof(items[0].name)) continue;
+        snprintf(path, sizeof(path), "%s/%s", root, item->d_name);
+        if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        if (strchr(item->d_name, '.')) {
+            // Extracciones abandonadas por procesos que murieron
+            if (strstr(item->d_name, ".tmp.") && now - st.st_mtime > 86400) lp_remove_tree(path);
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            lp_cache_item* grown = realloc(items, capacity * sizeof(lp_cache_item));
+            if (!grown) break;
+            items = grown;
+        }
+        lp_tree_bytes = 0;
+        nftw(path, lp_count_entry, 16, FTW_PHYS);
+        snprintf(items[count].name, sizeof(items[count].name), "%s", item->d_name);
+        items[count].used = st.st_mtime;
+        items[count].bytes = lp_tree_bytes;
+        total += lp_tree_bytes;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(items, count, sizeof(lp_cache_item), lp_compare_used);
+    for (size_t i = 0; i < count && total > limit; i++) {
+        char path[1200], doomed[1300];
+        if (strcmp(items[i].name, keep) == 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", root, items[i].name);
+        int fd = open(path, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) continue;
+        // Una entrada en uso tiene un bloqueo compartido: no se toca
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+            snprintf(doomed, sizeof(doomed), "%s/%s.evict.%d", root, items[i].name, (int)getpid());
+            if (rename(path, doomed) == 0) {
+                lp_remove_tree(doomed);
+                snprintf(doomed, sizeof(doomed), "%s/%s.lock", root, items[i].name);
+                unlink(doomed);
+                total -= items[i].bytes;
+            }
+        }
+        close(fd);
+    }
+    free(items);
+}
+
+// Devuelve un descriptor bloqueado de la entrada lista, o -1 si no hay caché
+static int lp_cache_prepare(const unsigned char* payload, size_t length, const char* hash,
+                            unsigned long long limit, char* app_dir, size_t size) {
+    char root[768];
+    if (!lp_cache_root(root, sizeof(root))) return -1;
+    snprintf(app_dir, size, "%s/%s", root, hash);
+    int fd = lp_cache_open(app_dir);
+    if (fd >= 0) return fd;
+
+    // Un solo proceso extrae; los demás esperan y reutilizan el resultado
+    char lock_path[1100];
+    snprintf(lock_path, sizeof(lock_path), "%s/%s.lock", root, hash);
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd >= 0) flock(lock_fd, LOCK_EX);
+    fd = lp_cache_open(app_dir);
+    if (fd < 0) {
+        char temp[1100];
+        int background;
+        snprintf(temp, sizeof(temp), "%s/%s.tmp.XXXXXX", root, hash);
+        if (mkdtemp(temp)) {
+            if (lp_extract(payload, length, temp, NULL, 0, &background) && rename(temp, app_dir) == 0) {
+                fd = lp_cache_open(app_dir);
+            } else {
+                lp_remove_tree(temp);
+                fd = lp_cache_open(app_dir);
+            }
+            if (fd >= 0 && limit) lp_cache_evict(root, hash, limit);
+        }
+    }
+    if (lock_fd >= 0) close(lock_fd);
+    return fd;
+}
+
+// Lanzador de comandos: posix_spawn sin /bin/sh cuando no hace falta
+extern char** environ;
+
+static int lp_wait_status(pid_t pid) {
+    int status;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return 127;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static int lp_spawn(char* const argv[]) {
+    pid_t pid;
+    int error = posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+    if (error) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(error));
+        return error == ENOENT ? 127 : 126;
+    }
+    return lp_wait_status(pid);
+}
+
+static int lp_spawn_shell(const char* command) {
+    char* argv[] = {"sh", "-c", (char*)command, NULL};
+    pid_t pid;
+    if (posix_spawn(&pid, "/bin/sh", NULL, NULL, argv, environ) != 0) return 127;
+    return lp_wait_status(pid);
+}
+
+static int lp_exec(char* const argv[]) {
+    fflush(stdout);
+    execvp(argv[0], argv);
+    fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+    return errno == ENOENT ? 127 : 126;
+}
+
+static int lp_exec_shell(const char* command) {
+    fflush(stdout);
+    execl("/bin/sh", "sh", "-c", command, (char*)NULL);
+    return 127;
+}
+
+// Borra app_dir cuando el último proceso que hereda el pipe termina.
+// Doble fork: el vigilante no queda como hijo de la aplicación.
+static int lp_cleanup_on_exit(const char* app_dir) {
+    int fds[2];
+    if (pipe(fds) != 0) return 0;
+    pid_t child = fork();
+    if (child < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 0;
+    }
+    if (child == 0) {
+        if (fork() != 0) _exit(0);
+        setsid();
+        close(fds[1]);
+        for (int fd = 3; fd < 1024; fd++) {
+            if (fd != fds[0] && fd != lp_trace_fd) close(fd);
+        }
+        char byte;
+        while (read(fds[0], &byte, 1) != 0) {
+            if (errno != EINTR) break;
+        }
+        long long start_us = lp_trace_now();
+        lp_wait_extraction(app_dir);
+        lp_remove_tree(app_dir);
+        lp_trace("cleanup", start_us, NULL);
+        _exit(0);
+    }
+    close(fds[0]);
+    lp_wait_status(child);
+    return 1;
+}
+
+// LIGHTPATH_RECORD_HOT: inotify (IN_OPEN) sobre cada directorio extraído
+static int lp_record_inotify = -1;
+static char** lp_record_dirs;              // ruta relativa de cada watch descriptor
+static int lp_record_dir_count;
+static size_t lp_record_prefix;            // longitud de "app_dir/"
+
+static int lp_record_watch(const char* path, const struct stat* st, int flag, struct FTW* ftw) {
+    (void)st; (void)ftw;
+    if (flag != FTW_D) return 0;
+    int wd = inotify_add_watch(lp_record_inotify, path, IN_OPEN | IN_ONLYDIR);
+    if (wd < 0) return 0;
+    if (wd >= lp_record_dir_count) {
+        char** grown = realloc(lp_record_dirs, sizeof(char*) * (wd + 64));
+        if (!grown) return 0;
+        memset(grown + lp_record_dir_count, 0, sizeof(char*) * (wd + 64 - lp_record_dir_count));
+        lp_record_dirs = grown;
+        lp_record_dir_count = wd + 64;
+    }
+    free(lp_record_dirs[wd]);
+    lp_record_dirs[wd] = strdup(strlen(path) > lp_record_prefix ? path + lp_record_prefix : "");
+    return 0;
+}
+
+typedef struct {
+    int stop;                  // extremo de lectura: se cierra el otro al acabar los comandos
+    char** names;
+    size_t count;
+    size_t capacity;
+} lp_record_state;
+
+static void lp_record_events(lp_record_state* state) {
+    char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t got;
+    while ((got = read(lp_record_inotify, buffer, sizeof(buffer))) > 0) {
+        for (char* p = buffer; p < buffer + got;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (!event->len || (event->mask & IN_ISDIR) || event->wd < 0 || event->wd >= lp_record_dir_count ||
+                !lp_record_dirs[event->wd]) {
+                continue;
+            }
+            if (state->count == state->capacity) {
+                size_t capacity = state->capacity ? state->capacity * 2 : 256;
+                char** grown = realloc(state->names, sizeof(char*) * capacity);
+                if (!grown) continue;
+                state->names = grown;
+                state->capacity = capacity;
+            }
+            const char* dir = lp_record_dirs[event->wd];
+            size_t length = strlen(dir) + strlen(event->name) + 2;
+            char* name = malloc(length);
+            if (!name) continue;
+            snprintf(name, length, "%s%s%s", dir, *dir ? "/" : "", event->name);
+            state->names[state->count++] = name;
+        }
+    }
+}
+
+static void* lp_record_worker(void* arg) {
+    lp_record_state* state = arg;
+    struct pollfd fds[2] = {{lp_record_inotify, POLLIN, 0}, {state->stop, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        lp_record_events(state);
+        if (fds[1].revents) break;
+    }
+    lp_record_events(state);
+    return NULL;
+}
+
+static int lp_compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Ejecuta todos los comandos sobre una extracción completa y guarda en
+// record_path los archivos de la aplicación que se abrieron (uno por línea)
+static int lp_record_hot(const unsigned char* payload, size_t length, const AppCommand** commands, char*** arguments,
+                         uint32_t count, const char* record_path) {
+    FILE* out = fopen(record_path, "w");
+    if (!out) {
+        fprintf(stderr, "Cannot write %s, Error!\n", record_path);
+        return 1;
+    }
+    char app_dir[1024];
+    int background;
+    strcpy(app_dir, "/tmp/lightpath_XXXXXX");
+    if (!mkdtemp(app_dir)) {
+        fclose(out);
+        return 1;
+    }
+    if (!lp_extract(payload, length, app_dir, NULL, 0, &background)) {
+        lp_remove_tree(app_dir);
+        fclose(out);
+        return 1;
+    }
+
+    int stop[2] = {-1, -1};
+    lp_record_state state = {-1, NULL, 0, 0};
+    pthread_t thread;
+    lp_record_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    lp_record_prefix = strlen(app_dir) + 1;
+    int recording = lp_record_inotify >= 0 && pipe2(stop, O_CLOEXEC) == 0 &&
+                    nftw(app_dir, lp_record_watch, 32, FTW_PHYS) == 0;
+    state.stop = stop[0];
+    recording = recording && pthread_create(&thread, NULL, lp_record_worker, &state) == 0;
+    if (!recording) {
+        fprintf(stderr, "Cannot watch %s, Error!\n", app_dir);
+    }
+
+    // Todos los comandos como procesos hijos, también el último
+    char old_cwd[1024];
+    int status = 0, in_app_dir = 0;
+    if (!getcwd(old_cwd, sizeof(old_cwd))) {
+        strcpy(old_cwd, "/");
+    }
+    for (uint32_t i = 0; recording && i < count; i++) {
+        const AppCommand* command = commands[i];
+        if ((int)command->in_app_dir != in_app_dir && chdir(command->in_app_dir ? app_dir : old_cwd) != 0) {
+            status = 1;
+            break;
+        }
+        in_app_dir = command->in_app_dir;
+        status = command->use_shell ? lp_spawn_shell(arguments[i][0]) : lp_spawn(arguments[i]);
+        if (status != 0) {
+            break;
+        }
+    }
+    if (chdir(old_cwd) != 0) {
+        // El directorio original ya no existe; no importa para limpiar
+    }
+
+    size_t written = 0;
+    if (recording) {
+        close(stop[1]);
+        stop[1] = -1;
+        pthread_join(thread, NULL);
+        qsort(state.names, state.count, sizeof(char*), lp_compare_strings);
+        fprintf(out, "# Files opened by the application, recorded with LIGHTPATH_RECORD_HOT\n");
+        for (size_t i = 0; i < state.count; i++) {
+            if (i == 0 || strcmp(state.names[i], state.names[i - 1]) != 0) {
+                fprintf(out, "%s\n", state.names[i]);
+                written++;
+            }
+        }
+    }
+    if (fclose(out) != 0) {
+        fprintf(stderr, "Cannot write %s, Error!\n", record_path);
+        status = status ? status : 1;
+    } else if (recording) {
+        fprintf(stderr, "Recorded %zu hot files in %s\n", written, record_path);
+    }
+
+    for (size_t i = 0; i < state.count; i++) free(state.names[i]);
+    free(state.names);
+    for (int i = 0; i < lp_record_dir_count; i++) free(lp_record_dirs[i]);
+    free(lp_record_dirs);
+    if (stop[0] >= 0) close(stop[0]);
+    if (stop[1] >= 0) close(stop[1]);
+    if (lp_record_inotify >= 0) close(lp_record_inotify);
+    lp_remove_tree(app_dir);
+    return status;
+}
+
+// Modo aplicación: si este ejecutable lleva un pie de lightpath_app, extrae el
+// payload y ejecuta la tabla de comandos. Devuelve -1 si no es una aplicación.
+int run_embedded_app(void) {
+    int fd = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    lp_trace_open();
+    struct stat st;
+    AppFooter footer;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(footer) ||
+        pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) != (ssize_t)sizeof(footer) ||
+        memcmp(footer.magic, APP_MAGIC, sizeof(footer.magic)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    size_t image_size = st.st_size;
+    unsigned char* image = mmap(NULL, image_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    size_t limit = image_size - sizeof(footer);
+    if (image == MAP_FAILED || footer.payload_offset > limit || footer.payload_size > limit - footer.payload_offset ||
+        footer.table_offset > limit || footer.table_size > limit - footer.table_offset ||
+        footer.table_size < sizeof(AppTableHeader) || footer.table_offset % 8 != 0) {
+        fprintf(stderr, "lightpath_app is damaged, Error!\n");
+        return 1;
+    }
+    const unsigned char* payload = image + footer.payload_offset;
+    const unsigned char* table = image + footer.table_offset;
+    const AppTableHeader* header = (const AppTableHeader*)table;
+
+    // Validar toda la tabla antes de extraer nada
+    uint32_t count = header->command_count;
+    const AppCommand** commands = calloc(count ? count : 1, sizeof(AppCommand*));
+    char*** arguments = calloc(count ? count : 1, sizeof(char**));
+    size_t offset = sizeof(AppTableHeader);
+    int valid = commands && arguments;
+    for (uint32_t i = 0; valid && i < count; i++) {
+        const AppCommand* command = (const AppCommand*)(table + offset);
+        valid = offset + sizeof(AppCommand) <= footer.table_size && command->argc > 0 &&
+                command->length <= footer.table_size - offset - sizeof(AppCommand);
+        if (!valid) break;
+        const char* strings = (const char*)(command + 1);
+        char** argv = calloc(command->argc + 1, sizeof(char*));
+        size_t position = 0;
+        for (uint32_t a = 0; argv && a < command->argc; a++) {
+            const char* end = position < command->length ? memchr(strings + position, '\0', command->length - position) : NULL;
+            if (!end) {
+                free(argv);
+                argv = NULL;
+                break;
+            }
+            argv[a] = (char*)strings + position;
+            position = end - strings + 1;
+        }
+        valid = argv != NULL;
+        commands[i] = command;
+        arguments[i] = argv;
+        offset += sizeof(AppCommand) + command->length;
+    }
+    // Conjunto caliente: hot_count rutas terminadas en NUL, ya ordenadas
+    const char** hot = calloc(header->hot_count + 1, sizeof(char*));
+    valid = valid && hot && header->hot_size <= footer.table_size - offset;
+    for (uint32_t i = 0, position = 0; valid && i < header->hot_count; i++) {
+        const char* name = (const char*)table + offset + position;
+        const char* end = position < header->hot_size ? memchr(name, '\0', header->hot_size - position) : NULL;
+        valid = end != NULL && (i == 0 || strcmp(hot[i - 1], name) < 0);
+        hot[i] = name;
+        position += end ? end - name + 1 : 0;
+    }
+    if (!valid) {
+        fprintf(stderr, "lightpath_app is damaged, Error!\n");
+        return 1;
+    }
+
+    lp_trace("open", 0, ", \"image_bytes\": %zu, \"payload_bytes\": %llu, \"codec\": %u, \"commands\": %u, "
+             "\"hot_files\": %u, \"cache\": %u", image_size, (unsigned long long)footer.payload_size, header->codec,
+             count, header->hot_count, header->cache);
+
+    const char* record_path = getenv("LIGHTPATH_RECORD_HOT");
+    if (record_path && *record_path) {
+        return lp_record_hot(payload, footer.payload_size, commands, arguments, count, record_path);
+    }
+
+    char app_dir[1024];
+    int cached = 0, background = 0;
+    if (header->cache) {
+        // Reutilizar la extracción previa del mismo payload
+        long long start_us = lp_trace_now();
+        lp_extracted_files = 0;
+        cached = lp_cache_prepare(payload, footer.payload_size, header->payload_hash, header->cache_limit,
+                                  app_dir, sizeof(app_dir)) >= 0;
+        lp_trace("cache", start_us, ", \"hit\": %d, \"bytes\": %llu, \"files\": %zu", cached && !lp_extracted_files,
+                 lp_extracted_files ? lp_extracted_bytes : 0, lp_extracted_files);
+    }
+    if (!cached) {
+        // Extraer en paralelo directamente desde la imagen del binario
+        long long start_us = lp_trace_now();
+        strcpy(app_dir, "/tmp/lightpath_XXXXXX");
+        if (!mkdtemp(app_dir)) {
+            return 1;
+        }
+        lp_trace("mkdtemp", start_us, NULL);
+        start_us = lp_trace_now();
+        int extracted = lp_extract(payload, footer.payload_size, app_dir, hot, header->hot_count, &background);
+        lp_trace("extract", start_us, ", \"bytes\": %llu, \"files\": %zu, \"background\": %d, \"ok\": %d",
+                 lp_extracted_bytes, lp_extracted_files, background, extracted);
+        if (!extracted) {
+            fprintf(stderr, "lightpath_app could not extract the application, Error!\n");
+            lp_wait_extraction(app_dir);
+            lp_remove_tree(app_dir);
+            return 1;
+        }
+        if (background) {
+            // La aplicación puede esperar al resto con flock -s "$LIGHTPATH_EXTRACTING" true
+            char lock_path[1100];
+            snprintf(lock_path, sizeof(lock_path), "%s/.lightpath-extracting", app_dir);
+            setenv("LIGHTPATH_EXTRACTING", lock_path, 1);
+        }
+    }
+
+    // Ejecutar comandos principales; chdir sólo cuando cambia el directorio
+    char old_cwd[1024];
+    int status = 0, in_app_dir = 0;
+    if (!getcwd(old_cwd, sizeof(old_cwd))) {
+        strcpy(old_cwd, "/");
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const AppCommand* command = commands[i];
+        long long start_us = lp_trace_now();
+        if ((int)command->in_app_dir != in_app_dir && chdir(command->in_app_dir ? app_dir : old_cwd) != 0) {
+            status = 1;
+            break;
+        }
+        in_app_dir = command->in_app_dir;
+        char name[256];
+        if (lp_trace_fd >= 0) {
+            lp_trace_string(name, sizeof(name), arguments[i][0]);
+        }
+
+        // El último comando reemplaza al runtime (señales y código de salida directos)
+        if (i == count - 1 && (cached || lp_cleanup_on_exit(app_dir))) {
+            lp_trace("exec", start_us, ", \"index\": %u, \"command\": \"%s\", \"shell\": %u", i, name,
+                     command->use_shell);
+            return command->use_shell ? lp_exec_shell(arguments[i][0]) : lp_exec(arguments[i]);
+        }
+        status = command->use_shell ? lp_spawn_shell(arguments[i][0]) : lp_spawn(arguments[i]);
+        lp_trace("command", start_us, ", \"index\": %u, \"command\": \"%s\", \"shell\": %u, \"exit_code\": %d",
+                 i, name, command->use_shell, status);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    // Limpiar directorio temporal (la caché se conserva)
+    if (chdir(old_cwd) != 0) {
+        // El directorio original ya no existe; no importa para limpiar
+    }
+    if (!cached) {
+        long long start_us = lp_trace_now();
+        lp_wait_extraction(app_dir);
+        lp_remove_tree(app_dir);
+        lp_trace("cleanup", start_us, NULL);
+    }
+    lp_trace("exit", 0, ", \"exit_code\": %d", status);
+    return status;
+}
+
+// Divide un comando en argv si no usa ninguna característica del shell.
+// Devuelve el número de palabras, o -1 si hace falta /bin/sh.
+int split_command_words(const char* command, char*** words_out) {
+    static const char* const shell_words[] = {
+        "if", "then", "else", "elif", "fi", "case", "esac", "for", "while", "until", "do", "done",
+        "function", "select", "time", "{", "}", "!", "[[", "cd", "export", "unset", "set", "source",
+        ".", "exit", "exec", "eval", "alias", "ulimit", "umask", "read", "trap", "wait", "shift",
+        "readonly", "local", "return", "break", "continue", "hash", "type", "command", "builtin",
+        "jobs", "fg", "bg", "times", "getopts", "let", "declare", "typeset", NULL
+    };
+
+    if (strpbrk(command, "|&;<>()$`\\\"'*?[\n")) {
+        return -1;
+    }
+
+    char** words = NULL;
+    int count = 0, needs_shell = 0;
+    const char* p = command;
+    for (;;) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+        const char* start = p;
+        while (*p && *p != ' ' && *p != '\t') p++;
+        if (*start == '~' || *start == '#' || (count == 0 && memchr(start, '=', p - start))) {
+            needs_shell = 1;
+            break;
+        }
+        words = checked_realloc(words, sizeof(char*) * (count + 2));
+        words[count++] = strndup(start, p - start);
+    }
+
+    for (int i = 0; count > 0 && shell_words[i]; i++) {
+        if (strcmp(words[0], shell_words[i]) == 0) {
+            needs_shell = 1;
+        }
+    }
+    if (needs_shell || count == 0) {
+        for (int i = 0; i < count; i++) {
+            free(words[i]);
+        }
+        free(words);
+        *words_out = NULL;
+        return -1;
+    }
+    words[count] = NULL;
+    *words_out = words;
+    return count;
+}
+
+// Tabla de comandos del main que lightpath_app ejecuta al arrancar
+void write_command_table(LightPathProject* project, const FunctionBlock* main_block, int codec,
+                         const char* payload_hash, const ByteBuffer* hot_names, uint32_t hot_count, ByteBuffer* table) {
+    AppTableHeader header;
+    memset(&header, 0, sizeof(header));
+    header.command_count = main_block->command_count;
+    header.cache = main_block->cache;
+    header.cache_limit = main_block->cache_limit;
+    header.codec = codec;
+    header.hot_count = hot_count;
+    header.hot_size = hot_names->size;
+    snprintf(header.payload_hash, sizeof(header.payload_hash), "%s", payload_hash);
+    buffer_append(table, &header, sizeof(header));
+
+    for (int i = 0; i < main_block->command_count; i++) {
+        Command* cmd = block_command(project, main_block, i);
+        const char* text = project_string(project, cmd->command);
+
+        // argv ya separado, o la línea completa para /bin/sh
+        ByteBuffer strings = {0};
+        char** words;
+        int count = split_command_words(text, &words);
+        if (count < 0) {
+            buffer_append(&strings, text, strlen(text) + 1);
+        }
+        for (int w = 0; w < count; w++) {
+            buffer_append(&strings, words[w], strlen(words[w]) + 1);
+            free(words[w]);
+        }
+        if (count >= 0) {
+            free(words);
+        }
+        static const char padding[4] = {0};
+        buffer_append(&strings, padding, (4 - strings.size % 4) % 4);
+
+        AppCommand entry;
+        entry.in_app_dir = strcmp(project_string(project, cmd->path_mode_at_time), "application") == 0;
+        entry.use_shell = count < 0;
+        entry.argc = count < 0 ? 1 : count;
+        entry.length = strings.size;
+        buffer_append(table, &entry, sizeof(entry));
+        buffer_append(table, strings.data, strings.size);
+        buffer_free(&strings);
+    }
+    buffer_append(table, hot_names->data, hot_names->size);
+}
+
+static int write_padding(int fd, uint64_t* offset, uint64_t alignment) {
+    static const char zeros[4096] = {0};
+    size_t length = (alignment - *offset % alignment) % alignment;
+    if (length && write(fd, zeros, length) != (ssize_t)length) {
+        return 0;
+    }
+    *offset += length;
+    return 1;
+}
+
+// lightpath_app = este mismo ejecutable + payload + tabla de comandos + pie
+int write_app_binary(const char* payload_path, const ByteBuffer* table, const char* app_path) {
+    char temp_path[MAX_PATH_LENGTH];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", app_path);
+    int stub = open("/proc/self/exe", O_RDONLY | O_CLOEXEC);
+    int payload = open(payload_path, O_RDONLY | O_CLOEXEC);
+    int out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    AppFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    uint64_t offset = 0;
+
+    // El payload empieza en una página nueva y la tabla alineada a 8 bytes
+    int ok = stub >= 0 && payload >= 0 && out >= 0 && copy_file_contents(stub, out, &offset) &&
+             write_padding(out, &offset, 4096);
+    footer.payload_offset = offset;
+    ok = ok && copy_file_contents(payload, out, &offset);
+    footer.payload_size = offset - footer.payload_offset;
+    ok = ok && write_padding(out, &offset, 8);
+    footer.table_offset = offset;
+    footer.table_size = table->size;
+    memcpy(footer.magic, APP_MAGIC, sizeof(footer.magic));
+    ok = ok && write(out, table->data, table->size) == (ssize_t)table->size &&
+         write(out, &footer, sizeof(footer)) == (ssize_t)sizeof(footer) && fchmod(out, 0755) == 0;
+
+    if (stub >= 0) close(stub);
+    if (payload >= 0) close(payload);
+    if ((out >= 0 && close(out) != 0) || !ok || rename(temp_path, app_path) != 0) {
+        printf("Cannot create %s, Error!\n", app_path);
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static int app_is_current(const BuildManifest* manifest, const char* app_path) {
+    struct stat app_stat;
+    if (stat(app_path, &app_stat) != 0) {
+        return 0;
+    }
+    long long mtime_ns = (long long)app_stat.st_mtim.tv_sec * 1000000000LL + app_stat.st_mtim.tv_nsec;
+    for (size_t i = 0; i < manifest->app_count; i++) {
+        if (strcmp(manifest->apps[i].path, app_path) == 0) {
+            return (unsigned long long)app_stat.st_size == manifest->apps[i].size &&
+                   mtime_ns == manifest->apps[i].mtime_ns;
+        }
+    }
+    return 0;
+}
+
+// Perfil de la compilación (--profile): fases internas y comandos del usuario
+static long long monotonic_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+static long long rusage_cpu_us(const struct rusage* usage) {
+    return (long long)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000LL +
+           usage->ru_utime.tv_usec + usage->ru_stime.tv_usec;
+}
+
+ProfileMark profile_begin(void) {
+    ProfileMark mark = {0, 0};
+    if (profile_path) {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        mark.start_us = monotonic_us();
+        mark.cpu_us = rusage_cpu_us(&usage);
+    }
+    return mark;
+}
+
+static ProfileEvent* add_profile_event(const char* name, const char* category) {
+    if (profile_count == profile_capacity) {
+        profile_capacity = profile_capacity ? profile_capacity * 2 : 64;
+        profile_events = checked_realloc(profile_events, profile_capacity * sizeof(ProfileEvent));
+    }
+    ProfileEvent* event = &profile_events[profile_count++];
+    memset(event, 0, sizeof(ProfileEvent));
+    event->name = strdup(name);
+    event->category = category;
+    event->exit_code = -1;
+    return event;
+}
+
+// Fase interna: CPU de todos los hilos de lightpath y pico de RSS hasta ese momento
+void profile_end(ProfileMark mark, const char* name) {
+    if (!profile_path) {
+        return;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    ProfileEvent* event = add_profile_event(name, "phase");
+    event->start_us = mark.start_us - profile_origin_us;
+    event->wall_us = monotonic_us() - mark.start_us;
+    event->cpu_us = rusage_cpu_us(&usage) - mark.cpu_us;
+    event->max_rss_kb = usage.ru_maxrss;
+}
+
+// Comando del usuario: CPU y pico de RSS del proceso hijo (wait4)
+void profile_command(const JobNode* node, const struct rusage* usage, int exit_code) {
+    if (!profile_path) {
+        return;
+    }
+    ProfileEvent* event = add_profile_event(node->command, "command");
+    event->function_name = strdup(node->function_name);  // el modelo puede recargarse (watch)
+    event->step = node->index;
+    event->lane = node->lane;
+    event->start_us = node->start_us - profile_origin_us;
+    event->wall_us = monotonic_us() - node->start_us;
+    event->cpu_us = rusage_cpu_us(usage);
+    event->max_rss_kb = usage->ru_maxrss;
+    event->exit_code = exit_code;
+}
+
+// Por inicio; la fase que contiene a otra va antes
+static int compare_profile_events(const void* a, const void* b) {
+    const ProfileEvent* x = a;
+    const ProfileEvent* y = b;
+    if (x->start_us != y->start_us) {
+        return x->start_us < y->start_us ? -1 : 1;
+    }
+    return x->wall_us > y->wall_us ? -1 : x->wall_us < y->wall_us;
+}
+
+static void write_json_string(FILE* file, const char* text) {
+    fputc('"', file);
+    for (const unsigned char* p = (const unsigned char*)text; *p; p++) {
+        if (*p == '"' || *p == '\\') {
+            fprintf(file, "\\%c", *p);
+        } else if (*p == '\n') {
+            fputs("\\n", file);
+        } else if (*p == '\t') {
+            fputs("\\t", file);
+        } else if (*p < 0x20) {
+            fprintf(file, "\\u%04x", *p);
+        } else {
+            fputc(*p, file);
+        }
+    }
+    fputc('"', file);
+}
+
+// Un solo archivo JSON: "phases" para comparar compilaciones y "traceEvents"
+// en el formato de Chrome (chrome://tracing, Perfetto)
+int write_profile(const char* run_name, int status) {
+    if (!profile_path) {
+        return 1;
+    }
+    qsort(profile_events, profile_count, sizeof(ProfileEvent), compare_profile_events);
+    FILE* file = fopen(profile_path, "w");
+    if (!file) {
+        printf("Cannot create %s, Error!\n", profile_path);
+        return 0;
+    }
+    fprintf(file, "{\n  \"lightpath_version\": %d,\n  \"run\": ", LIGHTPATH_VERSION);
+    write_json_string(file, run_name);
+    fprintf(file, ",\n  \"status\": %d,\n  \"phases\": [", status);
+    for (size_t i = 0; i < profile_count; i++) {
+        const ProfileEvent* event = &profile_events[i];
+        fprintf(file, "%s\n    {\"name\": ", i ? "," : "");
+        write_json_string(file, event->name);
+        fprintf(file, ", \"category\": \"%s\"", event->category);
+        if (event->function_name) {
+            fputs(", \"function\": ", file);
+            write_json_string(file, event->function_name);
+            fprintf(file, ", \"step\": %d, \"exit_code\": %d", event->step, event->exit_code);
+        }
+        fprintf(file, ", \"start_us\": %lld, \"wall_us\": %lld, \"cpu_us\": %lld, \"max_rss_kb\": %ld}",
+                event->start_us, event->wall_us, event->cpu_us, event->max_rss_kb);
+    }
+    fputs("\n  ],\n  \"displayTimeUnit\": \"ms\",\n  \"traceEvents\": [\n", file);
+    fputs("    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"lightpath\"}}", file);
+    int lanes = 0;
+    for (size_t i = 0; i < profile_count; i++) {
+        if (profile_events[i].lane > lanes) {
+            lanes = profile_events[i].lane;
+        }
+    }
+    for (int lane = 1; lane <= lanes; lane++) {
+        fprintf(file, ",\n    {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+                      "\"args\": {\"name\": \"job %d\"}}", lane, lane);
+    }
+    for (size_t i = 0; i < profile_count; i++) {
+        const ProfileEvent* event = &profile_events[i];
+        fputs(",\n    {\"name\": ", file);
+        write_json_string(file, event->name);
+        fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"dur\": %lld, "
+                      "\"args\": {\"cpu_us\": %lld, \"max_rss_kb\": %ld",
+                event->category, event->lane, event->start_us, event->wall_us, event->cpu_us, event->max_rss_kb);
+        if (event->function_name) {
+            fputs(", \"function\": ", file);
+            write_json_string(file, event->function_name);
+            fprintf(file, ", \"exit_code\": %d", event->exit_code);
+        }
+        fputs("}}", file);
+    }
+    fputs("\n  ]\n}\n", file);
+    if (fclose(file) != 0) {
+        printf("Cannot write %s, Error!\n", profile_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Memorización de funciones: inputs = "..." y outputs = "..." en un bloque
+// personalizado. La clave es el hash de los comandos (con su build_version y
+// path_mode) y del contenido de los inputs; si coincide con la de la última
+// ejecución correcta y los outputs siguen intactos, la función no se ejecuta.
+
+// Patrón con "*", "?", "[...]" por componente y "**" para cualquier número de directorios
+static int match_path_pattern(const char* pattern, const char* path) {
+    if (pattern[0] == '*' && pattern[1] == '*' && (pattern[2] == '/' || pattern[2] == '\0')) {
+        const char* rest = pattern[2] ? pattern + 3 : pattern + 2;
+        if (!*rest) {
+            return 1;
+        }
+        for (const char* p = path; p; p = strchr(p, '/') ? strchr(p, '/') + 1 : NULL) {
+            if (match_path_pattern(rest, p)) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    const char* pattern_end = strchr(pattern, '/');
+    const char* path_end = strchr(path, '/');
+    if (!pattern_end != !path_end) {
+        return 0;
+    }
+    char pattern_part[MAX_PATH_LENGTH], path_part[MAX_PATH_LENGTH];
+    snprintf(pattern_part, sizeof(pattern_part), "%.*s",
+             (int)(pattern_end ? (size_t)(pattern_end - pattern) : strlen(pattern)), pattern);
+    snprintf(path_part, sizeof(path_part), "%.*s", (int)(path_end ? (size_t)(path_end - path) : strlen(path)), path);
+    if (fnmatch(pattern_part, path_part, 0) != 0) {
+        return 0;
+    }
+    return !pattern_end || match_path_pattern(pattern_end + 1, path_end + 1);
+}
+
+static void add_memo_file(MemoFileList* list, const char* path, const struct stat* st) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 64;
+        list->files = checked_realloc(list->files, list->capacity * sizeof(MemoFile));
+    }
+    MemoFile* file = &list->files[list->count++];
+    file->path = strdup(path);
+    file->size = st ? (unsigned long long)st->st_size : 0;
+    file->mtime_ns = st ? stat_mtime_ns(st) : 0;
+    file->hash[0] = '\0';
+}
+
+static void free_memo_files(MemoFileList* list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->files[i].path);
+    }
+    free(list->files);
+    memset(list, 0, sizeof(MemoFileList));
+}
+
+static int compare_memo_files(const void* a, const void* b) {
+    return strcmp(((const MemoFile*)a)->path, ((const MemoFile*)b)->path);
+}
+
+// Recorre dir añadiendo los archivos cuya ruta relativa cumple pattern
+// (depth: directorios que aún se pueden bajar, -1 = sin límite por "**")
+static void expand_pattern_directory(const char* dir, const char* relative, const char* pattern, int depth,
+                                     MemoFileList* list) {
+    DIR* handle = opendir(dir[0] ? dir : ".");
+    if (!handle) {
+        return;
+    }
+    struct dirent* item;
+    while ((item = readdir(handle)) != NULL) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0 ||
+            (!dir[0] && strcmp(item->d_name, STATE_DIR) == 0)) {
+            continue;
+        }
+        char path[MAX_PATH_LENGTH], name[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] ? "/" : "", item->d_name);
+        snprintf(name, sizeof(name), "%s%s%s", relative, relative[0] ? "/" : "", item->d_name);
+        struct stat st;
+        if (lstat(path, &st) != 0) {
+            continue;
+        }
+        // Los enlaces a directorios no se recorren (podrían formar ciclos)
+        if (S_ISDIR(st.st_mode)) {
+            if (depth != 0) {
+                expand_pattern_directory(path, name, pattern, depth < 0 ? depth : depth - 1, list);
+            }
+        } else if (stat(path, &st) == 0 && S_ISREG(st.st_mode) && match_path_pattern(pattern, name)) {
+            add_memo_file(list, path, &st);
+        }
+    }
+    closedir(handle);
+}
+
+// Añade los archivos de un patrón; un directorio sin comodines cuenta con todo su contenido
+static void expand_pattern(const char* pattern, MemoFileList* list) {
+    // Los componentes sin comodines forman el directorio desde el que se recorre
+    char base[MAX_PATH_LENGTH];
+    size_t base_length = 0;
+    for (const char* part = pattern; *part;) {
+        const char* end = strchr(part, '/');
+        size_t length = end ? (size_t)(end - part) : strlen(part);
+        if (memchr(part, '*', length) || memchr(part, '?', length) || memchr(part, '[', length)) {
+            break;
+        }
+        base_length = (part - pattern) + length;
+        part += length + (end ? 1 : 0);
+    }
+    snprintf(base, sizeof(base), "%.*s", (int)base_length, pattern);
+
+    if (pattern[base_length] == '\0') {
+        struct stat st;
+        if (stat(base, &st) != 0) {
+            return;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            expand_pattern_directory(base, "", "**", -1, list);
+        } else if (S_ISREG(st.st_mode)) {
+            add_memo_file(list, base, &st);
+        }
+        return;
+    }
+
+    const char* rest = pattern + base_length + (base_length > 0 && pattern[base_length] == '/' ? 1 : 0);
+    int depth = 0;
+    for (const char* p = rest; *p; p++) {
+        if (*p == '/') {
+            depth++;
+        }
+    }
+    if (strstr(rest, "**")) {
+        depth = -1;
+    }
+    expand_pattern_directory(base, "", rest, depth, list);
+}
+
+static void sort_memo_files(MemoFileList* list) {
+    if (list->count == 0) {
+        return;
+    }
+    qsort(list->files, list->count, sizeof(MemoFile), compare_memo_files);
+    // Un archivo que cumple varios patrones cuenta una vez
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (kept > 0 && strcmp(list->files[kept - 1].path, list->files[i].path) == 0) {
+            free(list->files[i].path);
+        } else {
+            list->files[kept++] = list->files[i];
+        }
+    }
+    list->count = kept;
+}
+
+// Hash de cada archivo; se reutiliza el del registro anterior si no cambió su tamaño ni su fecha
+static int hash_memo_files(MemoFileList* list, const MemoFileList* previous) {
+    for (size_t i = 0; i < list->count; i++) {
+        MemoFile* file = &list->files[i];
+        const MemoFile* known = previous->count ? bsearch(file, previous->files, previous->count, sizeof(MemoFile),
+                                                          compare_memo_files) : NULL;
+        if (known && known->size == file->size && known->mtime_ns == file->mtime_ns && known->hash[0]) {
+            memcpy(file->hash, known->hash, sizeof(file->hash));
+        } else if (!sha256_file(file->path, file->hash)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void memo_record_path(const MemoCheck* memo, char* path, size_t size) {
+    snprintf(path, size, "%s/%s", MEMO_DIR, project_string(memo->project, memo->block->name));
+}
+
+// Registro: lightpath-memo, key, y una línea input/output por archivo (ordenadas por ruta)
+static int load_memo_record(const char* path, char key[65], MemoFileList* inputs, MemoFileList* outputs) {
+    key[0] = '\0';
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        return 0;
+    }
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    int version = 0, ok = 1;
+    while (ok && (length = getline(&line, &line_capacity, file)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[--length] = '\0';
+        }
+        MemoFile entry;
+        char kind[8];
+        int name_offset = 0;
+        if (strncmp(line, "lightpath-memo ", 15) == 0) {
+            version = atoi(line + 15);
+        } else if (sscanf(line, "key %64s", key) == 1) {
+            continue;
+        } else if (sscanf(line, "%7s %llu %lld %64s%n", kind, &entry.size, &entry.mtime_ns, entry.hash,
+                          &name_offset) == 4 && line[name_offset] == ' ' &&
+                   (strcmp(kind, "input") == 0 || strcmp(kind, "output") == 0)) {
+            // Igual que en el manifiesto: un solo espacio antes de la ruta
+            MemoFileList* list = kind[0] == 'i' ? inputs : outputs;
+            add_memo_file(list, line + name_offset + 1, NULL);
+            MemoFile* added = &list->files[list->count - 1];
+            added->size = entry.size;
+            added->mtime_ns = entry.mtime_ns;
+            memcpy(added->hash, entry.hash, sizeof(added->hash));
+        } else {
+            ok = 0;
+        }
+    }
+    free(line);
+    fclose(file);
+    if (!ok || version != LIGHTPATH_VERSION || !key[0]) {
+        key[0] = '\0';
+        free_memo_files(inputs);
+        free_memo_files(outputs);
+        return 0;
+    }
+    return 1;
+}
+
+static int save_memo_file(const char* path, const char* key, const MemoFileList* inputs, const MemoFileList* outputs) {
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        return 0;
+    }
+    fprintf(file, "lightpath-memo %d\n", LIGHTPATH_VERSION);
+    fprintf(file, "key %s\n", key);
+    for (size_t i = 0; i < inputs->count; i++) {
+        const MemoFile* entry = &inputs->files[i];
+        fprintf(file, "input %llu %lld %s %s\n", entry->size, entry->mtime_ns, entry->hash, entry->path);
+    }
+    for (size_t i = 0; i < outputs->count; i++) {
+        const MemoFile* entry = &outputs->files[i];
+        fprintf(file, "output %llu %lld %s %s\n", entry->size, entry->mtime_ns, entry->hash, entry->path);
+    }
+    if (fclose(file) != 0 || rename(temp_path, path) != 0) {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static void hash_memo_string(Sha256* ctx, const char* label, const char* text) {
+    sha256_update(ctx, label, strlen(label) + 1);
+    sha256_update(ctx, text, strlen(text) + 1);
+}
+
+// Clave de la función: comandos con su contexto, patrones y contenido de los inputs
+static void memo_function_key(const MemoCheck* memo, char key[65]) {
+    const LightPathProject* project = memo->project;
+    const FunctionBlock* block = memo->block;
+    Sha256 ctx;
+    sha256_init(&ctx);
+    char number[32];
+    snprintf(number, sizeof(number), "%d", LIGHTPATH_VERSION);
+    hash_memo_string(&ctx, "lightpath", number);
+    hash_memo_string(&ctx, "function", project_string(project, block->name));
+    for (int i = 0; i < block->command_count; i++) {
+        const Command* cmd = block_command(project, block, i);
+        snprintf(number, sizeof(number), "%d %d", cmd->build_version_at_time, cmd->group);
+        hash_memo_string(&ctx, "command", project_string(project, cmd->command));
+        hash_memo_string(&ctx, "build_version", number);
+        hash_memo_string(&ctx, "path_mode", project_string(project, cmd->path_mode_at_time));
+    }
+    snprintf(number, sizeof(number), "%d", block->final_build_version);
+    hash_memo_string(&ctx, "final_build_version", number);
+    hash_memo_string(&ctx, "final_path_mode", project_string(project, block->final_path_mode));
+    for (int i = 0; i < block->input_count; i++) {
+        hash_memo_string(&ctx, "inputs", project_string(project, ARENA_AT(&project->arena, ArenaRef, block->inputs)[i]));
+    }
+    for (int i = 0; i < block->output_count; i++) {
+        hash_memo_string(&ctx, "outputs", project_string(project, ARENA_AT(&project->arena, ArenaRef, block->outputs)[i]));
+    }
+    for (size_t i = 0; i < memo->inputs.count; i++) {
+        hash_memo_string(&ctx, memo->inputs.files[i].path, memo->inputs.files[i].hash);
+    }
+    unsigned char digest[32];
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, key);
+}
+
+// Los outputs registrados existen y no cambiaron (misma fecha y tamaño, o mismo contenido)
+static int memo_outputs_intact(const MemoFileList* outputs) {
+    for (size_t i = 0; i < outputs->count; i++) {
+        const MemoFile* file = &outputs->files[i];
+        struct stat st;
+        if (stat(file->path, &st) != 0 || !S_ISREG(st.st_mode) || (unsigned long long)st.st_size != file->size) {
+            return 0;
+        }
+        char hash[65];
+        if (stat_mtime_ns(&st) != file->mtime_ns && (!sha256_file(file->path, hash) || strcmp(hash, file->hash) != 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Calcula la clave de la función y decide si se puede saltar (nunca con --force)
+static int memo_is_current(MemoCheck* memo) {
+    char path[MAX_PATH_LENGTH], recorded_key[65];
+    MemoFileList recorded_inputs = {0}, recorded_outputs = {0};
+    memo_record_path(memo, path, sizeof(path));
+    int have_record = load_memo_record(path, recorded_key, &recorded_inputs, &recorded_outputs);
+
+    const LightPathProject* project = memo->project;
+    for (int i = 0; i < memo->block->input_count; i++) {
+        expand_pattern(project_string(project, ARENA_AT(&project->arena, ArenaRef, memo->block->inputs)[i]),
+                       &memo->inputs);
+    }
+    sort_memo_files(&memo->inputs);
+    if (hash_memo_files(&memo->inputs, &recorded_inputs)) {
+        memo_function_key(memo, memo->key);
+    } else {
+        // Un input ilegible: se ejecuta y no se registra
+        memo->key[0] = '\0';
+    }
+
+    memo->up_to_date = !force_run && have_record && memo->key[0] && strcmp(memo->key, recorded_key) == 0 &&
+                       memo_outputs_intact(&recorded_outputs);
+    if (memo->up_to_date) {
+        printf("\"%s\" Function is up to date, skipped (--force to run it)\n",
+               project_string(project, memo->block->name));
+    }
+    free_memo_files(&recorded_inputs);
+    free_memo_files(&recorded_outputs);
+    return memo->up_to_date;
+}
+
+// La función terminó bien: se registran la clave, los inputs y los outputs que dejó
+static void save_memo_record(MemoCheck* memo) {
+    char path[MAX_PATH_LENGTH], recorded_key[65];
+    MemoFileList recorded_inputs = {0}, recorded_outputs = {0}, outputs = {0};
+    memo_record_path(memo, path, sizeof(path));
+    load_memo_record(path, recorded_key, &recorded_inputs, &recorded_outputs);
+    unlink(path);
+
+    const LightPathProject* project = memo->project;
+    int ok = memo->key[0] != '\0';
+    for (int i = 0; ok && i < memo->block->output_count; i++) {
+        const char* pattern = project_string(project, ARENA_AT(&project->arena, ArenaRef, memo->block->outputs)[i]);
+        size_t before = outputs.count;
+        expand_pattern(pattern, &outputs);
+        if (outputs.count == before) {
+            // Sin registro la próxima vez se ejecuta de nuevo
+            printf("\"%s\" Function did not create %s, it is not memoized\n",
+                   project_string(project, memo->block->name), pattern);
+            ok = 0;
+        }
+    }
+    if (ok) {
+        sort_memo_files(&outputs);
+        ok = hash_memo_files(&outputs, &recorded_outputs) && create_directory(STATE_DIR) &&
+             create_directory(MEMO_DIR) && save_memo_file(path, memo->key, &memo->inputs, &outputs);
+    }
+    free_memo_files(&recorded_inputs);
+    free_memo_files(&recorded_outputs);
+    free_memo_files(&outputs);
+}
+
+// Ejecutor de comandos: grafo de dependencias con un número limitado de trabajos
+static int child_signal_pipe[2] = {-1, -1};
+
+static void on_child_exit(int signal_number) {
+    (void)signal_number;
+    int saved_errno = errno;
+    char byte = 0;
+    if (write(child_signal_pipe[1], &byte, 1) < 0) {
+        // El pipe lleno ya despierta al bucle
+    }
+    errno = saved_errno;
+}
+
+static int add_job_node(JobGraph* graph, const char* command, const char* function_name, int index) {
+    if (graph->count == graph->capacity) {
+        graph->capacity = graph->capacity ? graph->capacity * 2 : 64;
+        graph->nodes = checked_realloc(graph->nodes, graph->capacity * sizeof(JobNode));
+    }
+    JobNode* node = &graph->nodes[graph->count];
+    memset(node, 0, sizeof(JobNode));
+    node->command = command;
+    node->function_name = function_name;
+    node->index = index;
+    node->pid = -1;
+    node->out_fd = -1;
+    node->err_fd = -1;
+    node->memo = -1;
+    return graph->count++;
+}
+
+static void add_job_edge(JobGraph* graph, int from, int to) {
+    JobNode* node = &graph->nodes[from];
+    if (node->dependent_count == node->dependent_capacity) {
+        node->dependent_capacity = node->dependent_capacity ? node->dependent_capacity * 2 : 4;
+        node->dependents = checked_realloc(node->dependents, node->dependent_capacity * sizeof(int));
+    }
+    node->dependents[node->dependent_count++] = to;
+    graph->nodes[to].pending++;
+}
+
+void free_job_graph(JobGraph* graph) {
+    for (int i = 0; i < graph->count; i++) {
+        free(graph->nodes[i].dependents);
+        buffer_free(&graph->nodes[i].out);
+        buffer_free(&graph->nodes[i].err);
+    }
+    for (int i = 0; i < graph->memo_count; i++) {
+        free_memo_files(&graph->memos[i].inputs);
+    }
+    free(graph->nodes);
+    free(graph->barriers);
+    free(graph->visiting);
+    free(graph->memos);
+    memset(graph, 0, sizeof(JobGraph));
+}
+
+// Añade una función (y antes sus "needs") al grafo; devuelve su nodo de fin
+int add_function_to_graph(LightPathProject* project, JobGraph* graph, FunctionBlock* block) {
+    if (!graph->barriers) {
+        int count = project->root->function_count ? project->root->function_count : 1;
+        graph->barriers = checked_realloc(NULL, sizeof(int) * count);
+        graph->visiting = checked_realloc(NULL, sizeof(int) * count);
+        for (int i = 0; i < count; i++) {
+            graph->barriers[i] = -1;
+            graph->visiting[i] = 0;
+        }
+    }
+
+    const char* name = project_string(project, block->name);
+    const ArenaRef* needs = ARENA_AT(&project->arena, ArenaRef, block->needs);
+    int* previous_step = checked_realloc(NULL, sizeof(int) * (block->needs_count + block->command_count + 1));
+    int previous_count = 0;
+    for (int i = 0; i < block->needs_count; i++) {
+        const char* needed_name = project_string(project, needs[i]);
+        FunctionBlock* needed_block = find_function(project, needed_name, strlen(needed_name));
+        if (!needed_block) {
+            printf("\"%s\" Function on build.path is not there! Error!\n", needed_name);
+            free(previous_step);
+            return -1;
+        }
+        int needed = needed_block->index;
+        if (graph->visiting[needed]) {
+            printf("\"%s\" Function needs itself, Error!\n", needed_name);
+            free(previous_step);
+            return -1;
+        }
+        if (graph->barriers[needed] < 0) {
+            graph->visiting[needed] = 1;
+            graph->barriers[needed] = add_function_to_graph(project, graph, needed_block);
+            graph->visiting[needed] = 0;
+            if (graph->barriers[needed] < 0) {
+                free(previous_step);
+                return -1;
+            }
+        }
+        previous_step[previous_count++] = graph->barriers[needed];
+    }
+
+    // Con inputs/outputs, un nodo decide (ya terminadas las "needs") si hay que ejecutarla
+    int memo = -1;
+    if (block->index >= 0 && (block->input_count > 0 || block->output_count > 0)) {
+        if (graph->memo_count == graph->memo_capacity) {
+            graph->memo_capacity = graph->memo_capacity ? graph->memo_capacity * 2 : 4;
+            graph->memos = checked_realloc(graph->memos, graph->memo_capacity * sizeof(MemoCheck));
+        }
+        memo = graph->memo_count++;
+        MemoCheck* check = &graph->memos[memo];
+        memset(check, 0, sizeof(MemoCheck));
+        check->project = project;
+        check->block = block;
+        check->check = add_job_node(graph, NULL, name, 0);
+        graph->nodes[check->check].memo = memo;
+        for (int p = 0; p < previous_count; p++) {
+            add_job_edge(graph, previous_step[p], check->check);
+        }
+        previous_step[0] = check->check;
+        previous_count = 1;
+    }
+
+    // Comandos seguidos del mismo grupo "parallel" forman un paso
+    int* step = checked_realloc(NULL, sizeof(int) * (block->command_count + 1));
+    for (int i = 0; i < block->command_count;) {
+        int group = block_command(project, block, i)->group;
+        int step_count = 0;
+        do {
+            int node = add_job_node(graph, project_string(project, block_command(project, block, i)->command), name, i + 1);
+            for (int p = 0; p < previous_count; p++) {
+                add_job_edge(graph, previous_step[p], node);
+            }
+            step[step_count++] = node;
+            i++;
+        } while (group != 0 && i < block->command_count && block_command(project, block, i)->group == group);
+        memcpy(previous_step, step, sizeof(int) * step_count);
+        previous_count = step_count;
+    }
+
+    int barrier = add_job_node(graph, NULL, name, 0);
+    for (int p = 0; p < previous_count; p++) {
+        add_job_edge(graph, previous_step[p], barrier);
+    }
+    if (memo >= 0) {
+        graph->memos[memo].barrier = barrier;
+        graph->nodes[barrier].memo = memo;
+    }
+    free(step);
+    free(previous_step);
+    return barrier;
+}
+
+static void flush_job_output(const JobNode* node, const ByteBuffer* output, FILE* stream) {
+    size_t start = 0;
+    while (start < output->size) {
+        size_t end = start;
+        while (end < output->size && output->data[end] != '\n') end++;
+        fprintf(stream, "[%s:%d] ", node->function_name, node->index);
+        fwrite(output->data + start, 1, end - start, stream);
+        fputc('\n', stream);
+        start = end + 1;
+    }
+    fflush(stream);
+}
+
+static int start_job(JobNode* node, int buffered) {
+    int out_pipe[2] = {-1, -1}, err_pipe[2] = {-1, -1};
+    if (buffered && (pipe2(out_pipe, O_CLOEXEC) != 0 || pipe2(err_pipe, O_CLOEXEC) != 0)) {
+        return 0;
+    }
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return 0;
+    }
+    if (pid == 0) {
+        if (buffered) {
+            dup2(out_pipe[1], STDOUT_FILENO);
+            dup2(err_pipe[1], STDERR_FILENO);
+        }
+        signal(SIGCHLD, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", node->command, (char*)NULL);
+        _exit(127);
+    }
+
+    node->pid = pid;
+    if (buffered) {
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+        node->out_fd = out_pipe[0];
+        node->err_fd = err_pipe[0];
+    }
+    return 1;
+}
+
+// Ejecuta el grafo; se detiene en el primer fallo (los trabajos en curso terminan)
+int run_job_graph(JobGraph* graph, int jobs) {
+    // Sin paralelismo posible se hereda la terminal (salida en vivo, interactiva)
+    int buffered = 0;
+    for (int i = 0; i < graph->count && jobs > 1; i++) {
+        if (graph->nodes[i].dependent_count > 1 || graph->nodes[i].pending > 1) {
+            buffered = 1;
+        }
+    }
+
+    if (pipe2(child_signal_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+        printf("Cannot start commands, Error!\n");
+        return 0;
+    }
+    struct sigaction action, previous_action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = on_child_exit;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, &previous_action);
+
+    // Cola FIFO de trabajos listos: con -j 1 se ejecutan en el orden de build.path.
+    // Cada nodo entra una sola vez, así que basta un array sin vuelta
+    int* ready = checked_realloc(NULL, sizeof(int) * (graph->count + 1));
+    int ready_head = 0, ready_count = 0, running = 0, finished = 0, failed = 0;
+    for (int i = 0; i < graph->count; i++) {
+        if (graph->nodes[i].pending == 0) ready[ready_count++] = i;
+    }
+    struct pollfd* fds = checked_realloc(NULL, sizeof(struct pollfd) * (2 * graph->count + 1));
+    int* fd_nodes = checked_realloc(NULL, sizeof(int) * (2 * graph->count + 1));
+
+    while (finished < graph->count) {
+        // Lanzar trabajos listos (las barreras terminan al instante)
+        while (!failed && ready_head < ready_count &&
+               (running < jobs || graph->nodes[ready[ready_head]].command == NULL)) {
+            int index = ready[ready_head++];
+            JobNode* node = &graph->nodes[index];
+            MemoCheck* memo = node->memo >= 0 ? &graph->memos[node->memo] : NULL;
+            if (memo && memo->check == index && memo_is_current(memo)) {
+                // Al día: sus comandos se dan por hechos y se pasa directamente al fin de la función
+                for (int i = index; i < memo->barrier; i++) {
+                    graph->nodes[i].state = JOB_DONE;
+                }
+                finished += memo->barrier - index;
+                graph->nodes[memo->barrier].pending = 0;
+                ready[ready_count++] = memo->barrier;
+                continue;
+            }
+            if (node->command == NULL) {
+                node->state = JOB_DONE;
+                if (memo && memo->barrier == index && !memo->up_to_date) {
+                    save_memo_record(memo);
+                }
+            } else if (start_job(node, buffered)) {
+                // Carril libre más bajo para el perfil (una fila por trabajo simultáneo)
+                node->start_us = monotonic_us();
+                node->lane = 1;
+                for (int i = 0; i < graph->count; i++) {
+                    if (graph->nodes[i].state == JOB_RUNNING && graph->nodes[i].lane == node->lane) {
+                        node->lane++;
+                        i = -1;
+                    }
+                }
+                node->state = JOB_RUNNING;
+                running++;
+                continue;
+            } else {
+                printf("Cannot start \"%s\", Error!\n", node->command);
+                node->state = JOB_DONE;
+                failed = 1;
+            }
+            finished++;
+            for (int d = 0; d < node->dependent_count; d++) {
+                if (--graph->nodes[node->dependents[d]].pending == 0) {
+                    ready[ready_count++] = node->dependents[d];
+                }
+            }
+        }
+        if (running == 0) {
+            break;
+        }
+
+        int fd_count = 0;
+        fds[fd_count].fd = child_signal_pipe[0];
+        fds[fd_count++].events = POLLIN;
+        for (int i = 0; i < graph->count; i++) {
+            JobNode* node = &graph->nodes[i];
+            if (node->state != JOB_RUNNING) continue;
+            if (node->out_fd >= 0) {
+                fds[fd_count].fd = node->out_fd;
+                fds[fd_count].events = POLLIN;
+                fd_nodes[fd_count++] = i;
+            }
+            if (node->err_fd >= 0) {
+                fds[fd_count].fd = node->err_fd;
+                fds[fd_count].events = POLLIN;
+                fd_nodes[fd_count++] = i;
+            }
+        }
+        if (poll(fds, fd_count, -1) < 0 && errno != EINTR) {
+            break;
+        }
+
+        // Recoger la salida de los trabajos con búfer
+        for (int f = 1; f < fd_count; f++) {
+            if (!(fds[f].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            JobNode* node = &graph->nodes[fd_nodes[f]];
+            int is_out = fds[f].fd == node->out_fd;
+            char chunk[8192];
+            ssize_t got = read(fds[f].fd, chunk, sizeof(chunk));
+            if (got > 0) {
+                buffer_append(is_out ? &node->out : &node->err, chunk, got);
+            } else if (got == 0 || errno != EINTR) {
+                close(fds[f].fd);
+                if (is_out) node->out_fd = -1; else node->err_fd = -1;
+            }
+        }
+
+        char drain[64];
+        while (read(child_signal_pipe[0], drain, sizeof(drain)) > 0) {
+        }
+
+        // Procesos terminados cuyos pipes ya se cerraron
+        for (int i = 0; i < graph->count; i++) {
+            JobNode* node = &graph->nodes[i];
+            int status;
+            struct rusage usage;
+            if (node->state != JOB_RUNNING || node->out_fd >= 0 || node->err_fd >= 0) continue;
+            if (wait4(node->pid, &status, WNOHANG, &usage) != node->pid) continue;
+
+            node->state = JOB_DONE;
+            running--;
+            finished++;
+            if (buffered) {
+                flush_job_output(node, &node->out, stdout);
+                flush_job_output(node, &node->err, stderr);
+            }
+            int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            profile_command(node, &usage, code);
+            if (code != 0) {
+                if (!failed) {
+                    printf("Command \"%s\" failed with exit code %d, Error!\n", node->command, code);
+                }
+                failed = 1;
+                continue;
+            }
+            for (int d = 0; d < node->dependent_count; d++) {
+                if (--graph->nodes[node->dependents[d]].pending == 0) {
+                    ready[ready_count++] = node->dependents[d];
+                }
+            }
+        }
+    }
+
+    sigaction(SIGCHLD, &previous_action, NULL);
+    close(child_signal_pipe[0]);
+    close(child_signal_pipe[1]);
+    child_signal_pipe[0] = child_signal_pipe[1] = -1;
+    free(ready);
+    free(fds);
+    free(fd_nodes);
+    return !failed && finished == graph->count;
+}
+
+// Ejecuta una función completa (con sus dependencias) usando el grafo
+int run_function_block(LightPathProject* project, FunctionBlock* block) {
+    JobGraph graph;
+    memset(&graph, 0, sizeof(graph));
+    int ok = add_function_to_graph(project, &graph, block) >= 0 &&
+             run_job_graph(&graph, resolve_job_count(project));
+    free_job_graph(&graph);
+    return ok;
+}
+
+// Payload y manifiesto de cada códec; el del bloque build conserva los nombres de siempre
+static void payload_state_paths(int codec, int main_codec, char* manifest_path, char* payload_path, size_t size) {
+    if (codec == main_codec) {
+        snprintf(manifest_path, size, "%s/manifest", STATE_DIR);
+        snprintf(payload_path, size, "%s/source_packed.zip", STATE_DIR);
+    } else {
+        snprintf(manifest_path, size, "%s/manifest-%s", STATE_DIR, codec_names[codec]);
+        snprintf(payload_path, size, "%s/source_packed-%s.zip", STATE_DIR, codec_names[codec]);
+    }
+}
+
+// main da lightpath_app y cada función de targets = "..." da lightpath_app-<función>
+static int collect_app_variants(LightPathProject* project, AppVariant** variants) {
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    const ArenaRef* targets = ARENA_AT(&project->arena, ArenaRef, build_block->targets);
+    AppVariant* list = checked_realloc(NULL, sizeof(AppVariant) * (build_block->target_count + 1));
+    memset(list, 0, sizeof(AppVariant));
+    list[0].project = project;
+    list[0].block = project_block(project, project->root->main_func);
+    list[0].codec = build_block->compression;
+    snprintf(list[0].app_path, sizeof(list[0].app_path), "lightpath_app");
+    int count = 1;
+
+    for (int i = 0; i < build_block->target_count; i++) {
+        const char* name = project_string(project, targets[i]);
+        FunctionBlock* block = find_function(project, name, strlen(name));
+        if (strcmp(name, "main") == 0 || strcmp(name, "build") == 0) {
+            printf("\"%s\" Function is a pre-builded function, Error!\n", name);
+            free(list);
+            return -1;
+        }
+        if (!block) {
+            printf("\"%s\" Function on build.path is not there! Error!\n", name);
+            free(list);
+            return -1;
+        }
+        int repeated = 0;
+        for (int v = 1; v < count; v++) {
+            repeated = repeated || list[v].block == block;
+        }
+        if (repeated) {
+            continue;
+        }
+        AppVariant* variant = &list[count++];
+        memset(variant, 0, sizeof(AppVariant));
+        variant->project = project;
+        variant->block = block;
+        variant->codec = block->compression >= 0 ? block->compression : build_block->compression;
+        snprintf(variant->app_path, sizeof(variant->app_path), "lightpath_app-%s", name);
+    }
+    *variants = list;
+    return count;
+}
+
+// hot = "lib" cuenta para todo lo que hay dentro de lib/
+static int hot_pattern_matches(const char* pattern, const char* name) {
+    char prefix[MAX_PATH_LENGTH];
+    for (const char* slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+        snprintf(prefix, sizeof(prefix), "%.*s", (int)(slash - name), name);
+        if (match_path_pattern(pattern, prefix)) {
+            return 1;
+        }
+    }
+    return match_path_pattern(pattern, name);
+}
+
+// Rutas del conjunto caliente (hot y hot_file), ordenadas y terminadas en NUL.
+// Un duplicado arrastra a su original, que debe estar extraído antes.
+static uint32_t collect_hot_entries(LightPathProject* project, const FunctionBlock* block, const PackList* list,
+                                    ByteBuffer* names) {
+    const char** patterns = checked_realloc(NULL, sizeof(const char*) * (block->hot_count + 1));
+    int pattern_count = 0;
+    for (int i = 0; i < block->hot_count; i++) {
+        patterns[pattern_count++] = project_string(project, ARENA_AT(&project->arena, ArenaRef, block->hot)[i]);
+    }
+    unsigned char* hot_file = NULL;
+    size_t hot_file_length = 0;
+    if (block->hot_file) {
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), "source/%s", project_string(project, block->hot_file));
+        if (read_whole_file(path, &hot_file, &hot_file_length)) {
+            char* saveptr;
+            for (char* line = strtok_r((char*)hot_file, "\r\n", &saveptr); line;
+                 line = strtok_r(NULL, "\r\n", &saveptr)) {
+                while (*line == ' ' || *line == '\t') line++;
+                while (strncmp(line, "./", 2) == 0) line += 2;
+                if (*line && *line != '#') {
+                    patterns = checked_realloc(patterns, sizeof(const char*) * (pattern_count + 1));
+                    patterns[pattern_count++] = line;
+                }
+            }
+        }
+    }
+
+    char* hot = checked_realloc(NULL, list->count + 1);
+    memset(hot, 0, list->count + 1);
+    for (size_t i = 0; pattern_count > 0 && i < list->count; i++) {
+        const PackEntry* entry = &list->entries[i];
+        for (int p = 0; !entry->is_directory && p < pattern_count; p++) {
+            if (hot_pattern_matches(patterns[p], entry->name)) {
+                hot[i] = 1;
+                // Hasta el original de verdad, aunque haya una cadena de duplicados
+                for (const PackEntry* original = entry->original; original; original = original->original) {
+                    hot[original - list->entries] = 1;
+                }
+                break;
+            }
+        }
+    }
+    // list va en el orden de collect_source_entries; la tabla, en el de strcmp
+    const char** sorted = checked_realloc(NULL, sizeof(const char*) * (list->count + 1));
+    size_t hot_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (hot[i]) {
+            sorted[hot_count++] = list->entries[i].name;
+        }
+    }
+    qsort(sorted, hot_count, sizeof(const char*), compare_names);
+    for (size_t i = 0; i < hot_count; i++) {
+        buffer_append(names, sorted[i], strlen(sorted[i]) + 1);
+    }
+    static const char padding[4] = {0};
+    buffer_append(names, padding, (4 - names->size % 4) % 4);
+    free(sorted);
+    free(hot);
+    free(hot_file);
+    free(patterns);
+    return (uint32_t)hot_count;
+}
+
+static void* write_variant_worker(void* arg) {
+    AppVariant* variant = arg;
+    ByteBuffer table = {0}, hot_names = {0};
+    uint32_t hot_count = collect_hot_entries(variant->project, variant->block, variant->list, &hot_names);
+    write_command_table(variant->project, variant->block, variant->codec, variant->payload_hash, &hot_names, hot_count,
+                        &table);
+    variant->ok = write_app_binary(variant->payload_path, &table, variant->app_path);
+    buffer_free(&hot_names);
+    buffer_free(&table);
+    return NULL;
+}
+
+// Empaqueta la lista ya recorrida de source/ con el códec de current y escribe
+// a la vez todas las variantes que usan ese payload.
+// current recibe el nuevo manifiesto (también cuando lo usa el modo watch).
+int build_app(LightPathProject* project, PackList* list, AppVariant* variants, int variant_count,
+              const BuildManifest* previous, BuildManifest* current) {
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    char manifest_path[MAX_PATH_LENGTH], payload_path[MAX_PATH_LENGTH];
+    payload_state_paths(current->codec, build_block->compression, manifest_path, payload_path, sizeof(manifest_path));
+    unlink(manifest_path);
+    
+    // 1. Empaquetar source/, reutilizando las entradas sin cambios
+    ProfileMark phase = profile_begin();
+    int ok = pack_source_directory(list, payload_path, resolve_job_count(project), current->codec, previous, current);
+    profile_end(phase, "pack source");
+    if (ok && current->duplicate_count > 0) {
+        // Una línea por payload: con variantes de varios códecs, la cifra comprimida es la de cada uno
+        printf("%zu duplicate files stored once: %llu bytes saved (%llu compressed with %s)\n",
+               current->duplicate_count, current->duplicate_bytes, current->duplicate_packed_bytes,
+               codec_names[current->codec]);
+    }
+    
+    // 2. Añadir payload y tabla de comandos a copias de este ejecutable (sin gcc), una por variante
+    phase = profile_begin();
+    if (ok && !sha256_file(payload_path, current->payload_hash)) {
+        printf("Cannot read %s, Error!\n", payload_path);
+        ok = 0;
+    }
+    pthread_t* threads = checked_realloc(NULL, sizeof(pthread_t) * variant_count);
+    int* started = checked_realloc(NULL, sizeof(int) * variant_count);
+    for (int v = 0; v < variant_count; v++) {
+        AppVariant* variant = &variants[v];
+        started[v] = 0;
+        if (!ok || variant->codec != current->codec) {
+            continue;
+        }
+        variant->payload_path = payload_path;
+        variant->payload_hash = current->payload_hash;
+        variant->list = list;
+        // Sin hilos disponibles se escribe aquí mismo
+        started[v] = pthread_create(&threads[v], NULL, write_variant_worker, variant) == 0;
+        if (!started[v]) {
+            write_variant_worker(variant);
+        }
+    }
+    for (int v = 0; v < variant_count; v++) {
+        if (started[v]) {
+            pthread_join(threads[v], NULL);
+        }
+        ok = ok && (variants[v].codec != current->codec || variants[v].ok);
+    }
+    free(threads);
+    free(started);
+    profile_end(phase, "write lightpath_app");
+    
+    // 3. Guardar el manifiesto para la próxima compilación
+    for (int v = 0; ok && v < variant_count; v++) {
+        struct stat app_stat;
+        if (variants[v].codec != current->codec || stat(variants[v].app_path, &app_stat) != 0) {
+            continue;
+        }
+        current->apps = checked_realloc(current->apps, (current->app_count + 1) * sizeof(ManifestApp));
+        ManifestApp* app = &current->apps[current->app_count++];
+        app->path = strdup(variants[v].app_path);
+        app->size = app_stat.st_size;
+        app->mtime_ns = (long long)app_stat.st_mtim.tv_sec * 1000000000LL + app_stat.st_mtim.tv_nsec;
+    }
+    if (ok) {
+        save_build_manifest(manifest_path, current);
+    }
+    return ok;
+}
+
+// Los binarios de todas las variantes siguen valiendo (nada que compilar)
+static int payload_is_current(const PackList* list, const AppVariant* variants, int variant_count, int codec,
+                              const char* build_path_hash, const char* runtime_hash, const BuildManifest* previous) {
+    int unchanged = strcmp(previous->build_path_hash, build_path_hash) == 0 &&
+                    strcmp(previous->runtime_hash, runtime_hash) == 0 && source_tree_unchanged(list, previous);
+    for (int v = 0; unchanged && v < variant_count; v++) {
+        unchanged = variants[v].codec != codec || app_is_current(previous, variants[v].app_path);
+    }
+    return unchanged;
+}
+
+static int apps_are_current(LightPathProject* project, const PackList* list, const AppVariant* variants,
+                            int variant_count, const char* build_path_hash, const char* runtime_hash,
+                            const BuildManifest* main_previous) {
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    int current = 1;
+    for (int v = 0; current && v < variant_count; v++) {
+        int seen = 0;
+        for (int w = 0; w < v; w++) {
+            seen = seen || variants[w].codec == variants[v].codec;
+        }
+        if (seen) {
+            continue;
+        }
+        if (v == 0) {
+            current = payload_is_current(list, variants, variant_count, variants[v].codec, build_path_hash,
+                                         runtime_hash, main_previous);
+            continue;
+        }
+        char manifest_path[MAX_PATH_LENGTH], payload_path[MAX_PATH_LENGTH];
+        payload_state_paths(variants[v].codec, build_block->compression, manifest_path, payload_path,
+                            sizeof(manifest_path));
+        BuildManifest previous;
+        load_build_manifest(manifest_path, &previous);
+        current = payload_is_current(list, variants, variant_count, variants[v].codec, build_path_hash,
+                                     runtime_hash, &previous);
+        free_build_manifest(&previous);
+    }
+    return current;
+}
+
+// Compila el payload de un códec si algo cambió; previous pasa a ser el nuevo manifiesto
+static int update_payload(LightPathProject* project, PackList* list, AppVariant* variants, int variant_count, int codec,
+                          const char* build_path_hash, const char* runtime_hash, BuildManifest* previous) {
+    // 0. Ni source/, ni build.path, ni lightpath cambiaron: sus binarios siguen siendo válidos
+    if (payload_is_current(list, variants, variant_count, codec, build_path_hash, runtime_hash, previous)) {
+        return 1;
+    }
+
+    BuildManifest current;
+    memset(&current, 0, sizeof(current));
+    current.valid = 1;
+    current.codec = codec;
+    memcpy(current.build_path_hash, build_path_hash, sizeof(current.build_path_hash));
+    memcpy(current.runtime_hash, runtime_hash, sizeof(current.runtime_hash));
+    if (!build_app(project, list, variants, variant_count, previous, &current)) {
+        free_build_manifest(&current);
+        return 0;
+    }
+    free_build_manifest(previous);
+    *previous = current;
+    return 1;
+}
+
+// source/ se recorre una vez y se comprime una vez por códec distinto entre las variantes.
+// main_previous es el manifiesto del códec del bloque build (el modo watch lo guarda en memoria).
+int build_apps(LightPathProject* project, PackList* list, const char* build_path_hash, const char* runtime_hash,
+               BuildManifest* main_previous) {
+    AppVariant* variants;
+    int variant_count = collect_app_variants(project, &variants);
+    if (variant_count < 0) {
+        return 0;
+    }
+    int ok = 1;
+    for (int v = 0; ok && v < variant_count; v++) {
+        int codec = variants[v].codec, seen = 0;
+        for (int w = 0; w < v; w++) {
+            seen = seen || variants[w].codec == codec;
+        }
+        if (seen) {
+            continue;
+        }
+        if (v == 0) {
+            ok = update_payload(project, list, variants, variant_count, codec, build_path_hash, runtime_hash,
+                                main_previous);
+            continue;
+        }
+        char manifest_path[MAX_PATH_LENGTH], payload_path[MAX_PATH_LENGTH];
+        payload_state_paths(codec, variants[0].codec, manifest_path, payload_path, sizeof(manifest_path));
+        BuildManifest previous;
+        load_build_manifest(manifest_path, &previous);
+        ok = update_payload(project, list, variants, variant_count, codec, build_path_hash, runtime_hash, &previous);
+        free_build_manifest(&previous);
+    }
+    free(variants);
+    return ok;
+}
+
+// Caché de artefactos (LIGHTPATH_ARTIFACT_CACHE): <raíz>/<clave>/ guarda los binarios
+// de una compilación. La clave resume todo lo que decide su contenido, así que otra
+// copia del proyecto (otro checkout, otro trabajo de CI) los reutiliza sin compilar.
+static int artifact_cache_root(char* root, size_t size, unsigned long long* limit) {
+    const char* dir = getenv("LIGHTPATH_ARTIFACT_CACHE");
+    if (!dir || !*dir) {
+        return 0;
+    }
+    const char* limit_text = getenv("LIGHTPATH_ARTIFACT_CACHE_LIMIT");
+    *limit = limit_text && *limit_text ? parse_size(limit_text) : DEFAULT_ARTIFACT_CACHE_LIMIT;
+    snprintf(root, size, "%s", dir);
+    char path[MAX_PATH_LENGTH + 2];
+    snprintf(path, sizeof(path), "%s/", root);
+    return lp_make_parents(path);
+}
+
+// build.path normalizado: la secuencia de tokens (sin comentarios ni espacios)
+static int hash_build_path_tokens(Sha256* ctx) {
+    unsigned char* content;
+    size_t length;
+    if (!read_whole_file("build.path", &content, &length)) {
+        return 0;
+    }
+    init_tokenizer((char*)content, length);
+    Token token;
+    while ((token = next_token()).type != TOKEN_EOF) {
+        unsigned char type = (unsigned char)token.type;
+        uint64_t token_length = token.length;
+        sha256_update(ctx, &type, 1);
+        sha256_update(ctx, &token_length, sizeof(token_length));
+        sha256_update(ctx, token.value, token.length);
+    }
+    cleanup_tokenizer();
+    return !tokenizer_failed;
+}
+
+// Clave: versión y ejecutable de lightpath, build.path normalizado y, por cada
+// entrada de source/, ruta, permisos y contenido (las fechas no entran: el archivo
+// usa una fecha fija)
+static int artifact_key(PackList* list, const BuildManifest* previous, const char* runtime_hash, int jobs,
+                        char key[65]) {
+    // Los hashes del manifiesto valen para los archivos que no se tocaron
+    ManifestEntry** index = NULL;
+    size_t index_count = 0;
+    if (previous->valid) {
+        index = checked_realloc(NULL, sizeof(ManifestEntry*) * (previous->count + 1));
+        for (size_t i = 0; i < previous->count; i++) {
+            index[index_count++] = &previous->entries[i];
+        }
+        qsort(index, index_count, sizeof(ManifestEntry*), compare_manifest_names);
+    }
+    PackEntry** files = checked_realloc(NULL, sizeof(PackEntry*) * (list->count + 1));
+    size_t file_count = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        PackEntry* entry = &list->entries[i];
+        entry->previous = find_manifest_entry(index, index_count, entry->name);
+        entry->hash[0] = '\0';
+        if (S_ISREG(entry->mode) && entry->raw_size > 0) {
+            files[file_count++] = entry;
+        }
+    }
+
+    HashQueue queue;
+    queue.entries = files;
+    queue.count = file_count;
+    queue.next = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    if (jobs > (int)file_count) {
+        jobs = (int)file_count;
+    }
+    pthread_t* workers = checked_realloc(NULL, sizeof(pthread_t) * (jobs + 1));
+    int started = 0;
+    for (int i = 1; i < jobs; i++) {
+        if (pthread_create(&workers[started], NULL, hash_worker, &queue) == 0) {
+            started++;
+        }
+    }
+    hash_worker(&queue);
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    pthread_mutex_destroy(&queue.lock);
+
+    // Los enlaces duros se guardan como enlaces: cuentan con el nombre del primero
+    qsort(files, file_count, sizeof(PackEntry*), compare_entry_inodes);
+    const char** link_names = checked_realloc(NULL, sizeof(const char*) * (list->count + 1));
+    memset(link_names, 0, sizeof(const char*) * (list->count + 1));
+    for (size_t i = 1; i < file_count; i++) {
+        if (files[i - 1]->device == files[i]->device && files[i - 1]->inode == files[i]->inode) {
+            size_t first = files[i - 1] - list->entries;
+            link_names[files[i] - list->entries] = link_names[first] ? link_names[first] : files[i - 1]->name;
+        }
+    }
+
+    Sha256 ctx;
+    sha256_init(&ctx);
+    char text[MAX_PATH_LENGTH + 96];
+    int length = snprintf(text, sizeof(text), "lightpath-artifact %d %s", LIGHTPATH_VERSION, runtime_hash);
+    sha256_update(&ctx, text, length + 1);
+    int ok = hash_build_path_tokens(&ctx);
+    for (size_t i = 0; ok && i < list->count; i++) {
+        PackEntry* entry = &list->entries[i];
+        char target[MAX_PATH_LENGTH];
+        if (entry->is_directory) {
+            length = snprintf(text, sizeof(text), "dir %o", (unsigned int)entry->mode);
+        } else if (S_ISLNK(entry->mode)) {
+            ssize_t target_length = readlink(entry->full_path, target, sizeof(target) - 1);
+            ok = target_length >= 0;
+            target[ok ? target_length : 0] = '\0';
+            length = snprintf(text, sizeof(text), "symlink %o %s", (unsigned int)entry->mode, target);
+        } else if (link_names[i]) {
+            length = snprintf(text, sizeof(text), "hardlink %o %s", (unsigned int)entry->mode, link_names[i]);
+        } else {
+            ok = entry->raw_size == 0 || entry->hash[0];
+            length = snprintf(text, sizeof(text), "file %o %llu %d %s", (unsigned int)entry->mode,
+                              (unsigned long long)entry->raw_size, entry->sparse, entry->raw_size ? entry->hash : "-");
+        }
+        sha256_update(&ctx, entry->name, strlen(entry->name) + 1);
+        sha256_update(&ctx, text, length + 1);
+    }
+    unsigned char digest[32];
+    sha256_final(&ctx, digest);
+    sha256_hex(digest, key);
+
+    for (size_t i = 0; i < list->count; i++) {
+        list->entries[i].previous = NULL;
+    }
+    free(link_names);
+    free(files);
+    free(index);
+    return ok;
+}
+
+// Reflink si el sistema de archivos lo permite, si no enlace duro y si no copia
+static int materialize_file(const char* from, const char* to) {
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", to);
+    unlink(temp_path);
+    int in = open(from, O_RDONLY | O_CLOEXEC);
+    if (in < 0) {
+        return 0;
+    }
+    int out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    int ok = out >= 0 && ioctl(out, FICLONE, in) == 0;
+    if (!ok) {
+        if (out >= 0) {
+            close(out);
+            unlink(temp_path);
+        }
+        out = -1;
+        ok = link(from, temp_path) == 0;
+    }
+    if (!ok) {
+        uint64_t offset = 0;
+        out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+        ok = out >= 0 && copy_file_contents(in, out, &offset) && fchmod(out, 0755) == 0;
+    }
+    close(in);
+    if ((out >= 0 && close(out) != 0) || !ok || rename(temp_path, to) != 0) {
+        unlink(temp_path);
+        return 0;
+    }
+    return 1;
+}
+
+static int restore_artifacts(const char* root, const char* key, const AppVariant* variants, int variant_count) {
+    char dir[MAX_PATH_LENGTH + 80];
+    snprintf(dir, sizeof(dir), "%s/%s", root, key);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    // Con el bloqueo compartido no se desaloja mientras se copia; la fecha marca el uso
+    int ok = flock(fd, LOCK_SH) == 0;
+    futimens(fd, NULL);
+    for (int v = 0; ok && v < variant_count; v++) {
+        char path[2 * MAX_PATH_LENGTH + 96];
+        snprintf(path, sizeof(path), "%s/%s", dir, variants[v].app_path);
+        ok = materialize_file(path, variants[v].app_path);
+    }
+    close(fd);
+    return ok;
+}
+
+// Se escribe en <clave>.tmp.<pid> y se publica con rename: quien lee sólo ve entradas completas
+static void publish_artifacts(const char* root, const char* key, const AppVariant* variants, int variant_count,
+                              unsigned long long limit) {
+    char temp_dir[MAX_PATH_LENGTH + 96], dir[MAX_PATH_LENGTH + 80];
+    snprintf(temp_dir, sizeof(temp_dir), "%s/%s.tmp.%d", root, key, (int)getpid());
+    snprintf(dir, sizeof(dir), "%s/%s", root, key);
+    lp_remove_tree(temp_dir);
+    int ok = mkdir(temp_dir, 0755) == 0;
+    for (int v = 0; ok && v < variant_count; v++) {
+        char path[2 * MAX_PATH_LENGTH + 96];
+        snprintf(path, sizeof(path), "%s/%s", temp_dir, variants[v].app_path);
+        ok = materialize_file(variants[v].app_path, path);
+    }
+    // Si otro proceso publicó la misma clave antes, la suya vale igual
+    if (!ok || rename(temp_dir, dir) != 0) {
+        lp_remove_tree(temp_dir);
+    }
+    lp_cache_evict(root, key, limit);
+}
+
+int build_project(LightPathProject* project) {
+    // Ejecutar comandos de build con sus contextos (se detiene en el primer fallo)
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    ProfileMark phase = profile_begin();
+    if (!run_function_block(project, build_block)) {
+        return 0;
+    }
+    profile_end(phase, "build commands");
+    
+    if (build_block->has_build) {
+        // Verificar que existe la carpeta source
         if (!file_exists("source")) {
             printf("The source directory is not found, Error!\n");
             return 0;
         }
-        
-        // 1. Empaquetar todos los archivos de source/
-        if (!pack_source_directory("source")) {
-            return 0;
+        if (!create_directory(STATE_DIR)) {
+            printf("Cannot create %s, Error!\n", STATE_DIR);
+            return 0;
+        }
+
+        // Estado de la compilación anterior (los intermedios se conservan en .lightpath/)
+        BuildManifest previous;
+        PackList list = {0};
+        char build_path_hash[65], runtime_hash[65];
+        load_build_manifest(STATE_DIR "/manifest", &previous);
+        // runtime_hash identifica el ejecutable de lightpath que hace de stub
+        phase = profile_begin();
+        int ok = sha256_file("build.path", build_path_hash);
+        // La lista del servidor sólo vale si ningún comando de build pudo tocar source/
+        if (server_source && build_block->command_count == 0 && build_block->needs_count == 0) {
+            memcpy(runtime_hash, server_watch->runtime_hash, sizeof(runtime_hash));
+            list = *server_source;
+        } else {
+            ok = ok && sha256_file("/proc/self/exe", runtime_hash) && collect_source_entries("source", "", &list);
+        }
+        profile_end(phase, "scan source");
+
+        // Con la caché de artefactos, unos binarios ya compilados con la misma clave se copian
+        AppVariant* variants = NULL;
+        int variant_count = ok ? collect_app_variants(project, &variants) : -1;
+        char artifact_root[MAX_PATH_LENGTH], key[65];
+        unsigned long long artifact_limit;
+        ok = variant_count > 0;
+        int use_artifacts = ok && artifact_cache_root(artifact_root, sizeof(artifact_root), &artifact_limit) &&
+                            !apps_are_current(project, &list, variants, variant_count, build_path_hash, runtime_hash,
+                                              &previous);
+        if (use_artifacts) {
+            phase = profile_begin();
+            use_artifacts = artifact_key(&list, &previous, runtime_hash, resolve_job_count(project), key);
+            int restored = use_artifacts && restore_artifacts(artifact_root, key, variants, variant_count);
+            profile_end(phase, "artifact cache");
+            if (restored) {
+                printf("lightpath_app restored from the artifact cache (%.12s)\n", key);
+                free(variants);
+                free_pack_list(&list);
+                free_build_manifest(&previous);
+                return 1;
+            }
+        }
+
+        ok = ok && build_apps(project, &list, build_path_hash, runtime_hash, &previous);
+        if (ok && use_artifacts) {
+            publish_artifacts(artifact_root, key, variants, variant_count, artifact_limit);
+        }
+        free(variants);
+        free_pack_list(&list);
+        free_build_manifest(&previous);
+        return ok;
+    }
+    
+    return 1;
+}
+
+int run_custom_function(LightPathProject* project, const char* func_name) {
+    FunctionBlock* block = find_function(project, func_name, strlen(func_name));
+    if (block) {
+        // Los comandos de custom corren en el directorio actual con cualquier path_mode
+        ProfileMark phase = profile_begin();
+        int ok = run_function_block(project, block);
+        profile_end(phase, "function commands");
+        return ok;
+    }
+    
+    printf("\"%s\" Function on build.path is not there! Error!\n", func_name);
+    return 0;
+}
+
+// Modo watch: el proyecto, la lista de source/ y el manifiesto (con los hashes)
+// se quedan en memoria; entre compilaciones sólo se hace stat de lo que avisa inotify
+static int compare_pack_paths(const char* a, const char* b) {
+    // Orden de collect_source_entries: "dir/" y su contenido van antes que "dir.txt"
+    const unsigned char* x = (const unsigned char*)a;
+    const unsigned char* y = (const unsigned char*)b;
+    while (*x && *x == *y) {
+        x++;
+        y++;
+    }
+    int cx = *x == '/' ? 1 : *x;
+    int cy = *y == '/' ? 1 : *y;
+    return cx - cy;
+}
+
+static int compare_pack_entries(const void* a, const void* b) {
+    return compare_pack_paths(((const PackEntry*)a)->name, ((const PackEntry*)b)->name);
+}
+
+static int compare_change_paths(const void* a, const void* b) {
+    return compare_pack_paths(*(char* const*)a, *(char* const*)b);
+}
+
+static void watch_directory(WatchState* state, const char* path, const char* prefix) {
+    int wd = inotify_add_watch(state->fd, path, IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB |
+                                                IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR);
+    if (wd < 0) {
+        printf("Cannot watch %s, Error!\n", path);
+        return;
+    }
+    if (wd >= state->directory_count) {
+        int count = wd + 64;
+        state->directories = checked_realloc(state->directories, sizeof(char*) * count);
+        memset(state->directories + state->directory_count, 0, sizeof(char*) * (count - state->directory_count));
+        state->directory_count = count;
+    }
+    // Un directorio movido conserva su wd: sólo cambia el prefijo
+    free(state->directories[wd]);
+    state->directories[wd] = strdup(prefix);
+}
+
+static void watch_new_directories(WatchState* state, const PackList* list, size_t from) {
+    for (size_t i = from; i < list->count; i++) {
+        if (list->entries[i].is_directory) {
+            watch_directory(state, list->entries[i].full_path, list->entries[i].name);
+        }
+    }
+}
+
+static void add_watch_change(WatchState* state, const char* prefix, const char* name) {
+    if (state->change_count == state->change_capacity) {
+        state->change_capacity = state->change_capacity ? state->change_capacity * 2 : 64;
+        state->changes = checked_realloc(state->changes, sizeof(char*) * state->change_capacity);
+    }
+    size_t length = strlen(prefix) + strlen(name) + 1;
+    char* path = checked_realloc(NULL, length);
+    snprintf(path, length, "%s%s", prefix, name);
+    state->changes[state->change_count++] = path;
+}
+
+static void read_watch_events(WatchState* state) {
+    char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t length = read(state->fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            return;
+        }
+        for (char* p = buffer; p < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                state->overflow = 1;
+            } else if (event->wd == state->project_wd) {
+                if (event->len && strcmp(event->name, "build.path") == 0) {
+                    state->build_path_changed = 1;
+                }
+            } else if (event->wd < 0 || event->wd >= state->directory_count) {
+                continue;
+            } else if (event->mask & IN_IGNORED) {
+                free(state->directories[event->wd]);
+                state->directories[event->wd] = NULL;
+            } else if (event->len && state->directories[event->wd]) {
+                add_watch_change(state, state->directories[event->wd], event->name);
+            }
+        }
+    }
+}
+
+// Agrupa una ráfaga (un guardado, un git checkout) en una sola compilación
+static void wait_for_quiet(WatchState* state) {
+    struct pollfd pfd = {state->fd, POLLIN, 0};
+    long long deadline = monotonic_us() + WATCH_MAX_DELAY_MS * 1000LL;
+    while (monotonic_us() < deadline && poll(&pfd, 1, WATCH_QUIET_MS) > 0) {
+        read_watch_events(state);
+    }
+}
+
+static PackEntry* find_pack_entry(PackList* list, size_t sorted_count, const char* name) {
+    size_t low = 0, high = sorted_count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        int order = compare_pack_paths(list->entries[middle].name, name);
+        if (order == 0) {
+            return &list->entries[middle];
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    // Las entradas añadidas en esta pasada todavía no están ordenadas
+    for (size_t i = sorted_count; i < list->count; i++) {
+        if (strcmp(list->entries[i].name, name) == 0) {
+            return &list->entries[i];
+        }
+    }
+    return NULL;
+}
+
+// Marca para borrar la entrada y, si es un directorio, todo su contenido
+static void remove_pack_entries(PackList* list, size_t sorted_count, const char* name) {
+    PackEntry* entry = find_pack_entry(list, sorted_count, name);
+    if (entry) {
+        entry->name[0] = '\0';
+    }
+    size_t length = strlen(name);
+    for (size_t i = 0; i < list->count; i++) {
+        const char* other = list->entries[i].name;
+        if (strncmp(other, name, length) == 0 && other[length] == '/') {
+            list->entries[i].name[0] = '\0';
+        }
+    }
+}
+
+// Aplica las rutas cambiadas a la lista en memoria
+static void apply_watch_changes(WatchState* state, PackList* list) {
+    qsort(state->changes, state->change_count, sizeof(char*), compare_change_paths);
+    size_t sorted_count = list->count;
+    for (size_t c = 0; c < state->change_count; c++) {
+        const char* name = state->changes[c];
+        if (c > 0 && strcmp(name, state->changes[c - 1]) == 0) {
+            continue;
+        }
+        char full_path[MAX_PATH_LENGTH];
+        struct stat st;
+        snprintf(full_path, sizeof(full_path), "source/%s", name);
+        int exists = lstat(full_path, &st) == 0;
+        int is_file = exists && (S_ISREG(st.st_mode) || S_ISLNK(st.st_mode));
+        PackEntry* entry = is_file ? find_pack_entry(list, sorted_count, name) : NULL;
+
+        if (entry && !entry->is_directory) {
+            set_pack_entry_stat(entry, &st);
+            continue;
+        }
+        remove_pack_entries(list, sorted_count, name);
+        if (exists && S_ISDIR(st.st_mode)) {
+            // Un directorio nuevo o movido se recorre entero
+            char directory[MAX_PATH_LENGTH];
+            snprintf(directory, sizeof(directory), "%s/", name);
+            size_t from = list->count;
+            add_pack_entry(list, directory, full_path, &st);
+            collect_source_entries(full_path, directory, list);
+            watch_new_directories(state, list, from);
+        } else if (is_file) {
+            add_pack_entry(list, name, full_path, &st);
+        }
+    }
+    for (size_t c = 0; c < state->change_count; c++) {
+        free(state->changes[c]);
+    }
+    state->change_count = 0;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->entries[i].name[0]) {
+            list->entries[kept++] = list->entries[i];
+        } else {
+            free(list->entries[i].name);
+            free(list->entries[i].full_path);
+            release_pack_data(&list->entries[i]);
+        }
+    }
+    list->count = kept;
+    qsort(list->entries, list->count, sizeof(PackEntry), compare_pack_entries);
+}
+
+// Primera pasada, o la cola de inotify se desbordó: se recorre source/ entero
+static int scan_watched_source(WatchState* state, PackList* list) {
+    free_pack_list(list);
+    for (size_t c = 0; c < state->change_count; c++) {
+        free(state->changes[c]);
+    }
+    state->change_count = 0;
+    state->overflow = 0;
+    if (!file_exists("source")) {
+        return 1;
+    }
+    watch_directory(state, "source", "");
+    if (!collect_source_entries("source", "", list)) {
+        return 0;
+    }
+    watch_new_directories(state, list, 0);
+    return 1;
+}
+
+// Devuelve si la lista cambió
+static int update_watched_source(WatchState* state, PackList* list) {
+    read_watch_events(state);
+    int changed = state->overflow || state->change_count > 0;
+    if (state->overflow) {
+        scan_watched_source(state, list);
+    } else if (changed) {
+        apply_watch_changes(state, list);
+    }
+    return changed;
+}
+
+// Comandos de build y empaquetado; el nuevo manifiesto pasa a ser el anterior
+static int watch_rebuild(LightPathProject* project, WatchState* state, PackList* list, BuildManifest* previous) {
+    long long start = monotonic_us();
+    FunctionBlock* build_block = project_block(project, project->root->build_func);
+    ProfileMark phase = profile_begin();
+    if (!run_function_block(project, build_block)) {
+        return 0;
+    }
+    profile_end(phase, "build commands");
+    if (!build_block->has_build) {
+        return 1;
+    }
+    if (!file_exists("source") || !create_directory(STATE_DIR)) {
+        printf("The source directory is not found, Error!\n");
+        return 0;
+    }
+
+    // Lo que escribieron los comandos de build entra ya en esta compilación
+    update_watched_source(state, list);
+    if (!build_apps(project, list, state->build_path_hash, state->runtime_hash, previous)) {
+        return 0;
+    }
+    printf("lightpath_app rebuilt in %lld ms (%zu of %zu entries reused)\n",
+           (monotonic_us() - start) / 1000, previous->reused_count, previous->count);
+    return 1;
+}
+
+// Espera cambios: 1 si source/ cambió o build.path se volvió a cargar, 0 si no, -1 si falla
+static int wait_for_watch_changes(LightPathProject* project, WatchState* state, PackList* list, int* reloaded) {
+    struct pollfd pfd = {state->fd, POLLIN, 0};
+    if (poll(&pfd, 1, -1) < 0) {
+        return errno == EINTR ? 0 : -1;
+    }
+    wait_for_quiet(state);
+    int changed = update_watched_source(state, list);
+    if (!state->build_path_changed) {
+        return changed;
+    }
+
+    // Sólo cuenta si el contenido de build.path es otro
+    state->build_path_changed = 0;
+    char hash[65];
+    if (!sha256_file("build.path", hash) || strcmp(hash, state->build_path_hash) == 0) {
+        return changed;
+    }
+    LightPathProject updated;
+    memset(&updated, 0, sizeof(updated));
+    if (!load_project("build.path", &updated)) {
+        printf("Parse build.path failed, Error!\n");
+        fflush(stdout);
+        free_project(&updated);
+        return changed;
+    }
+    free_project(project);
+    *project = updated;
+    memcpy(state->build_path_hash, hash, sizeof(hash));
+    *reloaded = 1;
+    return 1;
+}
+
+int watch_project(LightPathProject* project, const char* function_name) {
+    if (function_name && !find_function(project, function_name, strlen(function_name))) {
+        printf("\"%s\" Function on build.path is not there! Error!\n", function_name);
+        return 0;
+    }
+    WatchState state;
+    memset(&state, 0, sizeof(state));
+    state.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.fd < 0) {
+        printf("Cannot start inotify, Error!\n");
+        return 0;
+    }
+    // build.path se vigila desde su directorio: muchos editores lo reemplazan con rename
+    state.project_wd = inotify_add_watch(state.fd, ".", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB);
+
+    BuildManifest previous;
+    PackList list = {0};
+    load_build_manifest(STATE_DIR "/manifest", &previous);
+    int ok = state.project_wd >= 0 && sha256_file("build.path", state.build_path_hash) &&
+             sha256_file("/proc/self/exe", state.runtime_hash) && scan_watched_source(&state, &list);
+    if (!ok) {
+        printf("Cannot watch the project, Error!\n");
+    }
+
+    // La primera vuelta es como lightpath sin argumentos; luego una por cada cambio
+    int reloaded = 1, first = 1, changes = 1;
+    while (ok && changes > 0) {
+        FunctionBlock* build_block = project_block(project, project->root->build_func);
+        int unchanged = build_block->has_build
+                            ? strcmp(previous.build_path_hash, state.build_path_hash) == 0 &&
+                                  strcmp(previous.runtime_hash, state.runtime_hash) == 0 &&
+                                  source_tree_unchanged(&list, &previous) && app_is_current(&previous, "lightpath_app")
+                            : !reloaded;
+        if (!unchanged || (reloaded && function_name)) {
+            ProfileMark phase = profile_begin();
+            int built = unchanged || watch_rebuild(project, &state, &list, &previous);
+            if (built && function_name) {
+                // La función puede haber desaparecido al recargar build.path
+                built = run_custom_function(project, function_name);
+            }
+            profile_end(phase, "watch rebuild");
+            write_profile("watch", built ? 0 : 1);
+        }
+        if (first) {
+            printf("Watching source/ and build.path (Ctrl+C to stop)\n");
+            first = 0;
+        }
+        fflush(stdout);
+
+        reloaded = 0;
+        do {
+            changes = wait_for_watch_changes(project, &state, &list, &reloaded);
+        } while (changes == 0);
+    }
+    close(state.fd);
+    free_pack_list(&list);
+    free_build_manifest(&previous);
+    for (int i = 0; i < state.directory_count; i++) {
+        free(state.directories[i]);
+    }
+    free(state.directories);
+    free(state.changes);
+    return 0;
+}
+// lightpath server: build.path ya cargado en un proceso residente. Cada petición
+// llega por .lightpath/server.sock con argv, entorno y los descriptores 0, 1 y 2
+// del cliente (SCM_RIGHTS), y se ejecuta en un fork que escribe directamente en
+// ellos. El cliente sólo espera el código de salida. source/ también se queda
+// recorrido en memoria, así que una compilación sin cambios no lo vuelve a leer.
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static void stop_server(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+// Identidad del ejecutable: un lightpath distinto del servidor no se atiende
+static void lightpath_identity(ServerRequest* request) {
+    struct stat st;
+    if (stat("/proc/self/exe", &st) == 0) {
+        request->exe_device = st.st_dev;
+        request->exe_inode = st.st_ino;
+        request->exe_mtime_ns = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    }
+}
+
+static int read_exact(int fd, void* data, size_t length) {
+    for (size_t done = 0; done < length;) {
+        ssize_t got = read(fd, (char*)data + done, length - done);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return 0;
+        done += got;
+    }
+    return 1;
+}
+
+static int write_exact(int fd, const void* data, size_t length) {
+    for (size_t done = 0; done < length;) {
+        ssize_t written = write(fd, (const char*)data + done, length - done);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        done += written;
+    }
+    return 1;
+}
+
+// Cliente: devuelve el código de salida, o -1 si no hay servidor (o no acepta
+// la petición) y hay que ejecutarla en este proceso
+int forward_to_server(int argc, char* argv[]) {
+    const char* disabled = getenv("LIGHTPATH_NO_SERVER");
+    if (disabled && *disabled && strcmp(disabled, "0") != 0) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", SERVER_SOCKET);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    ServerRequest request;
+    memset(&request, 0, sizeof(request));
+    memcpy(request.magic, SERVER_MAGIC, sizeof(request.magic));
+    lightpath_identity(&request);
+    ByteBuffer strings = {0};
+    for (int i = 1; i < argc; i++) {
+        buffer_append(&strings, argv[i], strlen(argv[i]) + 1);
+    }
+    for (char** variable = environ; *variable; variable++, request.env_count++) {
+        buffer_append(&strings, *variable, strlen(*variable) + 1);
+    }
+    request.arg_count = argc - 1;
+    request.file_mask = umask(022);
+    umask(request.file_mask);
+    request.length = strings.size;
+
+    // La cabecera viaja con stdin, stdout y stderr
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = {&request, sizeof(request)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(header), fds, sizeof(fds));
+    fflush(stdout);
+    int32_t status = SERVER_REFUSED;
+    int sent = sendmsg(fd, &message, MSG_NOSIGNAL) == (ssize_t)sizeof(request) &&
+               write_exact(fd, strings.data, strings.size);
+    buffer_free(&strings);
+    if (!sent) {
+        close(fd);
+        return -1;
+    }
+    if (!read_exact(fd, &status, sizeof(status))) {
+        printf("The lightpath server stopped during the request, Error!\n");
+        status = 1;
+    }
+    close(fd);
+    return status;
+}
+
+// Petición en curso: el ejecutor cierra exit_fd (su extremo) al terminar
+typedef struct {
+    pid_t runner;
+    int client;
+    int exit_fd;
+    int killed;
+} ServerJob;
+
+// Lee la petición: cabecera con los descriptores, y luego argv (words[1..]) y el entorno
+static int receive_request(int client, ServerRequest* request, int fds[3], char** strings, char*** words) {
+    char control[CMSG_SPACE(sizeof(int) * 3)];
+    struct iovec vector = {request, sizeof(*request)};
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &vector;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    ssize_t got = recvmsg(client, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    struct cmsghdr* header = got == (ssize_t)sizeof(*request) ? CMSG_FIRSTHDR(&message) : NULL;
+    if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS &&
+        header->cmsg_len == CMSG_LEN(sizeof(int) * 3)) {
+        memcpy(fds, CMSG_DATA(header), sizeof(int) * 3);
+    }
+    if (fds[2] < 0 || memcmp(request->magic, SERVER_MAGIC, sizeof(request->magic)) != 0 ||
+        request->length > SERVER_MAX_REQUEST || request->arg_count > request->length ||
+        request->env_count > request->length) {
+        return 0;
+    }
+    *strings = checked_realloc(NULL, request->length + 1);
+    if (!read_exact(client, *strings, request->length) ||
+        (request->length > 0 && (*strings)[request->length - 1] != '\0')) {
+        return 0;
+    }
+    *words = checked_realloc(NULL, sizeof(char*) * (request->arg_count + request->env_count + 2));
+    (*words)[0] = "lightpath";
+    size_t position = 0;
+    for (uint32_t i = 1; i <= request->arg_count + request->env_count; i++) {
+        if (position >= request->length) return 0;
+        (*words)[i] = *strings + position;
+        position += strlen(*strings + position) + 1;
+    }
+    return 1;
+}
+
+// Ejecutor: un fork del servidor (build.path ya cargado) con los descriptores,
+// el entorno y la umask del cliente, en su propio grupo de procesos
+static void run_server_request(LightPathProject* project, const ServerRequest* request, int fds[3], char** words) {
+    setpgid(0, 0);
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    for (int i = 0; i < 3; i++) {
+        dup2(fds[i], i);
+        if (fds[i] > 2) close(fds[i]);
+    }
+    clearenv();
+    for (uint32_t i = 1; i <= request->env_count; i++) {
+        putenv(words[request->arg_count + i]);
+    }
+    umask(request->file_mask);
+
+    char** arguments = checked_realloc(NULL, sizeof(char*) * (request->arg_count + 1));
+    int argument_count = 0;
+    if (!parse_arguments(request->arg_count + 1, words, arguments, &argument_count)) {
+        exit(1);
+    }
+    profile_origin_us = monotonic_us();
+    exit(run_request(project, arguments, argument_count, profile_begin()));
+}
+
+static void finish_server_job(ServerJob* job) {
+    int wait_status = 0;
+    while (waitpid(job->runner, &wait_status, 0) < 0 && errno == EINTR) {
+    }
+    int32_t status = WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status);
+    write_exact(job->client, &status, sizeof(status));
+    close(job->client);
+    close(job->exit_fd);
+}
+
+static int same_file_state(const struct stat* a, const struct stat* b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// source/ se mantiene recorrido con inotify, como en lightpath watch; si el
+// directorio se borró o se sustituyó se recorre otra vez
+static void refresh_server_source(WatchState* state, PackList* list, struct stat* source_stat) {
+    struct stat st;
+    int exists = stat("source", &st) == 0 && S_ISDIR(st.st_mode);
+    if (exists && server_source && st.st_dev == source_stat->st_dev && st.st_ino == source_stat->st_ino) {
+        update_watched_source(state, list);
+        return;
+    }
+    server_source = NULL;
+    if (exists && server_watch && scan_watched_source(state, list)) {
+        *source_stat = st;
+        server_source = list;
+    }
+}
+
+int serve_project(LightPathProject* project) {
+    if (!create_directory(STATE_DIR)) {
+        return 0;
+    }
+    int lock_fd = open(SERVER_LOCK, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX | LOCK_NB) != 0) {
+        printf("A lightpath server is already running in this directory, Error!\n");
+        if (lock_fd >= 0) close(lock_fd);
+        return 0;
+    }
+    // Sólo el mismo usuario puede conectarse (se le entregan descriptores y entorno)
+    unlink(SERVER_SOCKET);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", SERVER_SOCKET);
+    mode_t old_mask = umask(077);
+    int bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) == 0 &&
+                listen(listen_fd, 128) == 0;
+    umask(old_mask);
+    if (!bound) {
+        printf("Cannot listen on %s, Error!\n", SERVER_SOCKET);
+        if (listen_fd >= 0) close(listen_fd);
+        close(lock_fd);
+        return 0;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_server;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    ServerRequest identity;
+    memset(&identity, 0, sizeof(identity));
+    lightpath_identity(&identity);
+    struct stat loaded_stat, current_stat, source_stat;
+    int project_loaded = stat("build.path", &loaded_stat) == 0;
+    WatchState state;
+    PackList list = {0};
+    memset(&state, 0, sizeof(state));
+    state.project_wd = -1;
+    state.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (state.fd >= 0 && sha256_file("/proc/self/exe", state.runtime_hash)) {
+        server_watch = &state;
+    }
+    refresh_server_source(&state, &list, &source_stat);
+    printf("Serving build.path on %s (Ctrl+C to stop)\n", SERVER_SOCKET);
+    fflush(stdout);
+
+    ServerJob* jobs = NULL;
+    struct pollfd* watched = NULL;
+    size_t job_count = 0, job_capacity = 0;
+    while (!server_stopping) {
+        // Socket de escucha, inotify, y por cada petición el fin del ejecutor y el cliente
+        if (job_capacity < job_count + 1) {
+            job_capacity = job_capacity ? job_capacity * 2 : 16;
+            jobs = checked_realloc(jobs, sizeof(ServerJob) * job_capacity);
+            watched = checked_realloc(watched, sizeof(struct pollfd) * (job_capacity * 2 + 2));
+        }
+        watched[0].fd = listen_fd;
+        watched[0].events = POLLIN;
+        watched[1].fd = server_source ? state.fd : -1;
+        watched[1].events = POLLIN;
+        for (size_t i = 0; i < job_count; i++) {
+            watched[2 + i * 2].fd = jobs[i].exit_fd;
+            watched[2 + i * 2].events = POLLIN;
+            watched[3 + i * 2].fd = jobs[i].killed ? -1 : jobs[i].client;
+            watched[3 + i * 2].events = POLLIN;
         }
-        
-        // 2. Generar código C del runtime
-        if (!generate_runtime_c_code(project)) {
-            return 0;
+        if (poll(watched, 2 + job_count * 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            printf("Cannot wait on %s, Error!\n", SERVER_SOCKET);
+            break;
         }
-        
-        // 3. Convertir ZIP a código objeto
-        if (!convert_zip_to_object()) {
-            return 0;
+        if (watched[1].revents) {
+            refresh_server_source(&state, &list, &source_stat);
         }
-        
-        // 4. Compilar el binario final
-        char gcc_command[512];
-        snprintf(gcc_command, sizeof(gcc_command), 
-                "gcc -o lightpath_app lightpath_runtime.c source_data.c >/dev/null 2>&1");
-        
-        if (system(gcc_command) != 0) {
-            printf("Binary compilation failed, Error!\n");
-            return 0;
+        for (size_t i = job_count; i-- > 0;) {
+            if (watched[2 + i * 2].revents) {
+                finish_server_job(&jobs[i]);
+                jobs[i] = jobs[--job_count];
+            } else if (watched[3 + i * 2].revents) {
+                // El cliente ya no espera (Ctrl+C): terminar su grupo
+                kill(-jobs[i].runner, SIGTERM);
+                jobs[i].killed = 1;
+            }
+        }
+        if (!watched[0].revents) {
+            continue;
+        }
+
+        int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (client < 0) {
+            continue;
+        }
+        struct ucred peer;
+        socklen_t peer_length = sizeof(peer);
+        struct timeval timeout = {2, 0};
+        if (getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &peer_length) != 0 || peer.uid != getuid() ||
+            setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0) {
+            close(client);
+            continue;
+        }
+        // build.path cambió: volver a cargarlo antes de atender
+        if (stat("build.path", &current_stat) != 0 || !project_loaded || !same_file_state(&current_stat, &loaded_stat)) {
+            LightPathProject fresh;
+            if (project_loaded) {
+                free_project(project);
+            }
+            project_loaded = load_project("build.path", &fresh);
+            if (project_loaded) {
+                *project = fresh;
+                loaded_stat = current_stat;
+            }
+        }
+
+        ServerRequest request;
+        int fds[3] = {-1, -1, -1};
+        char* strings = NULL;
+        char** words = NULL;
+        int exit_pipe[2] = {-1, -1};
+        pid_t runner = -1;
+        // Otro ejecutable de lightpath o build.path con errores: el cliente lo hace por su cuenta
+        if (receive_request(client, &request, fds, &strings, &words) && project_loaded &&
+            request.exe_device == identity.exe_device && request.exe_inode == identity.exe_inode &&
+            request.exe_mtime_ns == identity.exe_mtime_ns && pipe2(exit_pipe, O_CLOEXEC) == 0) {
+            // Lo que cambió justo antes de la petición ya está en la cola de inotify
+            refresh_server_source(&state, &list, &source_stat);
+            fflush(stdout);
+            runner = fork();
+            if (runner == 0) {
+                close(listen_fd);
+                close(lock_fd);
+                close(client);
+                close(exit_pipe[0]);
+                if (state.fd >= 0) close(state.fd);
+                for (size_t i = 0; i < job_count; i++) {
+                    close(jobs[i].client);
+                    close(jobs[i].exit_fd);
+                }
+                run_server_request(project, &request, fds, words);
+            }
+            close(exit_pipe[1]);
+        }
+        for (int i = 0; i < 3; i++) {
+            if (fds[i] >= 0) close(fds[i]);
+        }
+        free(strings);
+        free(words);
+        if (runner > 0) {
+            ServerJob job = {runner, client, exit_pipe[0], 0};
+            jobs[job_count++] = job;
+        } else {
+            int32_t refused = SERVER_REFUSED;
+            write_exact(client, &refused, sizeof(refused));
+            close(client);
+            if (exit_pipe[0] >= 0) close(exit_pipe[0]);
         }
-        
-        // 5. Limpiar archivos temporales
-        system("rm -f source_packed.zip lightpath_runtime.c source_data.c 2>/dev/null");
     }
-    
+    // Las peticiones en curso se terminan; sus clientes reciben el código de salida
+    for (size_t i = 0; i < job_count; i++) {
+        kill(-jobs[i].runner, SIGTERM);
+        finish_server_job(&jobs[i]);
+    }
+    free(jobs);
+    free(watched);
+    server_watch = NULL;
+    server_source = NULL;
+    if (state.fd >= 0) close(state.fd);
+    free_pack_list(&list);
+    for (int i = 0; i < state.directory_count; i++) {
+        free(state.directories[i]);
+    }
+    free(state.directories);
+    for (size_t c = 0; c < state.change_count; c++) {
+        free(state.changes[c]);
+    }
+    free(state.changes);
+
+    unlink(SERVER_SOCKET);
+    close(listen_fd);
+    close(lock_fd);
+    printf("Server stopped\n");
     return 1;
 }
 
-int run_custom_function(LightPathProject* project, const char* func_name) {
-    for (int i = 0; i < project->custom_func_count; i++) {
-        if (strcmp(project->custom_func_names[i], func_name) == 0) {
-            FunctionBlock* func = &project->custom_funcs[i];
-            for (int j = 0; j < func->command_count; j++) {
-                Command* cmd = &func->commands[j];
-                
-                // Cambiar directorio según path_mode
-                if (strcmp(cmd->path_mode_at_time, "current") == 0) {
-                    // Ejecutar en directorio actual
-                    execute_command(cmd->command);
-                } else {
-                    // Ejecutar en directorio de aplicación (simulado)
-                    execute_command(cmd->command);
+// lightpath diff / apply: parches entre dos lightpath_app a nivel de entradas
+// del payload (un archivo sin cambios se copia del binario viejo)
+
+// Abre un lightpath_app y comprueba su pie con el mismo criterio que el runtime
+static int map_app_image(const char* path, AppImage* app) {
+    memset(app, 0, sizeof(*app));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Cannot open %s, Error!\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    app->size = st.st_size;
+    if (app->size < sizeof(AppFooter) ||
+        pread(fd, &app->footer, sizeof(AppFooter), app->size - sizeof(AppFooter)) != (ssize_t)sizeof(AppFooter) ||
+        memcmp(app->footer.magic, APP_MAGIC, sizeof(app->footer.magic)) != 0) {
+        fprintf(stderr, "%s is not a lightpath_app, Error!\n", path);
+        close(fd);
+        return 0;
+    }
+    app->data = mmap(NULL, app->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    size_t limit = app->size - sizeof(AppFooter);
+    const AppFooter* footer = &app->footer;
+    if (app->data == MAP_FAILED || footer->payload_offset > limit ||
+        footer->payload_size > limit - footer->payload_offset || footer->table_offset > limit ||
+        footer->table_size > limit - footer->table_offset) {
+        if (app->data != MAP_FAILED) munmap(app->data, app->size);
+        app->data = NULL;
+        fprintf(stderr, "%s is damaged, Error!\n", path);
+        return 0;
+    }
+    return 1;
+}
+
+static void unmap_app_image(AppImage* app) {
+    if (app->data) {
+        munmap(app->data, app->size);
+        app->data = NULL;
+    }
+}
+
+// Operaciones pendientes: las copias contiguas y los datos seguidos se unen
+typedef struct {
+    FILE* out;
+    const unsigned char* image;    // binario nuevo
+    PatchOp pending;               // kind == PATCH_END: nada pendiente
+    uint64_t data_start;           // PATCH_DATA pendiente: desde aquí en image
+    unsigned long long copied;
+    unsigned long long stored;
+    int failed;
+} PatchWriter;
+
+static void write_patch_op(PatchWriter* writer, const PatchOp* op, const void* data) {
+    if (fwrite(op, sizeof(*op), 1, writer->out) != 1 ||
+        (op->stored_length && (!data || fwrite(data, 1, op->stored_length, writer->out) != op->stored_length))) {
+        writer->failed = 1;
+    }
+    writer->stored += sizeof(*op) + op->stored_length;
+}
+
+static void flush_patch_op(PatchWriter* writer) {
+    PatchOp op = writer->pending;
+    writer->pending.kind = PATCH_END;
+    if (op.kind == PATCH_COPY) {
+        write_patch_op(writer, &op, NULL);
+        writer->copied += op.length;
+    } else if (op.kind == PATCH_DATA) {
+        // Por trozos: apply nunca necesita más de PACK_CHUNK_SIZE en memoria
+        for (uint64_t done = 0; done < op.length;) {
+            const unsigned char* data = writer->image + writer->data_start + done;
+            PatchOp chunk = {PATCH_DATA, 0, 0, op.length - done, 0};
+            if (chunk.length > PACK_CHUNK_SIZE) chunk.length = PACK_CHUNK_SIZE;
+            ByteBuffer packed = {0};
+            if (deflate_compress(data, chunk.length, 6, &packed) && packed.size < chunk.length) {
+                chunk.kind = PATCH_DEFLATE;
+                chunk.stored_length = packed.size;
+                write_patch_op(writer, &chunk, packed.data);
+            } else {
+                chunk.stored_length = chunk.length;
+                write_patch_op(writer, &chunk, data);
+            }
+            buffer_free(&packed);
+            done += chunk.length;
+        }
+    }
+}
+
+static void patch_copy(PatchWriter* writer, uint64_t old_offset, uint64_t length) {
+    if (!length) return;
+    if (writer->pending.kind == PATCH_COPY && writer->pending.offset + writer->pending.length == old_offset) {
+        writer->pending.length += length;
+        return;
+    }
+    flush_patch_op(writer);
+    PatchOp op = {PATCH_COPY, 0, old_offset, length, 0};
+    writer->pending = op;
+}
+
+static void patch_data(PatchWriter* writer, uint64_t new_offset, uint64_t length) {
+    if (!length) return;
+    if (writer->pending.kind == PATCH_DATA && writer->data_start + writer->pending.length == new_offset) {
+        writer->pending.length += length;
+        return;
+    }
+    flush_patch_op(writer);
+    PatchOp op = {PATCH_DATA, 0, 0, length, 0};
+    writer->pending = op;
+    writer->data_start = new_offset;
+}
+
+static int compare_lp_entry_names(const void* a, const void* b) {
+    return strcmp((*(const lp_entry* const*)a)->path, (*(const lp_entry* const*)b)->path);
+}
+
+static int compare_lp_entry_sizes(const void* a, const void* b) {
+    size_t x = (*(const lp_entry* const*)a)->compressed_size, y = (*(const lp_entry* const*)b)->compressed_size;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_lp_entry_offsets(const void* a, const void* b) {
+    size_t x = ((const lp_entry*)a)->local, y = ((const lp_entry*)b)->local;
+    return x < y ? -1 : x > y;
+}
+
+// Entrada del binario viejo con el mismo nombre (names ordenado por ruta)
+static const lp_entry* find_old_entry(const lp_entry** names, size_t count, const char* path) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        int order = strcmp(names[middle]->path, path);
+        if (order == 0) return names[middle];
+        if (order < 0) low = middle + 1; else high = middle;
+    }
+    return NULL;
+}
+
+// Mismos datos comprimidos bajo otro nombre (archivo movido o renombrado)
+static const lp_entry* find_old_data(const lp_entry** sizes, size_t count, const lp_entry* entry) {
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (sizes[middle]->compressed_size < entry->compressed_size) low = middle + 1; else high = middle;
+    }
+    for (size_t i = low, tries = 0; i < count && tries < 16; i++, tries++) {
+        if (sizes[i]->compressed_size != entry->compressed_size) break;
+        if (memcmp(sizes[i]->data, entry->data, entry->compressed_size) == 0) return sizes[i];
+    }
+    return NULL;
+}
+
+static void hash_image(const unsigned char* data, size_t length, unsigned char digest[32]) {
+    Sha256 ctx;
+    sha256_init(&ctx);
+    sha256_update(&ctx, data, length);
+    sha256_final(&ctx, digest);
+}
+
+// lightpath diff OLD NEW > PATCH
+int diff_apps(const char* old_path, const char* new_path) {
+    if (isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "Redirect the patch to a file (lightpath diff old new > patch), Error!\n");
+        return 0;
+    }
+    AppImage old_app, new_app;
+    if (!map_app_image(old_path, &old_app)) {
+        return 0;
+    }
+    if (!map_app_image(new_path, &new_app)) {
+        unmap_app_image(&old_app);
+        return 0;
+    }
+    const unsigned char* old_payload = old_app.data + old_app.footer.payload_offset;
+    const unsigned char* new_payload = new_app.data + new_app.footer.payload_offset;
+    lp_entry *old_entries = NULL, *new_entries = NULL;
+    size_t old_count = 0, new_count = 0;
+    if (!lp_read_index(old_payload, old_app.footer.payload_size, &old_entries, &old_count) ||
+        !lp_read_index(new_payload, new_app.footer.payload_size, &new_entries, &new_count)) {
+        fprintf(stderr, "Cannot read the payload of %s, Error!\n", old_entries ? new_path : old_path);
+        if (old_entries) lp_free_index(old_entries, old_count);
+        unmap_app_image(&old_app);
+        unmap_app_image(&new_app);
+        return 0;
+    }
+
+    PatchHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PATCH_MAGIC, sizeof(header.magic));
+    header.old_size = old_app.size;
+    header.new_size = new_app.size;
+    hash_image(old_app.data, old_app.size, header.old_hash);
+    hash_image(new_app.data, new_app.size, header.new_hash);
+    PatchWriter writer = {stdout, new_app.data, {PATCH_END, 0, 0, 0, 0}, 0, 0, 0, 0};
+    writer.failed = fwrite(&header, sizeof(header), 1, stdout) != 1;
+
+    const lp_entry** names = checked_realloc(NULL, sizeof(lp_entry*) * (old_count + 1));
+    const lp_entry** sizes = checked_realloc(NULL, sizeof(lp_entry*) * (old_count + 1));
+    for (size_t i = 0; i < old_count; i++) {
+        names[i] = sizes[i] = &old_entries[i];
+    }
+    qsort(names, old_count, sizeof(lp_entry*), compare_lp_entry_names);
+    qsort(sizes, old_count, sizeof(lp_entry*), compare_lp_entry_sizes);
+    qsort(new_entries, new_count, sizeof(lp_entry), compare_lp_entry_offsets);
+
+    // El stub (el ejecutable de lightpath) sólo cambia con otra versión
+    uint64_t position = new_app.footer.payload_offset;
+    if (old_app.footer.payload_offset == position && memcmp(old_app.data, new_app.data, position) == 0) {
+        patch_copy(&writer, 0, position);
+    } else {
+        patch_data(&writer, 0, position);
+    }
+    size_t changed = 0;
+    for (size_t i = 0; i < new_count; i++) {
+        const lp_entry* entry = &new_entries[i];
+        uint64_t start = new_app.footer.payload_offset + entry->local;
+        uint64_t data = entry->data - new_app.data;
+        uint64_t end = data + entry->compressed_size;
+        if (start < position) {
+            continue;
+        }
+        patch_data(&writer, position, start - position);
+        position = end;
+
+        const lp_entry* old = find_old_entry(names, old_count, entry->path);
+        uint64_t old_start = old ? old_app.footer.payload_offset + old->local : 0;
+        if (old && (size_t)(old->data - old_app.data) + old->compressed_size - old_start == end - start &&
+            memcmp(old_app.data + old_start, new_app.data + start, end - start) == 0) {
+            patch_copy(&writer, old_start, end - start);
+            continue;
+        }
+        changed++;
+        old = entry->compressed_size >= 64 ? find_old_data(sizes, old_count, entry) : NULL;
+        if (old) {
+            // Cabecera nueva, datos del binario viejo
+            patch_data(&writer, start, data - start);
+            patch_copy(&writer, old->data - old_app.data, entry->compressed_size);
+        } else {
+            patch_data(&writer, start, end - start);
+        }
+    }
+    // Directorio central, tabla de comandos y pie
+    patch_data(&writer, position, new_app.size - position);
+    flush_patch_op(&writer);
+    PatchOp end = {PATCH_END, 0, 0, 0, 0};
+    write_patch_op(&writer, &end, NULL);
+    if (fflush(stdout) != 0) {
+        writer.failed = 1;
+    }
+
+    if (writer.failed) {
+        fprintf(stderr, "Cannot write the patch, Error!\n");
+    } else {
+        fprintf(stderr, "%zu of %zu entries changed: patch of %llu bytes, %llu bytes reused from %s\n", changed,
+                new_count, writer.stored + (unsigned long long)sizeof(header), writer.copied, old_path);
+    }
+    free(names);
+    free(sizes);
+    lp_free_index(old_entries, old_count);
+    lp_free_index(new_entries, new_count);
+    unmap_app_image(&old_app);
+    unmap_app_image(&new_app);
+    return !writer.failed;
+}
+
+static int write_patch_bytes(int fd, const unsigned char* data, uint64_t length, Sha256* ctx) {
+    sha256_update(ctx, data, length);
+    while (length > 0) {
+        ssize_t written = write(fd, data, length > (1 << 30) ? (1 << 30) : length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return 0;
+        data += written;
+        length -= written;
+    }
+    return 1;
+}
+
+// lightpath apply OLD PATCH [NEW]: rehace el binario nuevo y comprueba su hash
+int apply_patch(const char* old_path, const char* patch_path, const char* new_path) {
+    FILE* patch = strcmp(patch_path, "-") == 0 ? stdin : fopen(patch_path, "rb");
+    if (!patch) {
+        printf("Cannot open %s, Error!\n", patch_path);
+        return 0;
+    }
+    PatchHeader header;
+    if (fread(&header, sizeof(header), 1, patch) != 1 || memcmp(header.magic, PATCH_MAGIC, sizeof(header.magic)) != 0) {
+        printf("%s is not a lightpath patch, Error!\n", patch_path);
+        if (patch != stdin) fclose(patch);
+        return 0;
+    }
+
+    int old_fd = open(old_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    unsigned char* old_data = MAP_FAILED;
+    if (old_fd >= 0 && fstat(old_fd, &st) == 0 && (uint64_t)st.st_size == header.old_size && st.st_size > 0) {
+        old_data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, old_fd, 0);
+    }
+    if (old_fd >= 0) close(old_fd);
+    unsigned char digest[32];
+    if (old_data != MAP_FAILED) {
+        hash_image(old_data, st.st_size, digest);
+    }
+    if (old_data == MAP_FAILED || memcmp(digest, header.old_hash, 32) != 0) {
+        printf("%s is not the binary this patch was made from, Error!\n", old_path);
+        if (old_data != MAP_FAILED) munmap(old_data, st.st_size);
+        if (patch != stdin) fclose(patch);
+        return 0;
+    }
+
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", new_path);
+    int out = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755);
+    Sha256 ctx;
+    sha256_init(&ctx);
+    uint64_t written = 0;
+    unsigned long long copied = 0;
+    int ok = out >= 0, finished = 0;
+    unsigned char* stored = checked_realloc(NULL, PACK_CHUNK_SIZE);
+    unsigned char* unpacked = checked_realloc(NULL, PACK_CHUNK_SIZE);
+    while (ok && !finished) {
+        PatchOp op;
+        if (fread(&op, sizeof(op), 1, patch) != 1) {
+            ok = 0;
+        } else if (op.kind == PATCH_END) {
+            finished = 1;
+        } else if (op.kind == PATCH_COPY) {
+            ok = op.offset <= header.old_size && op.length <= header.old_size - op.offset &&
+                 write_patch_bytes(out, old_data + op.offset, op.length, &ctx);
+            copied += op.length;
+        } else if ((op.kind == PATCH_DATA || op.kind == PATCH_DEFLATE) && op.length <= PACK_CHUNK_SIZE &&
+                   op.stored_length <= PACK_CHUNK_SIZE && (op.kind == PATCH_DEFLATE || op.stored_length == op.length)) {
+            ok = fread(stored, 1, op.stored_length, patch) == op.stored_length;
+            if (ok && op.kind == PATCH_DEFLATE) {
+                ok = lp_inflate(stored, op.stored_length, unpacked, op.length) &&
+                     write_patch_bytes(out, unpacked, op.length, &ctx);
+            } else if (ok) {
+                ok = write_patch_bytes(out, stored, op.length, &ctx);
+            }
+        } else {
+            ok = 0;
+        }
+        written += ok && !finished ? op.length : 0;
+    }
+    free(stored);
+    free(unpacked);
+    munmap(old_data, st.st_size);
+    if (patch != stdin) fclose(patch);
+
+    sha256_final(&ctx, digest);
+    if (!ok || written != header.new_size || memcmp(digest, header.new_hash, 32) != 0) {
+        printf("The patch %s is damaged or incomplete, Error!\n", patch_path);
+        ok = 0;
+    } else {
+        // Los mismos permisos que el binario viejo
+        ok = fchmod(out, st.st_mode & 07777) == 0;
+        ok = close(out) == 0 && ok;
+        out = -1;
+        if (!ok || rename(temp_path, new_path) != 0) {
+            printf("Cannot create %s, Error!\n", new_path);
+            ok = 0;
+        }
+    }
+    if (out >= 0) close(out);
+    if (!ok) {
+        unlink(temp_path);
+        return 0;
+    }
+    printf("%s patched: %llu bytes reused, %llu bytes from the patch\n", new_path, copied,
+           (unsigned long long)(header.new_size - copied));
+    return 1;
+}
+
+// lightpath inspect: contenido de un lightpath_app (o de source_packed.zip) sin extraerlo
+
+typedef struct {
+    const char* path;          // directorio (sin "/" final) o entrada
+    size_t length;             // longitud significativa de path
+    int kind;                  // INSPECT_FILE, INSPECT_DIRECTORY, INSPECT_SYMLINK, INSPECT_DUPLICATE
+    const lp_entry* entry;
+    unsigned long long raw;
+    unsigned long long compressed;
+    unsigned long long cost_us;
+    size_t files;
+    int hot;
+} InspectItem;
+
+#define INSPECT_FILE 0
+#define INSPECT_DIRECTORY 1
+#define INSPECT_SYMLINK 2
+#define INSPECT_DUPLICATE 3
+#define INSPECT_TOP 20
+
+static const char* const inspect_kinds[] = {"file", "directory", "symlink", "duplicate"};
+
+static const char* method_name(int method) {
+    switch (method) {
+        case METHOD_STORED: return "stored";
+        case METHOD_DEFLATE: return "deflate";
+        case METHOD_FAST: return "fast";
+        case METHOD_MAX: return "max";
+        default: return "unknown";
+    }
+}
+
+// Coste estimado de extraer una entrada en un núcleo: crear el archivo,
+// descomprimir y escribir. Es un modelo fijo (no mide esta máquina) para que
+// el informe de dos compilaciones se pueda comparar, por ejemplo en CI.
+static unsigned long long estimate_extract_us(const lp_entry* entry, int kind) {
+    if (kind == INSPECT_DIRECTORY) return INSPECT_DIRECTORY_US;
+    if (kind != INSPECT_FILE) return INSPECT_LINK_US;
+    unsigned long long decode_mbs = entry->method == METHOD_DEFLATE ? INSPECT_DEFLATE_MBS
+                                    : entry->method == METHOD_FAST  ? INSPECT_FAST_MBS
+                                    : entry->method == METHOD_MAX   ? INSPECT_MAX_MBS
+                                                                    : 0;
+    // 1 MB/s = 1 byte por microsegundo
+    return INSPECT_FILE_US + entry->size / INSPECT_WRITE_MBS + (decode_mbs ? entry->size / decode_mbs : 0);
+}
+
+static int compare_inspect_paths(const void* a, const void* b) {
+    const InspectItem* x = a;
+    const InspectItem* y = b;
+    size_t length = x->length < y->length ? x->length : y->length;
+    int order = memcmp(x->path, y->path, length);
+    return order ? order : (x->length > y->length) - (x->length < y->length);
+}
+
+static int compare_inspect_sizes(const void* a, const void* b) {
+    const InspectItem* x = a;
+    const InspectItem* y = b;
+    if (x->compressed != y->compressed) return x->compressed < y->compressed ? 1 : -1;
+    return compare_inspect_paths(a, b);
+}
+
+static void write_json_path(FILE* file, const InspectItem* item) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%.*s", (int)item->length, item->path);
+    write_json_string(file, path);
+}
+
+// lightpath inspect [FILE] [--json]
+int inspect_app(const char* path, int json) {
+    if (!path) {
+        path = file_exists("lightpath_app") ? "lightpath_app" : STATE_DIR "/source_packed.zip";
+    }
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        printf("Cannot open %s, Error!\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    close(fd);
+
+    // Un lightpath_app, o el archivo ZIP solo (sin stub ni tabla de comandos)
+    AppImage app;
+    int is_app = 0;
+    AppFooter footer;
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0 && (size_t)st.st_size > sizeof(footer) &&
+        pread(fd, &footer, sizeof(footer), st.st_size - sizeof(footer)) == (ssize_t)sizeof(footer) &&
+        memcmp(footer.magic, APP_MAGIC, sizeof(footer.magic)) == 0) {
+        is_app = 1;
+    }
+    if (fd >= 0) close(fd);
+    if (is_app) {
+        if (!map_app_image(path, &app)) return 0;
+    } else {
+        memset(&app, 0, sizeof(app));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        app.size = st.st_size;
+        app.data = fd >= 0 ? mmap(NULL, app.size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        if (fd >= 0) close(fd);
+        if (app.data == MAP_FAILED) {
+            printf("Cannot open %s, Error!\n", path);
+            return 0;
+        }
+        app.footer.payload_size = app.size;
+    }
+    const unsigned char* payload = app.data + app.footer.payload_offset;
+    lp_entry* entries;
+    size_t count;
+    if (!lp_read_index(payload, app.footer.payload_size, &entries, &count)) {
+        printf("%s is not a lightpath_app or a lightpath archive, Error!\n", path);
+        unmap_app_image(&app);
+        return 0;
+    }
+
+    // Tabla de comandos (con las mismas comprobaciones que el runtime)
+    const unsigned char* table = app.data + app.footer.table_offset;
+    const AppTableHeader* header = is_app && app.footer.table_size >= sizeof(AppTableHeader)
+                                       ? (const AppTableHeader*)table : NULL;
+    const AppCommand** commands = checked_realloc(NULL, sizeof(AppCommand*) * ((header ? header->command_count : 0) + 1));
+    size_t offset = sizeof(AppTableHeader);
+    uint32_t command_count = 0;
+    for (uint32_t i = 0; header && i < header->command_count; i++, command_count++) {
+        const AppCommand* command = (const AppCommand*)(table + offset);
+        if (offset + sizeof(AppCommand) > app.footer.table_size || command->argc == 0 ||
+            command->length > app.footer.table_size - offset - sizeof(AppCommand) || command->length == 0 ||
+            ((const char*)(command + 1))[command->length - 1] != '\0') {
+            break;
+        }
+        commands[i] = command;
+        offset += sizeof(AppCommand) + command->length;
+    }
+    const char** hot = checked_realloc(NULL, sizeof(char*) * ((header ? header->hot_count : 0) + 1));
+    size_t hot_count = 0;
+    for (size_t position = 0; header && command_count == header->command_count && hot_count < header->hot_count &&
+                              header->hot_size <= app.footer.table_size - offset && position < header->hot_size;) {
+        const char* name = (const char*)table + offset + position;
+        const char* end = memchr(name, '\0', header->hot_size - position);
+        if (!end) break;
+        hot[hot_count++] = name;
+        position += end - name + 1;
+    }
+
+    // Entradas y, por cada archivo, su aportación a todos sus directorios
+    InspectItem* items = checked_realloc(NULL, sizeof(InspectItem) * (count + 1));
+    size_t directory_capacity = 64, directory_count = 0;
+    InspectItem* directories = checked_realloc(NULL, sizeof(InspectItem) * directory_capacity);
+    unsigned long long totals[4] = {0}, raw = 0, compressed = 0, cost = 0, hot_cost = 0, largest = 0;
+    for (size_t i = 0; i < count; i++) {
+        const lp_entry* entry = &entries[i];
+        size_t length = strlen(entry->path);
+        InspectItem* item = &items[i];
+        memset(item, 0, sizeof(*item));
+        item->path = entry->path;
+        item->length = length;
+        item->entry = entry;
+        item->kind = entry->link ? INSPECT_DUPLICATE : S_ISLNK(entry->mode) ? INSPECT_SYMLINK
+                     : length && entry->path[length - 1] == '/' ? INSPECT_DIRECTORY : INSPECT_FILE;
+        if (item->kind == INSPECT_DIRECTORY) item->length--;
+        item->raw = item->kind == INSPECT_FILE ? entry->size : 0;
+        item->compressed = entry->compressed_size;
+        item->cost_us = estimate_extract_us(entry, item->kind);
+        item->files = item->kind != INSPECT_DIRECTORY;
+        item->hot = lp_is_hot(hot, hot_count, entry->path);
+        totals[item->kind]++;
+        raw += item->raw;
+        compressed += item->compressed;
+        cost += item->cost_us;
+        if (item->kind == INSPECT_DIRECTORY || item->kind == INSPECT_SYMLINK || item->hot) hot_cost += item->cost_us;
+        if (item->cost_us > largest) largest = item->cost_us;
+        for (const char* slash = strchr(entry->path, '/'); slash && (size_t)(slash - entry->path) < item->length;
+             slash = strchr(slash + 1, '/')) {
+            if (directory_count == directory_capacity) {
+                directory_capacity *= 2;
+                directories = checked_realloc(directories, sizeof(InspectItem) * directory_capacity);
+            }
+            InspectItem* directory = &directories[directory_count++];
+            *directory = *item;
+            directory->length = slash - entry->path;
+            directory->kind = INSPECT_DIRECTORY;
+        }
+    }
+    // Sumar las aportaciones de cada directorio
+    qsort(directories, directory_count, sizeof(InspectItem), compare_inspect_paths);
+    size_t merged = 0;
+    for (size_t i = 0; i < directory_count; i++) {
+        if (merged && compare_inspect_paths(&directories[merged - 1], &directories[i]) == 0) {
+            directories[merged - 1].raw += directories[i].raw;
+            directories[merged - 1].compressed += directories[i].compressed;
+            directories[merged - 1].cost_us += directories[i].cost_us;
+            directories[merged - 1].files += directories[i].files;
+        } else {
+            directories[merged++] = directories[i];
+        }
+    }
+    directory_count = merged;
+    qsort(directories, directory_count, sizeof(InspectItem), compare_inspect_sizes);
+    qsort(items, count, sizeof(InspectItem), compare_inspect_sizes);
+    const char* codec = header && header->codec < sizeof(codec_names) / sizeof(codec_names[0])
+                            ? codec_names[header->codec] : NULL;
+
+    if (json) {
+        printf("{\n  \"file\": ");
+        write_json_string(stdout, path);
+        printf(",\n  \"size\": %zu,\n  \"lightpath_app\": %s", app.size, is_app ? "true" : "false");
+        if (is_app) {
+            printf(",\n  \"stub_bytes\": %llu,\n  \"payload_bytes\": %llu,\n  \"table_bytes\": %llu",
+                   (unsigned long long)app.footer.payload_offset, (unsigned long long)app.footer.payload_size,
+                   (unsigned long long)app.footer.table_size);
+        }
+        if (header) {
+            char hash[sizeof(header->payload_hash) + 1];
+            snprintf(hash, sizeof(hash), "%.*s", (int)sizeof(header->payload_hash), header->payload_hash);
+            printf(",\n  \"codec\": ");
+            write_json_string(stdout, codec ? codec : "unknown");
+            printf(",\n  \"payload_hash\": ");
+            write_json_string(stdout, hash);
+            printf(",\n  \"cache\": %s,\n  \"cache_limit\": %llu,\n  \"hot_files\": %zu,\n  \"commands\": [",
+                   header->cache ? "true" : "false", (unsigned long long)header->cache_limit, hot_count);
+            for (uint32_t i = 0; i < command_count; i++) {
+                const AppCommand* command = commands[i];
+                const char* word = (const char*)(command + 1);
+                printf("%s\n    {\"path_mode\": \"%s\", \"shell\": %s, \"argv\": [", i ? "," : "",
+                       command->in_app_dir ? "application" : "cwd", command->use_shell ? "true" : "false");
+                for (uint32_t a = 0; a < command->argc && word < (const char*)(command + 1) + command->length; a++) {
+                    printf("%s", a ? ", " : "");
+                    write_json_string(stdout, word);
+                    word += strlen(word) + 1;
                 }
+                printf("]}");
             }
-            return 1;
+            printf("%s]", command_count ? "\n  " : "");
+        }
+        printf(",\n  \"totals\": {\"entries\": %zu, \"files\": %llu, \"directories\": %llu, \"symlinks\": %llu, "
+               "\"duplicates\": %llu, \"raw_bytes\": %llu, \"compressed_bytes\": %llu, \"estimated_extract_us\": %llu, "
+               "\"estimated_start_us\": %llu, \"largest_entry_us\": %llu},\n  \"directories\": [",
+               count, totals[INSPECT_FILE], totals[INSPECT_DIRECTORY], totals[INSPECT_SYMLINK],
+               totals[INSPECT_DUPLICATE], raw, compressed, cost, hot_count ? hot_cost : cost, largest);
+        for (size_t i = 0; i < directory_count; i++) {
+            printf("%s\n    {\"path\": ", i ? "," : "");
+            write_json_path(stdout, &directories[i]);
+            printf(", \"entries\": %zu, \"raw_bytes\": %llu, \"compressed_bytes\": %llu, \"estimated_extract_us\": %llu}",
+                   directories[i].files, directories[i].raw, directories[i].compressed, directories[i].cost_us);
+        }
+        printf("%s],\n  \"entries\": [", directory_count ? "\n  " : "");
+        for (size_t i = 0; i < count; i++) {
+            const InspectItem* item = &items[i];
+            printf("%s\n    {\"path\": ", i ? "," : "");
+            write_json_path(stdout, item);
+            printf(", \"type\": \"%s\", \"method\": \"%s\", \"mode\": \"%04o\", \"raw_bytes\": %llu, "
+                   "\"compressed_bytes\": %llu, \"estimated_extract_us\": %llu, \"sparse\": %s, \"hot\": %s",
+                   inspect_kinds[item->kind], method_name(item->entry->method), item->entry->mode & 07777, item->raw,
+                   item->compressed, item->cost_us, item->entry->sparse ? "true" : "false", item->hot ? "true" : "false");
+            if (item->entry->link) {
+                printf(", \"original\": ");
+                write_json_string(stdout, item->entry->link);
+            }
+            printf("}");
+        }
+        printf("%s]\n}\n", count ? "\n  " : "");
+    } else {
+        printf("%s: %zu bytes", path, app.size);
+        if (is_app) {
+            printf(" (stub %llu, payload %llu, command table %llu)", (unsigned long long)app.footer.payload_offset,
+                   (unsigned long long)app.footer.payload_size, (unsigned long long)app.footer.table_size);
+        }
+        printf("\n");
+        if (header) {
+            printf("Codec: %s, payload hash %.12s, cache %s, %zu hot files\n\nCommands:\n", codec ? codec : "unknown",
+                   header->payload_hash, header->cache ? "on" : "off", hot_count);
+            for (uint32_t i = 0; i < command_count; i++) {
+                const AppCommand* command = commands[i];
+                const char* word = (const char*)(command + 1);
+                printf("  %u. [%s, %s]", i + 1, command->in_app_dir ? "application" : "cwd",
+                       command->use_shell ? "sh -c" : "direct");
+                for (uint32_t a = 0; a < command->argc && word < (const char*)(command + 1) + command->length; a++) {
+                    printf(" %s", word);
+                    word += strlen(word) + 1;
+                }
+                printf("\n");
+            }
+        }
+        printf("\nPayload: %zu entries (%llu files, %llu directories, %llu symlinks, %llu duplicates)\n", count,
+               totals[INSPECT_FILE], totals[INSPECT_DIRECTORY], totals[INSPECT_SYMLINK], totals[INSPECT_DUPLICATE]);
+        printf("  %llu bytes, %llu compressed (%.1f%%)\n", raw, compressed, raw ? compressed * 100.0 / raw : 100.0);
+        printf("  Estimated extraction: %.1f ms on one core, largest entry %.1f ms", cost / 1000.0, largest / 1000.0);
+        if (hot_count) {
+            printf(", before start-up %.1f ms", hot_cost / 1000.0);
+        }
+        printf("\n\nLargest directories:\n  %12s %12s %8s %9s  path\n", "compressed", "raw", "entries", "est. ms");
+        for (size_t i = 0; i < directory_count && i < INSPECT_TOP; i++) {
+            printf("  %12llu %12llu %8zu %9.1f  %.*s/\n", directories[i].compressed, directories[i].raw,
+                   directories[i].files, directories[i].cost_us / 1000.0, (int)directories[i].length,
+                   directories[i].path);
+        }
+        printf("\nLargest entries:\n  %12s %12s %8s %9s  path\n", "compressed", "raw", "method", "est. ms");
+        for (size_t i = 0; i < count && i < INSPECT_TOP; i++) {
+            const InspectItem* item = &items[i];
+            printf("  %12llu %12llu %8s %9.1f  %s%s%s%s%s\n", item->compressed, item->raw,
+                   method_name(item->entry->method), item->cost_us / 1000.0, item->path,
+                   item->kind == INSPECT_DUPLICATE ? " -> " : "", item->entry->link ? item->entry->link : "",
+                   item->kind == INSPECT_SYMLINK ? " (symlink)" : "", item->hot ? " (hot)" : "");
+        }
+        if (count > INSPECT_TOP || directory_count > INSPECT_TOP) {
+            printf("\n(--json lists every entry and directory)\n");
         }
     }
-    
-    printf("\"%s\" Function on build.path is not there! Error!\n", func_name);
-    return 0;
+
+    free(items);
+    free(directories);
+    free(commands);
+    free(hot);
+    lp_free_index(entries, count);
+    unmap_app_image(&app);
+    return 1;
+}
+
+// Argumentos de lightpath inspect: [FILE] [--json]
+int run_inspect(char** arguments, int count) {
+    const char* path = NULL;
+    int json = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(arguments[i], "--json") == 0) {
+            json = 1;
+        } else if (!path) {
+            path = arguments[i];
+        } else {
+            show_usage();
+            return 0;
+        }
+    }
+    return inspect_app(path, json);
 }
 
 void show_usage(void) {
     printf("LightPath usage, Error!\n");
+    printf("  lightpath [-j N]             Build the project\n");
+    printf("  lightpath [-j N] <function>  Run a function of build.path\n");
+    printf("  lightpath watch [function]   Rebuild on every change (then run the function)\n");
+    printf("  lightpath server             Keep build.path and source/ loaded for later calls here\n");
+    printf("  lightpath inspect [FILE]     List the payload, command table and extraction cost (--json)\n");
+    printf("  lightpath diff OLD NEW > P   Write a patch that turns lightpath_app OLD into NEW\n");
+    printf("  lightpath apply OLD P [OUT]  Rebuild NEW from OLD and the patch (default: replace OLD)\n");
+    printf("  --profile FILE               Write phase and command timings as JSON / Chrome trace\n");
+    printf("  --force                      Run functions with inputs/outputs even when up to date\n");
 }
 
-int main(int argc, char* argv[]) {
-    if (!file_exists("build.path")) {
-        printf("The file build.path is not on the directory, Error!\n");
-        return 1;
-    }
-    
-    LightPathProject project;
-    if (!parse_build_file("build.path", &project)) {
-        printf("Parse build.path failed, Error!\n");
-        return 1;
+// Opciones globales: -j N, -jN, --jobs N, --jobs=N, --profile FILE, --profile=FILE, --force
+int parse_arguments(int argc, char* argv[], char** arguments, int* argument_count) {
+    *argument_count = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* jobs_value = NULL;
+        if (strcmp(argv[i], "--profile") == 0) {
+            if (i + 1 >= argc) {
+                show_usage();
+                return 0;
+            }
+            profile_path = argv[++i];
+            continue;
+        } else if (strncmp(argv[i], "--profile=", 10) == 0 && argv[i][10]) {
+            profile_path = argv[i] + 10;
+            continue;
+        } else if (strcmp(argv[i], "--force") == 0) {
+            force_run = 1;
+            continue;
+        } else if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+            if (i + 1 >= argc) {
+                show_usage();
+                return 0;
+            }
+            jobs_value = argv[++i];
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            jobs_value = argv[i] + 2;
+        } else if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs_value = argv[i] + 7;
+        } else {
+            arguments[(*argument_count)++] = argv[i];
+            continue;
+        }
+
+        requested_jobs = atoi(jobs_value);
+        if (requested_jobs <= 0) {
+            show_usage();
+            return 0;
+        }
     }
-    
-    if (argc == 1) {
+    return 1;
+}
+
+// Ejecuta la petición con build.path ya cargado (en main o en lightpath server)
+int run_request(LightPathProject* project, char** arguments, int argument_count, ProfileMark total) {
+    const char* run_name = argument_count == 0 ? "build" : arguments[0];
+    int status;
+    // "watch", "inspect" y "server" son modos de lightpath salvo que build.path tenga una función con ese nombre
+    int watch = argument_count >= 1 && argument_count <= 2 && strcmp(arguments[0], "watch") == 0 &&
+                (argument_count == 2 || !find_function(project, "watch", 5));
+    int inspect = argument_count >= 1 && argument_count <= 3 && strcmp(arguments[0], "inspect") == 0;
+    if (argument_count == 0) {
         // Sin argumentos - construir proyecto
-        return build_project(&project) ? 0 : 1;
-    }
-    
-    if (argc == 2) {
-        char* command = argv[1];
+        status = build_project(project) ? 0 : 1;
+    } else if (inspect && !find_function(project, "inspect", 7)) {
+        status = run_inspect(arguments + 1, argument_count - 1) ? 0 : 1;
+    } else if (argument_count == 1 && strcmp(arguments[0], "server") == 0 && !find_function(project, "server", 6)) {
+        status = serve_project(project) ? 0 : 1;
+    } else if (watch) {
+        // Sólo vuelve si no se pudo empezar a vigilar
+        const char* function_name = argument_count == 2 ? arguments[1] : NULL;
+        if (function_name && (strcmp(function_name, "main") == 0 || strcmp(function_name, "build") == 0)) {
+            printf("\"%s\" Function is a pre-builded function, Error!\n", function_name);
+            return 1;
+        }
+        status = watch_project(project, function_name) ? 0 : 1;
+    } else if (argument_count == 1) {
+        char* command = arguments[0];
         
         if (strcmp(command, "main") == 0) {
             printf("\"main\" Function is a pre-builded function, Error!\n");
@@ -605,9 +8204,69 @@ int main(int argc, char* argv[]) {
         }
         
         // Ejecutar función personalizada
-        return run_custom_function(&project, command) ? 0 : 1;
+        status = run_custom_function(project, command) ? 0 : 1;
+    } else {
+        show_usage();
+        return 0;
+    }
+
+    char total_name[MAX_PATH_LENGTH];
+    snprintf(total_name, sizeof(total_name), "lightpath %s", run_name);
+    profile_end(total, total_name);
+    if (!write_profile(run_name, status)) {
+        status = 1;
+    }
+    return status;
+}
+
+int main(int argc, char* argv[]) {
+    // Si este ejecutable lleva un payload adjunto, actúa como lightpath_app
+    int app_status = run_embedded_app();
+    if (app_status >= 0) {
+        return app_status;
+    }
+
+    char** arguments = checked_realloc(NULL, sizeof(char*) * argc);
+    int argument_count;
+    if (!parse_arguments(argc, argv, arguments, &argument_count)) {
+        return 1;
+    }
+
+    // diff y apply trabajan sobre binarios ya construidos: no necesitan build.path
+    if (argument_count == 3 && strcmp(arguments[0], "diff") == 0) {
+        return diff_apps(arguments[1], arguments[2]) ? 0 : 1;
+    }
+    if ((argument_count == 3 || argument_count == 4) && strcmp(arguments[0], "apply") == 0) {
+        return apply_patch(arguments[1], arguments[2], argument_count == 4 ? arguments[3] : arguments[1]) ? 0 : 1;
+    }
+
+    // inspect tampoco; sin argumentos, una función "inspect" de build.path tiene prioridad
+    int inspect = argument_count >= 1 && argument_count <= 3 && strcmp(arguments[0], "inspect") == 0;
+    if (inspect && (argument_count > 1 || !file_exists("build.path"))) {
+        return run_inspect(arguments + 1, argument_count - 1) ? 0 : 1;
+    }
+
+    // Con lightpath server en marcha la petición se ejecuta allí (watch y server, aquí)
+    if (argument_count == 0 || (strcmp(arguments[0], "watch") != 0 && strcmp(arguments[0], "server") != 0)) {
+        int forwarded = forward_to_server(argc, argv);
+        if (forwarded != SERVER_REFUSED) {
+            return forwarded;
+        }
+    }
+
+    if (!file_exists("build.path")) {
+        printf("The file build.path is not on the directory, Error!\n");
+        return 1;
     }
     
-    show_usage();
-    return 0;
+    profile_origin_us = monotonic_us();
+    ProfileMark total = profile_begin();
+    ProfileMark phase = profile_begin();
+    LightPathProject project;
+    if (!load_project("build.path", &project)) {
+        printf("Parse build.path failed, Error!\n");
+        return 1;
+    }
+    profile_end(phase, "load build.path");
+    return run_request(&project, arguments, argument_count, total);
 }